@@ -32,8 +32,6 @@
 #include <allegro5/allegro_audio.h>
 #include <allegro5/internal/aintern_bitmap.h>
 
-#define SAMPLES_PER_BUFFER 1024
-
 ALLEGRO_EVENT_QUEUE *queue = NULL;
 ALLEGRO_TIMER *timer = NULL;
 ALLEGRO_DISPLAY *disp = NULL;
@@ -172,7 +170,7 @@ int main(int argc, char **argv)
     ALLEGRO_MONITOR_INFO info;
     ALLEGRO_EVENT event;
     float *abuf;
-    int i, w, h, ww, wh, redraw, running = 1;
+    int i, w, h, ww, wh, redraw, running = 1, samples = 0, periods = 0;
     char **infile = NULL, *fn;
     char s[5];
     uint8_t *ptr;
@@ -310,11 +308,12 @@ int main(int argc, char **argv)
 
     audio = al_install_audio() && al_reserve_samples(0);
     if(audio) {
-        stream = al_create_audio_stream(4, SAMPLES_PER_BUFFER, 44100, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_1);
+        meg4_audiogetbuf(&samples, &periods);
+        stream = al_create_audio_stream(periods, samples, 44100, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_1);
         if(!stream) { al_uninstall_audio(); audio = 0; } else
         if(!al_attach_audio_stream_to_mixer(stream, al_get_default_mixer())) { al_destroy_audio_stream(stream); al_uninstall_audio(); audio = 0; }
     }
-    if(verbose && audio) main_log(1, "audio opened %uHz, %u bits", 44100, 32);
+    if(verbose && audio) main_log(1, "audio opened %uHz, %u bits, %u x %u samples", 44100, 32, periods, samples);
 
     /* turn on the emulator */
     meg4_poweron(lng);
@@ -361,7 +360,7 @@ int main(int argc, char **argv)
             /* audio event */
             case ALLEGRO_EVENT_AUDIO_STREAM_FRAGMENT:
                 if((abuf = al_get_audio_stream_fragment(stream))) {
-                    meg4_audiofeed(abuf, SAMPLES_PER_BUFFER);
+                    meg4_audiofeed(abuf, samples);
                     al_set_audio_stream_fragment(stream, abuf);
                 }
             break;
@@ -931,6 +931,28 @@ void main_log(int lvl, const char* fmt, ...)
     __builtin_va_end(args);
 }
 
+/**
+ * Load the audio configuration, lines like "buffer=512", "periods=2" and "resampler=1" in audio.cfg
+ */
+void main_audiocfg(void)
+{
+    char *buf, *tmp, *s;
+    int len = 0;
+
+    if(!(buf = (char*)main_cfgload("audio.cfg", &len))) return;
+    /* config files are not necessarily zero terminated */
+    if(!(tmp = (char*)realloc(buf, len + 1))) { free(buf); return; }
+    buf = tmp; buf[len] = 0;
+    for(s = buf; *s; s++) {
+        if(!strncmp(s, "buffer=", 7)) meg4_audiobuf(atoi(s + 7), 0); else
+        if(!strncmp(s, "periods=", 8)) meg4_audiobuf(0, atoi(s + 8)); else
+        if(!strncmp(s, "resampler=", 10)) meg4_audioresampler(atoi(s + 10));
+        while(*s && *s != '\n') s++;
+        if(!*s) break;
+    }
+    free(buf);
+}
+
 /**
  * Parse the command line
  */
@@ -948,6 +970,7 @@ void main_parsecommandline(int argc, char **argv, char **lng, char ***infile)
     }
 #endif
     *infile = NULL;
+    main_audiocfg();
     for(i = 1; i < argc && argv && argv[i]; i++) {
         if(!memcmp(argv[i], "--help", 6) || !strcmp(argv[i], CLIFLAG "h") || !strcmp(argv[i], CLIFLAG "?")) goto usage;
         if(argv[i][0] == CLIFLAG[0]) {
@@ -955,6 +978,12 @@ void main_parsecommandline(int argc, char **argv, char **lng, char ***infile)
                 switch(argv[i][j]) {
                     case 'L': if(j == 1 && argv[i + 1]) { *lng = argv[++i]; j = 16; } else goto usage; break;
                     case 'd': if(j == 1 && argv[i + 1]) { main_floppydir = argv[++i]; j = 16; } else goto usage; break;
+                    case 't': if(j == 1 && argv[i + 1]) { meg4_gpuworkers(atoi(argv[++i])); j = 16; } else goto usage; break;
+                    case 'g': if(j == 1 && argv[i + 1]) { meg4_gpumem(atoi(argv[++i])); j = 16; } else goto usage; break;
+                    case 'r': if(j == 1 && argv[i + 1]) { meg4_gpuasync(atoi(argv[++i])); j = 16; } else goto usage; break;
+                    case 'a': if(j == 1 && argv[i + 1]) { meg4_audiobuf(atoi(argv[++i]), 0); j = 16; } else goto usage; break;
+                    case 'p': if(j == 1 && argv[i + 1]) { meg4_audiobuf(0, atoi(argv[++i])); j = 16; } else goto usage; break;
+                    case 'q': if(j == 1 && argv[i + 1]) { meg4_audioresampler(atoi(argv[++i])); j = 16; } else goto usage; break;
                     case 'v': verbose++; break;
 #ifdef DEBUG
                     case 's': strace++; break;
@@ -969,7 +998,7 @@ usage:                  main_hdr();
 #ifndef __WIN32__
                             "[" CLIFLAG "z] "
 #endif
-                            "[" CLIFLAG "n] [" CLIFLAG "v|" CLIFLAG "vv|" CLIFLAG "vvv] "
+                            "[" CLIFLAG "n] [" CLIFLAG "t <n>] [" CLIFLAG "r <0|1>] [" CLIFLAG "g <kb>] [" CLIFLAG "a <samples>] [" CLIFLAG "p <n>] [" CLIFLAG "v|" CLIFLAG "vv|" CLIFLAG "vvv] "
 #ifdef DEBUG
                             "[" CLIFLAG "s]"
 #endif
@@ -55,6 +55,10 @@ endif
 ifneq ($(EMBED),)
  CFLAGS += -DEMBED=1
 endif
+ifneq ($(THREADS),)
+ CFLAGS += -DMEG4_THREADS=1
+ LIBS += -lpthread
+endif
 ifeq ("$(PACKAGE)","Win")
  OBJS += resource.o
 endif
@@ -63,9 +67,9 @@ all: libmeg4 $(TARGET)
 
 libmeg4:
 ifeq ($(USE_EMCC),)
-	@make -C ../../src todo all DEBUG=$(DEBUG) EMBED=$(EMBED) NOEDITORS=$(NOEDITORS) NOLUA=$(NOLUA)
+	@make -C ../../src todo all DEBUG=$(DEBUG) EMBED=$(EMBED) NOEDITORS=$(NOEDITORS) NOLUA=$(NOLUA) THREADS=$(THREADS)
 else
-	CC=emcc USE_EMCC=1 make -C ../../src all DEBUG=$(DEBUG) EMBED=$(EMBED) NOEDITORS=$(NOEDITORS) NOLUA=$(NOLUA)
+	CC=emcc USE_EMCC=1 make -C ../../src all DEBUG=$(DEBUG) EMBED=$(EMBED) NOEDITORS=$(NOEDITORS) NOLUA=$(NOLUA) THREADS=$(THREADS)
 endif
 
 resource.o:
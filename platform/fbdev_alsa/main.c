@@ -24,6 +24,7 @@
 #define _POSIX_C_SOURCE 199309L    /* needed for timespec and nanosleep() */
 #include <time.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <dirent.h>
 #include <unistd.h>
 #include <pthread.h>
@@ -40,28 +41,27 @@
 #include <sound/asound.h>
 #include "meg4.h"
 
-#define ALSA_BUFFER_SIZE 4096
-#define ALSA_PERIOD_SIZE 1024
+#define ALSA_MAX_PERIOD 8192
 
 enum { KBD, MOUSE, PAD };
 
-int fb = -1, en = 0, ed[256], *sax = NULL, *say = NULL;
+int fb = -1, en = 0, ed[256];
 struct fb_fix_screeninfo fb_fix;
 struct fb_var_screeninfo fb_var, fb_orig;
 uint32_t *scrbuf = NULL;
 uint8_t *fbuf = NULL, *foffs, *ffull;
 struct termios oldt, newt;
 int afd = -1, audio = 0;
-volatile unsigned int period_size, boundary;
+volatile unsigned int period_size, buffer_size, boundary;
 struct snd_pcm_mmap_status *mmap_status;
 struct snd_pcm_mmap_control *mmap_control;
-float abuf[ALSA_BUFFER_SIZE];
-int16_t ibuf[2*ALSA_BUFFER_SIZE];
+float abuf[ALSA_MAX_PERIOD];
+int16_t ibuf[2*ALSA_MAX_PERIOD];
 pthread_t th = 0;
 void sync(void);
 
 int main_w = 0, main_h = 0, main_exit = 0, main_alt = 0, main_sh = 0, main_meta = 0, main_caps = 0, main_keymap[512], main_kbd = 0;
-int win_f = 0, win_w, win_h, win_fw, win_fh, win_dp, win_dp2, win_dp3, win_dp4, win_dp5, win_dp6, win_dp7, win_dp8;
+int win_f = 0, win_w, win_h, win_fw, win_fh;
 void main_delay(int msec);
 /* keyboard layout mapping */
 const char *main_kbdlayout[2][128*4] = { {
@@ -89,6 +89,7 @@ const char *main_kbdlayout[2][128*4] = { {
 #define meg4_showcursor()
 #define meg4_hidecursor()
 #include "../common.h"
+#include "../scaler.h"
 
 /* helpers for hw_params */
 static struct snd_interval *param_to_interval(struct snd_pcm_hw_params *p, int n)
@@ -177,8 +178,7 @@ void main_quit(void)
         if(afd > 0) { ioctl(afd, SNDRV_PCM_IOCTL_DRAIN); close(afd); afd = -1; }
     }
     if(scrbuf) { free(scrbuf); scrbuf = NULL; }
-    if(sax) { free(sax); sax = NULL; }
-    if(say) { free(say); say = NULL; }
+    scaler_free();
     if(fbuf) { memset(fbuf, 0, fb_fix.smem_len); msync(fbuf, fb_fix.smem_len, MS_SYNC); munmap(fbuf, fb_fix.smem_len); fbuf = NULL; }
     if(fb >= 0) {
         if(fb_orig.bits_per_pixel != 32) ioctl(fb, FBIOPUT_VSCREENINFO, &fb_orig);
@@ -275,10 +275,7 @@ void main_win(void)
     if(win_fh > main_h) { win_fh = main_h; win_fw = 640 * main_h / 400; }
     x = (main_w - win_fw) >> 1; y = (main_h - win_fh) >> 1;
     ffull = fbuf + y * fb_fix.line_length + (x << 2);
-    l = (win_fw > win_fh ? win_fw : win_fh) + 1;
-    sax = (int*)malloc(l * sizeof(int)); say = (int*)malloc(l * sizeof(int));
-    win_dp = fb_fix.line_length >> 2; win_dp2 = win_dp << 1; win_dp3 = win_dp * 3; win_dp4 = win_dp << 2;
-    win_dp5 = win_dp * 5; win_dp6 = win_dp * 6; win_dp7 = win_dp * 7; win_dp8 = win_dp << 3;
+    scaler_threads(sysconf(_SC_NPROCESSORS_ONLN));
 }
 
 /**
@@ -339,7 +336,7 @@ static void *main_audio(void *data)
 
     (void)data;
     while(period_size) {
-        numframes = period_size;
+        numframes = period_size < ALSA_MAX_PERIOD ? period_size : ALSA_MAX_PERIOD;
         meg4_audiofeed((float*)abuf, numframes);
         for(i = j = 0; i < numframes; i++, j += 2)
             ibuf[j] = ibuf[j + 1] = abuf[i] * 32767.0f;
@@ -349,12 +346,16 @@ static void *main_audio(void *data)
             xfer.frames = numframes > period_size ? period_size : numframes;
             xfer.result = 0;
             if(!(ret = ioctl(afd, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &xfer))) {
-                avail = mmap_status->hw_ptr + ALSA_BUFFER_SIZE - mmap_control->appl_ptr;
+                avail = mmap_status->hw_ptr + buffer_size - mmap_control->appl_ptr;
                 if(avail < 0) avail += boundary; else
                 if((unsigned int)avail >= boundary) avail -= boundary;
                 numframes -= xfer.result;
                 buf += xfer.result;
-            } else if(ret < 0) break;
+            } else if(ret < 0) {
+                /* underrun, the device has stopped, restart it and write the rest */
+                if(errno == EPIPE && !ioctl(afd, SNDRV_PCM_IOCTL_PREPARE)) { meg4_audiounderrun(); continue; }
+                break;
+            }
         } while(period_size && numframes > 0);
     }
     return NULL;
@@ -375,198 +376,21 @@ void main_delay(int msec)
  */
 void main_fix_scaler(void)
 {
-    uint32_t *src, *dst;
-    int i, j, k, l, m, p;
-
-    src = scrbuf;
-    dst = (uint32_t*)foffs;
-    /* optimized upscaler for 1x, 2x, 3x, 4x, 6x and 8x */
-    p = win_h / meg4.screen.h;
-    if(!fb_var.red.offset) {
-        /* RGBA */
-        switch(p) {
-            case 1:
-                for(j = 0, i = meg4.screen.w << 2; j < meg4.screen.h; j++, src += 640, dst += win_dp)
-                    memcpy(dst, src, i);
-            break;
-            case 2:
-                for(j = 0; j < meg4.screen.h; j++, src += 640, dst += win_dp2)
-                    for(i = k = 0; i < meg4.screen.w; i++, k += 2)
-                        dst[k] = dst[k + 1] = dst[k + win_dp] = dst[k + win_dp + 1] = src[i];
-            break;
-            case 3:
-                for(j = 0; j < meg4.screen.h; j++, src += 640, dst += win_dp3)
-                    for(i = k = 0; i < meg4.screen.w; i++, k += 3)
-                        dst[k] = dst[k + 1] = dst[k + 2] =
-                        dst[k + win_dp] = dst[k + win_dp + 1] = dst[k + win_dp + 2] =
-                        dst[k + win_dp2] = dst[k + win_dp2 + 1] = dst[k + win_dp2 + 2] = src[i];
-            break;
-            case 4:
-                for(j = 0; j < meg4.screen.h; j++, src += 640, dst += win_dp4)
-                    for(i = k = 0; i < meg4.screen.w; i++, k += 4)
-                        dst[k] = dst[k + 1] = dst[k + 2] = dst[k + 3] =
-                        dst[k + win_dp] = dst[k + win_dp + 1] = dst[k + win_dp + 2] = dst[k + win_dp + 3] =
-                        dst[k + win_dp2] = dst[k + win_dp2 + 1] = dst[k + win_dp2 + 2] = dst[k + win_dp2 + 3] =
-                        dst[k + win_dp3] = dst[k + win_dp3 + 1] = dst[k + win_dp3 + 2] = dst[k + win_dp3 + 3] = src[i];
-            break;
-            case 6:
-                for(j = 0; j < meg4.screen.h; j++, src += 640, dst += win_dp6)
-                    for(i = k = 0; i < meg4.screen.w; i++, k += 6)
-                        dst[k] = dst[k + 1] = dst[k + 2] = dst[k + 3] = dst[k + 4] = dst[k + 5] =
-                        dst[k + win_dp] = dst[k + win_dp + 1] = dst[k + win_dp + 2] = dst[k + win_dp + 3] = dst[k + win_dp + 4] = dst[k + win_dp + 5] =
-                        dst[k + win_dp2] = dst[k + win_dp2 + 1] = dst[k + win_dp2 + 2] = dst[k + win_dp2 + 3] =
-                        dst[k + win_dp2 + 4] = dst[k + win_dp2 + 5] =
-                        dst[k + win_dp3] = dst[k + win_dp3 + 1] = dst[k + win_dp3 + 2] = dst[k + win_dp3 + 3] =
-                        dst[k + win_dp3 + 4] = dst[k + win_dp3 + 5] =
-                        dst[k + win_dp4] = dst[k + win_dp4 + 1] = dst[k + win_dp4 + 2] = dst[k + win_dp4 + 3] =
-                        dst[k + win_dp4 + 4] = dst[k + win_dp4 + 5] =
-                        dst[k + win_dp5] = dst[k + win_dp5 + 1] = dst[k + win_dp5 + 2] = dst[k + win_dp5 + 3] =
-                        dst[k + win_dp5 + 4] = dst[k + win_dp5 + 5] = src[i];
-            break;
-            case 8:
-                for(j = 0; j < meg4.screen.h; j++, src += 640, dst += win_dp8)
-                    for(i = k = 0; i < meg4.screen.w; i++, k += 8)
-                        dst[k] = dst[k + 1] = dst[k + 2] = dst[k + 3] = dst[k + 4] = dst[k + 5] = dst[k + 6] = dst[k + 7] =
-                        dst[k + win_dp] = dst[k + win_dp + 1] = dst[k + win_dp + 2] = dst[k + win_dp + 3] =
-                        dst[k + win_dp + 4] = dst[k + win_dp + 5] = dst[k + win_dp + 6] = dst[k + win_dp + 7] =
-                        dst[k + win_dp2] = dst[k + win_dp2 + 1] = dst[k + win_dp2 + 2] = dst[k + win_dp2 + 3] =
-                        dst[k + win_dp2 + 4] = dst[k + win_dp2 + 5] = dst[k + win_dp2 + 6] = dst[k + win_dp2 + 7] =
-                        dst[k + win_dp3] = dst[k + win_dp3 + 1] = dst[k + win_dp3 + 2] = dst[k + win_dp3 + 3] =
-                        dst[k + win_dp3 + 4] = dst[k + win_dp3 + 5] = dst[k + win_dp3 + 6] = dst[k + win_dp3 + 7] =
-                        dst[k + win_dp4] = dst[k + win_dp4 + 1] = dst[k + win_dp4 + 2] = dst[k + win_dp4 + 3] =
-                        dst[k + win_dp4 + 4] = dst[k + win_dp4 + 5] = dst[k + win_dp4 + 6] = dst[k + win_dp4 + 7] =
-                        dst[k + win_dp5] = dst[k + win_dp5 + 1] = dst[k + win_dp5 + 2] = dst[k + win_dp5 + 3] =
-                        dst[k + win_dp5 + 4] = dst[k + win_dp5 + 5] = dst[k + win_dp5 + 6] = dst[k + win_dp5 + 7] =
-                        dst[k + win_dp6] = dst[k + win_dp6 + 1] = dst[k + win_dp6 + 2] = dst[k + win_dp6 + 3] =
-                        dst[k + win_dp6 + 4] = dst[k + win_dp6 + 5] = dst[k + win_dp6 + 6] = dst[k + win_dp6 + 7] =
-                        dst[k + win_dp7] = dst[k + win_dp7 + 1] = dst[k + win_dp7 + 2] = dst[k + win_dp7 + 3] =
-                        dst[k + win_dp7 + 4] = dst[k + win_dp7 + 5] = dst[k + win_dp7 + 6] = dst[k + win_dp7 + 7] = src[i];
-            break;
-            default:
-                for(j = 0; j < meg4.screen.h; j++, src += 640)
-                    for(m = 0; m < p; m++, dst += win_dp)
-                        for(i = k = 0; i < meg4.screen.w; i++)
-                            for(l = 0; l < p; l++, k++)
-                                dst[k] = src[i];
-            break;
-        }
-    } else {
-        /* BGRA */
-        switch(p) {
-            case 1:
-                for(j = 0; j < meg4.screen.h; j++, src += 640, dst += win_dp)
-                    for(i = 0; i < meg4.screen.w; i++)
-                        dst[i] = ((src[i] & 0xff) << 16) | (src[i] & 0xff00) | ((src[i] >> 16) & 0xff);
-            break;
-            case 2:
-                for(j = 0; j < meg4.screen.h; j++, src += 640, dst += win_dp2)
-                    for(i = k = 0; i < meg4.screen.w; i++, k += 2)
-                        dst[k] = dst[k + 1] = dst[k + win_dp] = dst[k + win_dp + 1] =
-                            ((src[i] & 0xff) << 16) | (src[i] & 0xff00) | ((src[i] >> 16) & 0xff);
-            break;
-            case 3:
-                for(j = 0; j < meg4.screen.h; j++, src += 640, dst += win_dp3)
-                    for(i = k = 0; i < meg4.screen.w; i++, k += 3)
-                        dst[k] = dst[k + 1] = dst[k + 2] =
-                        dst[k + win_dp] = dst[k + win_dp + 1] = dst[k + win_dp + 2] =
-                        dst[k + win_dp2] = dst[k + win_dp2 + 1] = dst[k + win_dp2 + 2] =
-                            ((src[i] & 0xff) << 16) | (src[i] & 0xff00) | ((src[i] >> 16) & 0xff);
-            break;
-            case 4:
-                for(j = 0; j < meg4.screen.h; j++, src += 640, dst += win_dp4)
-                    for(i = k = 0; i < meg4.screen.w; i++, k += 4)
-                        dst[k] = dst[k + 1] = dst[k + 2] = dst[k + 3] =
-                        dst[k + win_dp] = dst[k + win_dp + 1] = dst[k + win_dp + 2] = dst[k + win_dp + 3] =
-                        dst[k + win_dp2] = dst[k + win_dp2 + 1] = dst[k + win_dp2 + 2] = dst[k + win_dp2 + 3] =
-                        dst[k + win_dp3] = dst[k + win_dp3 + 1] = dst[k + win_dp3 + 2] = dst[k + win_dp3 + 3] =
-                            ((src[i] & 0xff) << 16) | (src[i] & 0xff00) | ((src[i] >> 16) & 0xff);
-            break;
-            case 6:
-                for(j = 0; j < meg4.screen.h; j++, src += 640, dst += win_dp6)
-                    for(i = k = 0; i < meg4.screen.w; i++, k += 6)
-                        dst[k] = dst[k + 1] = dst[k + 2] = dst[k + 3] = dst[k + 4] = dst[k + 5] =
-                        dst[k + win_dp] = dst[k + win_dp + 1] = dst[k + win_dp + 2] = dst[k + win_dp + 3] = dst[k + win_dp + 4] = dst[k + win_dp + 5] =
-                        dst[k + win_dp2] = dst[k + win_dp2 + 1] = dst[k + win_dp2 + 2] = dst[k + win_dp2 + 3] =
-                        dst[k + win_dp2 + 4] = dst[k + win_dp2 + 5] =
-                        dst[k + win_dp3] = dst[k + win_dp3 + 1] = dst[k + win_dp3 + 2] = dst[k + win_dp3 + 3] =
-                        dst[k + win_dp3 + 4] = dst[k + win_dp3 + 5] =
-                        dst[k + win_dp4] = dst[k + win_dp4 + 1] = dst[k + win_dp4 + 2] = dst[k + win_dp4 + 3] =
-                        dst[k + win_dp4 + 4] = dst[k + win_dp4 + 5] =
-                        dst[k + win_dp5] = dst[k + win_dp5 + 1] = dst[k + win_dp5 + 2] = dst[k + win_dp5 + 3] =
-                        dst[k + win_dp5 + 4] = dst[k + win_dp5 + 5] =
-                            ((src[i] & 0xff) << 16) | (src[i] & 0xff00) | ((src[i] >> 16) & 0xff);
-            break;
-            case 8:
-                for(j = 0; j < meg4.screen.h; j++, src += 640, dst += win_dp8)
-                    for(i = k = 0; i < meg4.screen.w; i++, k += 8)
-                        dst[k] = dst[k + 1] = dst[k + 2] = dst[k + 3] = dst[k + 4] = dst[k + 5] = dst[k + 6] = dst[k + 7] =
-                        dst[k + win_dp] = dst[k + win_dp + 1] = dst[k + win_dp + 2] = dst[k + win_dp + 3] =
-                        dst[k + win_dp + 4] = dst[k + win_dp + 5] = dst[k + win_dp + 6] = dst[k + win_dp + 7] =
-                        dst[k + win_dp2] = dst[k + win_dp2 + 1] = dst[k + win_dp2 + 2] = dst[k + win_dp2 + 3] =
-                        dst[k + win_dp2 + 4] = dst[k + win_dp2 + 5] = dst[k + win_dp2 + 6] = dst[k + win_dp2 + 7] =
-                        dst[k + win_dp3] = dst[k + win_dp3 + 1] = dst[k + win_dp3 + 2] = dst[k + win_dp3 + 3] =
-                        dst[k + win_dp3 + 4] = dst[k + win_dp3 + 5] = dst[k + win_dp3 + 6] = dst[k + win_dp3 + 7] =
-                        dst[k + win_dp4] = dst[k + win_dp4 + 1] = dst[k + win_dp4 + 2] = dst[k + win_dp4 + 3] =
-                        dst[k + win_dp4 + 4] = dst[k + win_dp4 + 5] = dst[k + win_dp4 + 6] = dst[k + win_dp4 + 7] =
-                        dst[k + win_dp5] = dst[k + win_dp5 + 1] = dst[k + win_dp5 + 2] = dst[k + win_dp5 + 3] =
-                        dst[k + win_dp5 + 4] = dst[k + win_dp5 + 5] = dst[k + win_dp5 + 6] = dst[k + win_dp5 + 7] =
-                        dst[k + win_dp6] = dst[k + win_dp6 + 1] = dst[k + win_dp6 + 2] = dst[k + win_dp6 + 3] =
-                        dst[k + win_dp6 + 4] = dst[k + win_dp6 + 5] = dst[k + win_dp6 + 6] = dst[k + win_dp6 + 7] =
-                        dst[k + win_dp7] = dst[k + win_dp7 + 1] = dst[k + win_dp7 + 2] = dst[k + win_dp7 + 3] =
-                        dst[k + win_dp7 + 4] = dst[k + win_dp7 + 5] = dst[k + win_dp7 + 6] = dst[k + win_dp7 + 7] =
-                            ((src[i] & 0xff) << 16) | (src[i] & 0xff00) | ((src[i] >> 16) & 0xff);
-            break;
-            default:
-                for(j = 0; j < meg4.screen.h; j++, src += 640)
-                    for(m = 0; m < p; m++, dst += win_dp)
-                        for(i = k = 0; i < meg4.screen.w; i++)
-                            for(l = 0; l < p; l++, k++)
-                                dst[k] = ((src[i] & 0xff) << 16) | (src[i] & 0xff00) | ((src[i] >> 16) & 0xff);
-            break;
-        }
-    }
+    scaler_integer((uint32_t*)foffs, fb_fix.line_length, scrbuf, meg4.screen.w, meg4.screen.h, 640 * 4,
+        win_h / meg4.screen.h, fb_var.red.offset != 0);
 }
 
 /**
- * Display screen with arbitrary scaler (fullscreen mode, might be blurry, linear interpolation)
+ * Display screen with arbitrary scaler (fullscreen mode, nearest with -n, otherwise linear interpolation)
  */
 void main_arb_scaler(void)
 {
-    uint8_t b[4];
-    uint32_t *src, *dst, *c00, *c01, *c10, *c11, *csp, *dp, *ep;
-    int o = 0, x, y, sx, sy, *csax, *csay, csx, csy, ex, ey, t1, t2, sstep, lx, ly, l;
-    int sw = meg4.screen.w, sh = meg4.screen.h, sp = 640, w = win_fw, h = win_fh, p = fb_fix.line_length;
-
-    src = scrbuf;
-    dst = (uint32_t*)ffull;
-    sx = (int) (65536.0 * (float)sw / (float)w); sy = (int) (65536.0 * (float)sh / (float)h);
-    csp = src; ep = src + sp * sh - 1; dp = (uint32_t*)((uint8_t*)dst + o);
-    csx = 0; csax = sax; for(x = 0; x <= w; x++) { *csax = csx; csax++; csx &= 0xffff; csx += sx; }
-    csy = 0; csay = say; for(y = 0; y <= h; y++) { *csay = csy; csay++; csy &= 0xffff; csy += sy; }
-    csay = say; ly = 0;
-    for(y = l = 0; y < h; y++) {
-        c00 = csp; c01 = csp; c01++; c10 = csp; c10 += sp; c11 = c10; c11++; csax = sax; lx = 0;
-        for(x = 0; x < w - 1; x++) {
-            if(c00 > ep) { c00 = ep; } if(c01 > ep) { c01 = ep; } if(c10 > ep) { c10 = ep; } if(c11 > ep) { c11 = ep; }
-            ex = (*csax & 0xffff); ey = (*csay & 0xffff);
-            t1 = (((((*c01 >> 24) - (*c00 >> 24)) * ex) >> 16) + (*c00 >> 24)) & 0xff;
-            t2 = (((((*c11 >> 24) - (*c10 >> 24)) * ex) >> 16) + (*c10 >> 24)) & 0xff;
-            b[3] = ((((t2 - t1) * ey) >> 16) + t1); if(b[3] == 254) b[3] = 255;
-            t1 = (((((*c01 & 0xff) - (*c00 & 0xff)) * ex) >> 16) + (*c00 & 0xff)) & 0xff;
-            t2 = (((((*c11 & 0xff) - (*c10 & 0xff)) * ex) >> 16) + (*c10 & 0xff)) & 0xff;
-            b[0] = ((((t2 - t1) * ey) >> 16) + t1);
-            t1 = ((((((*c01 >> 8) & 0xff) - ((*c00 >> 8) & 0xff)) * ex) >> 16) + ((*c00 >> 8) & 0xff)) & 0xff;
-            t2 = ((((((*c11 >> 8) & 0xff) - ((*c10 >> 8) & 0xff)) * ex) >> 16) + ((*c10 >> 8) & 0xff)) & 0xff;
-            b[1] = ((((t2 - t1) * ey) >> 16) + t1);
-            t1 = ((((((*c01 >> 16) & 0xff) - ((*c00 >> 16) & 0xff)) * ex) >> 16) + ((*c00 >> 16) & 0xff)) & 0xff;
-            t2 = ((((((*c11 >> 16) & 0xff) - ((*c10 >> 16) & 0xff)) * ex) >> 16) + ((*c10 >> 16) & 0xff)) & 0xff;
-            b[2] = ((((t2 - t1) * ey) >> 16) + t1);
-            *dp = !fb_var.red.offset ? /* RGBA */ *((uint32_t*)b) : /* BGRA */ (uint32_t)((b[0] << 16) | (b[1] << 8) | b[2]);
-            dp++; csax++; if(*csax > 0) { sstep = (*csax >> 16); lx += sstep; if(lx < sw) { c00 += sstep; c01 += sstep; c10 += sstep; c11 += sstep; } }
-        }
-        csay++; if(*csay > 0) { sstep = (*csay >> 16); ly += sstep; if(ly < sh) csp += (sstep * sp); }
-        o += p; dp = (uint32_t*)((uint8_t*)dst + o);
-    }
+    if(nearest)
+        scaler_nearest((uint32_t*)ffull, win_fw, win_fh, fb_fix.line_length, scrbuf, meg4.screen.w, meg4.screen.h, 640 * 4,
+            fb_var.red.offset != 0);
+    else
+        scaler_bilinear((uint32_t*)ffull, win_fw, win_fh, fb_fix.line_length, scrbuf, meg4.screen.w, meg4.screen.h, 640 * 4,
+            fb_var.red.offset != 0);
 }
 
 /**
@@ -729,19 +553,22 @@ int main(int argc, char **argv)
         param_init(&params);
         param_set_mask(&params, SNDRV_PCM_HW_PARAM_ACCESS, SNDRV_PCM_ACCESS_RW_INTERLEAVED);
         param_set_mask(&params, SNDRV_PCM_HW_PARAM_FORMAT, SNDRV_PCM_FORMAT_S16_LE);
-        param_set_min(&params, SNDRV_PCM_HW_PARAM_BUFFER_SIZE, ALSA_BUFFER_SIZE);
-        param_set_min(&params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE, ALSA_PERIOD_SIZE);
-        param_set_int(&params, SNDRV_PCM_HW_PARAM_PERIODS, ALSA_BUFFER_SIZE / ALSA_PERIOD_SIZE);
+        meg4_audiogetbuf(&k, &n);
+        param_set_min(&params, SNDRV_PCM_HW_PARAM_BUFFER_SIZE, k * n);
+        param_set_min(&params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE, k);
+        param_set_int(&params, SNDRV_PCM_HW_PARAM_PERIODS, n);
         param_set_int(&params, SNDRV_PCM_HW_PARAM_RATE, 44100);
         param_set_int(&params, SNDRV_PCM_HW_PARAM_CHANNELS, 2);
         if(ioctl(afd, SNDRV_PCM_IOCTL_HW_PARAMS, &params)) { close(afd); afd = -1; goto noaudio; }
         period_size = param_get_int(&params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
+        buffer_size = param_get_int(&params, SNDRV_PCM_HW_PARAM_BUFFER_SIZE);
+        if(!buffer_size) buffer_size = period_size * n;
         memset(&spar, 0, sizeof(spar));
         spar.tstamp_mode = SNDRV_PCM_TSTAMP_ENABLE;
         spar.period_step = 1;
         spar.avail_min = period_size;
-        spar.start_threshold = ALSA_BUFFER_SIZE - period_size;
-        spar.stop_threshold = ALSA_BUFFER_SIZE;
+        spar.start_threshold = buffer_size - period_size;
+        spar.stop_threshold = buffer_size;
         spar.xfer_align = period_size / 2; /* for old kernels */
         if(ioctl(afd, SNDRV_PCM_IOCTL_SW_PARAMS, &spar)) { close(afd); afd = -1; goto noaudio; }
         boundary = spar.boundary;
@@ -783,7 +610,7 @@ int main(int argc, char **argv)
         }
     }
 noaudio:
-    if(verbose && audio) main_log(1, "audio opened %uHz, %u bits", rrate, 16);
+    if(verbose && audio) main_log(1, "audio opened %uHz, %u bits, %u x %u samples", rrate, 16, buffer_size / period_size, period_size);
 
     scrbuf = (uint32_t*)malloc(640 * 400 * sizeof(uint32_t));
     if(!scrbuf) {
@@ -318,7 +318,8 @@ void main_osk_hide(void)
 static int main_audio(const void *inp, void *out, long unsigned int framesPerBuffer, const PaStreamCallbackTimeInfo *info,
     PaStreamCallbackFlags flags, void *ctx)
 {
-    (void)inp; (void)info; (void)flags; (void)ctx;
+    (void)inp; (void)info; (void)ctx;
+    if(flags & paOutputUnderflow) meg4_audiounderrun();
     meg4_audiofeed((float*)out, framesPerBuffer);
     return 0;
 }
@@ -387,6 +388,7 @@ int main(int argc, char **argv)
     uint32_t ticks;
     uint8_t *ptr;
     FILE *out, *err;
+    PaStreamParameters opar;
 #ifdef __WIN32__
     char *lng = main_lng;
 #else
@@ -550,12 +552,21 @@ int main(int argc, char **argv)
         , "w");
     /* initialize the audio */
     audio = (Pa_Initialize() == paNoError) ? 1 : 0; pa = NULL;
-    if(audio && (Pa_OpenDefaultStream(&pa, 0, 1, paFloat32, 44100, 4096, main_audio, NULL) != paNoError || !pa)) {
-        Pa_Terminate(); audio = 0; pa = NULL;
+    if(audio) {
+        /* the default stream would use the device's high latency, ask for what's configured instead */
+        meg4_audiogetbuf(&w, &h);
+        memset(&opar, 0, sizeof(opar));
+        opar.device = Pa_GetDefaultOutputDevice();
+        opar.channelCount = 1;
+        opar.sampleFormat = paFloat32;
+        opar.suggestedLatency = (PaTime)(w * h) / 44100.0;
+        if(opar.device == paNoDevice || Pa_OpenStream(&pa, NULL, &opar, 44100, w, paNoFlag, main_audio, NULL) != paNoError || !pa) {
+            Pa_Terminate(); audio = 0; pa = NULL;
+        }
     }
     /* restore stdout, stderr */
     fclose(stderr); stdout = out; stderr = err;
-    if(verbose && audio) main_log(1, "audio opened %uHz, %u bits", 44100, 32);
+    if(verbose && audio) main_log(1, "audio opened %uHz, %u bits, %u samples", 44100, 32, w);
     /* initialize screen and other stuff */
     if(!glfwInit()) {
         main_log(0, "unable to initialize GLFW");
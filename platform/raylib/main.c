@@ -312,12 +312,13 @@ int main(int argc, char **argv)
 
     InitAudioDevice();
     if((audio = IsAudioDeviceReady())) {
-        SetAudioStreamBufferSizeDefault(4096);
+        meg4_audiogetbuf(&i, NULL);
+        SetAudioStreamBufferSizeDefault(i);
         stream = LoadAudioStream(44100, 32, 1);
         if(!stream.sampleSize) { CloseAudioDevice(); audio = 0; }
         else SetAudioStreamCallback(stream, main_audio);
     }
-    if(verbose && audio) main_log(1, "audio opened %uHz, %u bits", 44100, 32);
+    if(verbose && audio) main_log(1, "audio opened %uHz, %u bits, %u samples", 44100, 32, i);
     /* turn on the emulator */
     meg4_poweron(lng);
 #ifndef NOEDITORS
@@ -0,0 +1,420 @@
+/*
+ * meg4/platform/scaler.h
+ *
+ * Copyright (C) 2023 bzt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @brief Software scalers for the platforms that have to put the screen on a framebuffer themselves
+ *
+ * Nearest, integer (pixel perfect) and bilinear scaling of a 32 bit RGBA image, optionally converting it to BGRA on the
+ * fly. The inner loops have SSE2 and NEON variants (define SCALER_NOSIMD to use plain C everywhere, they give the very
+ * same result), and with MEG4_THREADS the destination is split into horizontal bands which are scaled in parallel.
+ * Source and destination pitches are in bytes, just like with meg4_redraw().
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef SCALER_NOSIMD
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SCALER_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SCALER_NEON 1
+#endif
+#endif
+#ifdef MEG4_THREADS
+#include <pthread.h>
+#endif
+
+#define SCALER_MAXTHREADS 8
+#define SCALER_SWAP(c) ((((c) & 0xff) << 16) | ((c) & 0xff00) | (((c) >> 16) & 0xff))
+
+typedef struct {
+    uint32_t *dst, *src, *tmp;
+    int dw, dh, dp, sw, sh, sp, f, bgra, y0, y1;
+} scaler_job_t;
+
+static scaler_job_t scaler_jobs[SCALER_MAXTHREADS];
+static uint32_t *scaler_buf = NULL;
+static int *scaler_tbl = NULL, scaler_buflen = 0, scaler_tbllen = 0, scaler_tblkey = 0, scaler_num = 1;
+#ifdef MEG4_THREADS
+static pthread_t scaler_thr[SCALER_MAXTHREADS];
+static pthread_mutex_t scaler_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scaler_cnd = PTHREAD_COND_INITIALIZER, scaler_fin = PTHREAD_COND_INITIALIZER;
+static int scaler_run = 0, scaler_gen = 0, scaler_done = 0, scaler_quit = 0;
+static void (*scaler_fn)(scaler_job_t*) = NULL;
+#endif
+
+/**
+ * Copy a row of pixels, each repeated f times, converting to BGRA if needed
+ */
+static void scaler_row(uint32_t *d, uint32_t *s, int n, int f, int bgra)
+{
+    uint32_t c;
+    int i = 0, k;
+#ifdef SCALER_SSE2
+    int m;
+    __m128i v, b, m0 = _mm_set1_epi32(0xff), m1 = _mm_set1_epi32(0xff00);
+#define SCALER_SWAP4(v) _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(v, m0), 16), _mm_and_si128(v, m1)), \
+    _mm_and_si128(_mm_srli_epi32(v, 16), m0))
+    for(; i + 4 <= n; i += 4, d += 4 * f) {
+        v = _mm_loadu_si128((__m128i*)(s + i));
+        if(bgra) v = SCALER_SWAP4(v);
+        switch(f) {
+            case 1: _mm_storeu_si128((__m128i*)d, v); break;
+            case 2:
+                _mm_storeu_si128((__m128i*)d, _mm_unpacklo_epi32(v, v));
+                _mm_storeu_si128((__m128i*)(d + 4), _mm_unpackhi_epi32(v, v));
+            break;
+            case 3:
+                _mm_storeu_si128((__m128i*)d, _mm_shuffle_epi32(v, 0x40));
+                _mm_storeu_si128((__m128i*)(d + 4), _mm_shuffle_epi32(v, 0xA5));
+                _mm_storeu_si128((__m128i*)(d + 8), _mm_shuffle_epi32(v, 0xFE));
+            break;
+            default:
+                for(k = 0; k < 4; k++, v = _mm_srli_si128(v, 4)) {
+                    b = _mm_shuffle_epi32(v, 0);
+                    for(m = 0; m + 4 <= f; m += 4) _mm_storeu_si128((__m128i*)(d + k * f + m), b);
+                    for(; m < f; m++) d[k * f + m] = _mm_cvtsi128_si32(v);
+                }
+            break;
+        }
+    }
+#undef SCALER_SWAP4
+#endif
+#ifdef SCALER_NEON
+    int m;
+    uint32x4_t v, m0 = vdupq_n_u32(0xff), m1 = vdupq_n_u32(0xff00);
+    uint32x4x2_t v2;
+    uint32x4x3_t v3;
+    uint32x4x4_t v4;
+    for(; i + 4 <= n; i += 4, d += 4 * f) {
+        v = vld1q_u32(s + i);
+        if(bgra) v = vorrq_u32(vorrq_u32(vshlq_n_u32(vandq_u32(v, m0), 16), vandq_u32(v, m1)), vandq_u32(vshrq_n_u32(v, 16), m0));
+        switch(f) {
+            case 1: vst1q_u32(d, v); break;
+            case 2: v2.val[0] = v2.val[1] = v; vst2q_u32(d, v2); break;
+            case 3: v3.val[0] = v3.val[1] = v3.val[2] = v; vst3q_u32(d, v3); break;
+            case 4: v4.val[0] = v4.val[1] = v4.val[2] = v4.val[3] = v; vst4q_u32(d, v4); break;
+            default:
+                for(k = 0; k < 4; k++) {
+                    c = vgetq_lane_u32(v, 0); v = vextq_u32(v, v, 1);
+                    for(v4.val[0] = vdupq_n_u32(c), m = 0; m + 4 <= f; m += 4) vst1q_u32(d + k * f + m, v4.val[0]);
+                    for(; m < f; m++) d[k * f + m] = c;
+                }
+            break;
+        }
+    }
+#endif
+    for(; i < n; i++) {
+        c = bgra ? SCALER_SWAP(s[i]) : s[i];
+        for(k = 0; k < f; k++) *d++ = c;
+    }
+}
+
+/**
+ * Horizontal pass of the bilinear scaler, the table has the source index and the weight of the right neighbour (0 to
+ * 256) for each destination pixel
+ */
+static void scaler_hrow(uint32_t *d, uint32_t *s, int *tbl, int n)
+{
+    uint32_t c0, c1, w;
+    int i = 0;
+#ifdef SCALER_SSE2
+    __m128i z = _mm_setzero_si128(), a, b, c, e;
+#define SCALER_LERP2(t) (a = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)(s + ((t) >> 9))), z), \
+    _mm_srli_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a, _mm_srli_si128(a, 8)), \
+    _mm_set1_epi32((256 - ((t) & 511)) | (((t) & 511) << 16))), 8))
+    for(; i + 4 <= n; i += 4) {
+        b = SCALER_LERP2(tbl[i]); c = SCALER_LERP2(tbl[i + 1]); b = _mm_packs_epi32(b, c);
+        c = SCALER_LERP2(tbl[i + 2]); e = SCALER_LERP2(tbl[i + 3]); c = _mm_packs_epi32(c, e);
+        _mm_storeu_si128((__m128i*)(d + i), _mm_packus_epi16(b, c));
+    }
+#undef SCALER_LERP2
+#endif
+#ifdef SCALER_NEON
+    uint16x8_t a;
+    uint16x4_t b, c;
+    for(; i + 2 <= n; i += 2) {
+        w = tbl[i] & 511;
+        a = vmulq_u16(vmovl_u8(vld1_u8((uint8_t*)(s + (tbl[i] >> 9)))), vcombine_u16(vdup_n_u16(256 - w), vdup_n_u16(w)));
+        b = vshr_n_u16(vadd_u16(vget_low_u16(a), vget_high_u16(a)), 8);
+        w = tbl[i + 1] & 511;
+        a = vmulq_u16(vmovl_u8(vld1_u8((uint8_t*)(s + (tbl[i + 1] >> 9)))), vcombine_u16(vdup_n_u16(256 - w), vdup_n_u16(w)));
+        c = vshr_n_u16(vadd_u16(vget_low_u16(a), vget_high_u16(a)), 8);
+        vst1_u8((uint8_t*)(d + i), vmovn_u16(vcombine_u16(b, c)));
+    }
+#endif
+    for(; i < n; i++) {
+        c0 = s[tbl[i] >> 9]; c1 = s[(tbl[i] >> 9) + 1]; w = tbl[i] & 511;
+        d[i] = ((((c0 & 0xff00ff) * (256 - w) + (c1 & 0xff00ff) * w) >> 8) & 0xff00ff) |
+            ((((c0 >> 8) & 0xff00ff) * (256 - w) + ((c1 >> 8) & 0xff00ff) * w) & 0xff00ff00);
+    }
+}
+
+/**
+ * Vertical pass of the bilinear scaler, blends two rows with the weight of the lower one (1 to 255)
+ */
+static void scaler_vrow(uint32_t *d, uint32_t *s0, uint32_t *s1, int w, int n, int bgra)
+{
+    uint32_t c0, c1, c;
+    int i = 0;
+#ifdef SCALER_SSE2
+    __m128i z = _mm_setzero_si128(), w0 = _mm_set1_epi16(256 - w), w1 = _mm_set1_epi16(w), a, b, l, h;
+    __m128i m0 = _mm_set1_epi32(0xff), m1 = _mm_set1_epi32(0xff00);
+    for(; i + 4 <= n; i += 4) {
+        a = _mm_loadu_si128((__m128i*)(s0 + i)); b = _mm_loadu_si128((__m128i*)(s1 + i));
+        l = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, z), w0), _mm_mullo_epi16(_mm_unpacklo_epi8(b, z), w1)), 8);
+        h = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, z), w0), _mm_mullo_epi16(_mm_unpackhi_epi8(b, z), w1)), 8);
+        a = _mm_packus_epi16(l, h);
+        if(bgra)
+            a = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(a, m0), 16), _mm_and_si128(a, m1)),
+                _mm_and_si128(_mm_srli_epi32(a, 16), m0));
+        _mm_storeu_si128((__m128i*)(d + i), a);
+    }
+#endif
+#ifdef SCALER_NEON
+    uint8x8_t w0 = vdup_n_u8(256 - w), w1 = vdup_n_u8(w);
+    uint8x16_t a, b;
+    uint32x4_t v, m0 = vdupq_n_u32(0xff), m1 = vdupq_n_u32(0xff00);
+    for(; i + 4 <= n; i += 4) {
+        a = vld1q_u8((uint8_t*)(s0 + i)); b = vld1q_u8((uint8_t*)(s1 + i));
+        v = vreinterpretq_u32_u8(vcombine_u8(
+            vshrn_n_u16(vmlal_u8(vmull_u8(vget_low_u8(a), w0), vget_low_u8(b), w1), 8),
+            vshrn_n_u16(vmlal_u8(vmull_u8(vget_high_u8(a), w0), vget_high_u8(b), w1), 8)));
+        if(bgra) v = vorrq_u32(vorrq_u32(vshlq_n_u32(vandq_u32(v, m0), 16), vandq_u32(v, m1)), vandq_u32(vshrq_n_u32(v, 16), m0));
+        vst1q_u32(d + i, v);
+    }
+#endif
+    for(; i < n; i++) {
+        c0 = s0[i]; c1 = s1[i];
+        c = ((((c0 & 0xff00ff) * (256 - w) + (c1 & 0xff00ff) * w) >> 8) & 0xff00ff) |
+            ((((c0 >> 8) & 0xff00ff) * (256 - w) + ((c1 >> 8) & 0xff00ff) * w) & 0xff00ff00);
+        d[i] = bgra ? SCALER_SWAP(c) : c;
+    }
+}
+
+/**
+ * Integer scaler job, y0 and y1 are source rows. Rows are assembled in a temporary buffer, so that the framebuffer is
+ * only written, never read back
+ */
+static void scaler_integer_job(scaler_job_t *j)
+{
+    uint32_t *s = (uint32_t*)((uint8_t*)j->src + j->y0 * j->sp), *d = (uint32_t*)((uint8_t*)j->dst + j->y0 * j->f * j->dp);
+    int y, k, l = j->sw * j->f * 4;
+
+    for(y = j->y0; y < j->y1; y++, s = (uint32_t*)((uint8_t*)s + j->sp)) {
+        if(j->f == 1) { scaler_row(d, s, j->sw, 1, j->bgra); d = (uint32_t*)((uint8_t*)d + j->dp); continue; }
+        scaler_row(j->tmp, s, j->sw, j->f, j->bgra);
+        for(k = 0; k < j->f; k++, d = (uint32_t*)((uint8_t*)d + j->dp)) memcpy(d, j->tmp, l);
+    }
+}
+
+/**
+ * Nearest scaler job, y0 and y1 are destination rows
+ */
+static void scaler_nearest_job(scaler_job_t *j)
+{
+    uint32_t *s, *d = (uint32_t*)((uint8_t*)j->dst + j->y0 * j->dp), *t = j->tmp + j->dw;
+    int x, y, sy, last = -1;
+
+    for(y = j->y0; y < j->y1; y++, d = (uint32_t*)((uint8_t*)d + j->dp)) {
+        sy = y * j->sh / j->dh;
+        if(sy != last) {
+            s = (uint32_t*)((uint8_t*)j->src + sy * j->sp);
+            for(x = 0; x < j->dw; x++) t[x] = s[scaler_tbl[x]];
+            scaler_row(j->tmp, t, j->dw, 1, j->bgra);
+            last = sy;
+        }
+        memcpy(d, j->tmp, j->dw * 4);
+    }
+}
+
+/**
+ * Bilinear scaler job, y0 and y1 are destination rows. The horizontally interpolated source rows are cached, so that
+ * each source row is only interpolated once (or twice on band boundaries)
+ */
+static void scaler_bilinear_job(scaler_job_t *j)
+{
+    uint32_t *d = (uint32_t*)((uint8_t*)j->dst + j->y0 * j->dp), *r0 = j->tmp, *r1 = j->tmp + j->dw, *t;
+    int y, sy, w, i0 = -1, i1 = -1, i;
+
+    for(y = j->y0; y < j->y1; y++, d = (uint32_t*)((uint8_t*)d + j->dp)) {
+        sy = y * j->sh / j->dh; w = (y * j->sh % j->dh) * 256 / j->dh;
+        if(sy >= j->sh - 1) { sy = j->sh - 2; w = 256; }
+        if(sy != i0) {
+            if(sy == i1) { t = r0; r0 = r1; r1 = t; i = i0; i0 = i1; i1 = i; }
+            else { scaler_hrow(r0, (uint32_t*)((uint8_t*)j->src + sy * j->sp), scaler_tbl, j->dw); i0 = sy; }
+        }
+        if(w && sy + 1 != i1) { scaler_hrow(r1, (uint32_t*)((uint8_t*)j->src + (sy + 1) * j->sp), scaler_tbl, j->dw); i1 = sy + 1; }
+        if(!w) scaler_row(d, r0, j->dw, 1, j->bgra); else
+        if(w == 256) scaler_row(d, r1, j->dw, 1, j->bgra); else
+            scaler_vrow(d, r0, r1, w, j->dw, j->bgra);
+    }
+}
+
+#ifdef MEG4_THREADS
+/**
+ * Scaler worker thread, runs the job with its own index
+ */
+static void *scaler_worker(void *arg)
+{
+    int i = (int)(intptr_t)arg, gen = 0;
+    pthread_mutex_lock(&scaler_mtx);
+    while(1) {
+        while(gen == scaler_gen) pthread_cond_wait(&scaler_cnd, &scaler_mtx);
+        gen = scaler_gen;
+        if(scaler_quit) break;
+        pthread_mutex_unlock(&scaler_mtx);
+        scaler_fn(&scaler_jobs[i]);
+        pthread_mutex_lock(&scaler_mtx);
+        if(++scaler_done == scaler_run) pthread_cond_signal(&scaler_fin);
+    }
+    pthread_mutex_unlock(&scaler_mtx);
+    return NULL;
+}
+#endif
+
+/**
+ * Split the rows into bands and run the job on each of them, the first one on the caller thread
+ */
+static void scaler_parallel(void (*fn)(scaler_job_t*), scaler_job_t *job, int rows, int tmplen)
+{
+    uint32_t *buf;
+    int i, n = rows < scaler_num * 16 ? 1 : scaler_num;
+
+    if(n * tmplen > scaler_buflen) {
+        if(!(buf = (uint32_t*)realloc(scaler_buf, n * tmplen * sizeof(uint32_t)))) return;
+        scaler_buf = buf; scaler_buflen = n * tmplen;
+    }
+    for(i = 0; i < n; i++) {
+        memcpy(&scaler_jobs[i], job, sizeof(scaler_job_t));
+        scaler_jobs[i].tmp = scaler_buf + i * tmplen;
+        scaler_jobs[i].y0 = rows * i / n; scaler_jobs[i].y1 = rows * (i + 1) / n;
+    }
+#ifdef MEG4_THREADS
+    if(n > 1) {
+        if(!scaler_run) {
+            scaler_quit = 0;
+            for(scaler_run = 0; scaler_run < scaler_num - 1 &&
+                !pthread_create(&scaler_thr[scaler_run], NULL, scaler_worker, (void*)(intptr_t)(scaler_run + 1)); scaler_run++);
+        }
+        if(scaler_run == n - 1) {
+            pthread_mutex_lock(&scaler_mtx);
+            scaler_fn = fn; scaler_done = 0; scaler_gen++; pthread_cond_broadcast(&scaler_cnd);
+            pthread_mutex_unlock(&scaler_mtx);
+            fn(&scaler_jobs[0]);
+            pthread_mutex_lock(&scaler_mtx); while(scaler_done < scaler_run) { pthread_cond_wait(&scaler_fin, &scaler_mtx); }
+            pthread_mutex_unlock(&scaler_mtx);
+            return;
+        }
+    }
+#endif
+    for(i = 0; i < n; i++) fn(&scaler_jobs[i]);
+}
+
+/**
+ * Free the scaler's resources and stop the worker threads
+ */
+void scaler_free(void)
+{
+#ifdef MEG4_THREADS
+    int i;
+    if(scaler_run) {
+        pthread_mutex_lock(&scaler_mtx); scaler_quit = 1; scaler_gen++; pthread_cond_broadcast(&scaler_cnd);
+        pthread_mutex_unlock(&scaler_mtx);
+        for(i = 0; i < scaler_run; i++) pthread_join(scaler_thr[i], NULL);
+        scaler_run = scaler_gen = 0;
+    }
+#endif
+    if(scaler_buf) { free(scaler_buf); scaler_buf = NULL; }
+    if(scaler_tbl) { free(scaler_tbl); scaler_tbl = NULL; }
+    scaler_buflen = scaler_tbllen = scaler_tblkey = 0;
+}
+
+/**
+ * Set the number of threads (1 means no threads, only has an effect if compiled with MEG4_THREADS)
+ */
+void scaler_threads(int num)
+{
+    scaler_free();
+#ifdef MEG4_THREADS
+    scaler_num = num < 1 ? 1 : (num > SCALER_MAXTHREADS ? SCALER_MAXTHREADS : num);
+#else
+    (void)num;
+#endif
+}
+
+/**
+ * Calculate the horizontal lookup table (only if the sizes have changed since the last call)
+ */
+static int scaler_table(int sw, int dw, int bilinear)
+{
+    int *tbl, x, key = (sw << 16) | (dw << 1) | bilinear;
+
+    if(key == scaler_tblkey) return 1;
+    if(dw > scaler_tbllen) {
+        if(!(tbl = (int*)realloc(scaler_tbl, dw * sizeof(int)))) return 0;
+        scaler_tbl = tbl; scaler_tbllen = dw;
+    }
+    for(x = 0; x < dw; x++)
+        if(!bilinear) scaler_tbl[x] = x * sw / dw;
+        else
+        /* source index and the right neighbour's weight, the last column is sampled from the left with full weight */
+        if(x * sw / dw >= sw - 1) scaler_tbl[x] = ((sw - 2) << 9) | 256;
+        else scaler_tbl[x] = ((x * sw / dw) << 9) | ((x * sw % dw) * 256 / dw);
+    scaler_tblkey = key;
+    return 1;
+}
+
+/**
+ * Pixel perfect integer scaler, each source pixel becomes an f x f block
+ */
+void scaler_integer(uint32_t *dst, int dp, uint32_t *src, int sw, int sh, int sp, int f, int bgra)
+{
+    scaler_job_t job;
+    if(!dst || !src || sw < 1 || sh < 1 || f < 1) return;
+    job.dst = dst; job.dp = dp; job.src = src; job.sw = sw; job.sh = sh; job.sp = sp; job.f = f; job.bgra = bgra;
+    job.dw = sw * f; job.dh = sh * f;
+    scaler_parallel(scaler_integer_job, &job, sh, sw * f);
+}
+
+/**
+ * Nearest neighbour scaler to arbitrary size
+ */
+void scaler_nearest(uint32_t *dst, int dw, int dh, int dp, uint32_t *src, int sw, int sh, int sp, int bgra)
+{
+    scaler_job_t job;
+    if(!dst || !src || sw < 1 || sh < 1 || dw < 1 || dh < 1 || !scaler_table(sw, dw, 0)) return;
+    job.dst = dst; job.dw = dw; job.dh = dh; job.dp = dp; job.src = src; job.sw = sw; job.sh = sh; job.sp = sp;
+    job.f = 1; job.bgra = bgra;
+    scaler_parallel(scaler_nearest_job, &job, dh, 2 * dw);
+}
+
+/**
+ * Bilinear scaler to arbitrary size (smooth, but might be blurry)
+ */
+void scaler_bilinear(uint32_t *dst, int dw, int dh, int dp, uint32_t *src, int sw, int sh, int sp, int bgra)
+{
+    scaler_job_t job;
+    if(sw < 2 || sh < 2) { scaler_nearest(dst, dw, dh, dp, src, sw, sh, sp, bgra); return; }
+    if(!dst || !src || dw < 1 || dh < 1 || !scaler_table(sw, dw, 1)) return;
+    job.dst = dst; job.dw = dw; job.dh = dh; job.dp = dp; job.src = src; job.sw = sw; job.sh = sh; job.sp = sp;
+    job.f = 1; job.bgra = bgra;
+    scaler_parallel(scaler_bilinear_job, &job, dh, 2 * dw);
+}
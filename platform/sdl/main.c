@@ -735,7 +735,8 @@ int main(int argc, char **argv)
     want.format = AUDIO_F32;
 #endif
     want.channels = 1;
-    want.samples = 4096;
+    meg4_audiogetbuf(&i, NULL);
+    want.samples = i;
     want.callback = main_audio;
     audio = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
     if(audio && (have.freq != 44100 || have.channels != 1 || have.format !=
@@ -747,7 +748,7 @@ int main(int argc, char **argv)
       )) {
         SDL_CloseAudioDevice(audio); audio = 0;
     }
-    if(verbose && audio) main_log(1, "audio opened %uHz, %u bits", have.freq, 32);
+    if(verbose && audio) main_log(1, "audio opened %uHz, %u bits, %u samples", have.freq, 32, have.samples);
     /* turn on the emulator */
     meg4_poweron(lng);
 #if !defined(NOEDITORS) && !defined(__EMSCRIPTEN__)
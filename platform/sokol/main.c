@@ -170,6 +170,8 @@ void main_hdr(void)
  */
 static void init(void)
 {
+    int samples, periods;
+
     memset(main_clip, 0, sizeof(main_clip));
     sg_setup(&(sg_desc){ .context = sapp_sgcontext(), .logger.func = slog });
     sgl_setup(&(sgl_desc_t){ .logger.func = slog });
@@ -184,14 +186,17 @@ static void init(void)
         .wrap_u = SG_WRAP_CLAMP_TO_EDGE,
         .wrap_v = SG_WRAP_CLAMP_TO_EDGE
     });
+    meg4_audiogetbuf(&samples, &periods);
     saudio_setup(&(saudio_desc){
         .sample_rate = 44100,
         .num_channels = 1,
+        .buffer_frames = samples,
+        .num_packets = periods,
         .stream_cb = main_audio,
         .logger.func = slog,
     });
     audio = saudio_isvalid();
-    if(verbose && audio) main_log(1, "audio opened %uHz, %u bits", 44100, 32);
+    if(verbose && audio) main_log(1, "audio opened %uHz, %u bits, %u samples", 44100, 32, saudio_buffer_frames());
 #ifndef DEBUG
     main_fullscreen();
 #endif
@@ -7,13 +7,13 @@
  *
  */
 
-#define MEG4_NUM_API 165
+#define MEG4_NUM_API 169
 #define MEG4_NUM_BDEF 260
 #ifndef API_IMPL
-extern meg4_api_t meg4_api[166];
+extern meg4_api_t meg4_api[170];
 extern bdef_t meg4_bdefs[261];
 #else
-meg4_api_t meg4_api[166] = {
+meg4_api_t meg4_api[170] = {
     { "putc", 0, 1, 0, 0x0, 0x0, 0x0, 0x1 },
     { "printf", 0, 2, 2, 0x1, 0x1, 0x0, 0x0 },
     { "getc", 1, 0, 0, 0x0, 0x0, 0x0, 0x0 },
@@ -63,6 +63,10 @@ meg4_api_t meg4_api[166] = {
     { "mset", 0, 3, 0, 0x0, 0x0, 0x0, 0x7 },
     { "map", 0, 7, 0, 0x0, 0x0, 0x0, 0x3c },
     { "maze", 0, 12, 0, 0x800, 0x0, 0x0, 0x7ff },
+    { "blit", 0, 6, 0, 0x0, 0x0, 0x0, 0x30 },
+    { "blitscr", 0, 8, 0, 0x84, 0x0, 0x0, 0x38 },
+    { "blitmem", 0, 8, 0, 0x85, 0x0, 0x0, 0x3a },
+    { "blitfill", 0, 5, 0, 0x1, 0x0, 0x0, 0x1e },
     { "getpad", 1, 2, 0, 0x0, 0x0, 0x0, 0x0 },
     { "prspad", 1, 2, 0, 0x0, 0x0, 0x0, 0x0 },
     { "relpad", 1, 2, 0, 0x0, 0x0, 0x0, 0x0 },
@@ -450,11 +454,11 @@ bdef_t meg4_bdefs[261] = {
 
 #define MEG4_PRINT 1
 #define MEG4_INPUT 3
-#define MEG4_OUTB 143
+#define MEG4_OUTB 147
 #define MEG4_EXIT 6
-#define MEG4_MEMCPY 148
-#define MEG4_ATOI 155
-#define MEG4_VAL 157
+#define MEG4_MEMCPY 152
+#define MEG4_ATOI 159
+#define MEG4_VAL 161
 #define MEG4_DISPATCH \
     case  0: meg4_api_putc((uint32_t)cpu_topi(0)); break; \
     case  1: meg4_api_printf((str_t)cpu_topi(0)); break; \
@@ -505,119 +509,123 @@ bdef_t meg4_bdefs[261] = {
     case 46: meg4_api_mset((uint16_t)cpu_topi(0),(uint16_t)cpu_topi(4),(uint16_t)cpu_topi(8)); break; \
     case 47: meg4_api_map((int16_t)cpu_topi(0),(int16_t)cpu_topi(4),(uint16_t)cpu_topi(8),(uint16_t)cpu_topi(12),(uint16_t)cpu_topi(16),(uint16_t)cpu_topi(20),(int8_t)cpu_topi(24)); break; \
     case 48: meg4_api_maze((uint16_t)cpu_topi(0),(uint16_t)cpu_topi(4),(uint16_t)cpu_topi(8),(uint16_t)cpu_topi(12),(uint8_t)cpu_topi(16),(uint16_t)cpu_topi(20),(uint16_t)cpu_topi(24),(uint16_t)cpu_topi(28),(uint16_t)cpu_topi(32),(uint16_t)cpu_topi(36),(uint8_t)cpu_topi(40),(addr_t)cpu_topi(44)); break; \
-    case 49:  val = meg4_api_getpad((int)cpu_topi(0),(int)cpu_topi(4)); break; \
-    case 50:  val = meg4_api_prspad((int)cpu_topi(0),(int)cpu_topi(4)); break; \
-    case 51:  val = meg4_api_relpad((int)cpu_topi(0),(int)cpu_topi(4)); break; \
-    case 52:  val = meg4_api_getbtn((int)cpu_topi(0)); break; \
-    case 53:  val = meg4_api_getclk((int)cpu_topi(0)); break; \
-    case 54:  val = meg4_api_getkey((int)cpu_topi(0)); break; \
-    case 55:  val = meg4_api_popkey(); break; \
-    case 56:  val = meg4_api_pendkey(); break; \
-    case 57:  val = meg4_api_lenkey((uint32_t)cpu_topi(0)); break; \
-    case 58:  val = meg4_api_speckey((uint32_t)cpu_topi(0)); break; \
-    case 59:  val = meg4_api_rand(); break; \
-    case 60: fval = meg4_api_rnd(); break; \
-    case 61: fval = meg4_api_float((int)cpu_topi(0)); break; \
-    case 62:  val = meg4_api_int((float)cpu_topf(0)); break; \
-    case 63: fval = meg4_api_floor((float)cpu_topf(0)); break; \
-    case 64: fval = meg4_api_ceil((float)cpu_topf(0)); break; \
-    case 65: fval = meg4_api_sgn((float)cpu_topf(0)); break; \
-    case 66: fval = meg4_api_abs((float)cpu_topf(0)); break; \
-    case 67: fval = meg4_api_exp((float)cpu_topf(0)); break; \
-    case 68: fval = meg4_api_log((float)cpu_topf(0)); break; \
-    case 69: fval = meg4_api_pow((float)cpu_topf(0),(float)cpu_topf(4)); break; \
-    case 70: fval = meg4_api_sqrt((float)cpu_topf(0)); break; \
-    case 71: fval = meg4_api_rsqrt((float)cpu_topf(0)); break; \
-    case 72: fval = meg4_api_clamp((float)cpu_topf(0),(float)cpu_topf(4),(float)cpu_topf(8)); break; \
-    case 73: fval = meg4_api_lerp((float)cpu_topf(0),(float)cpu_topf(4),(float)cpu_topf(8)); break; \
-    case 74: fval = meg4_api_pi(); break; \
-    case 75: fval = meg4_api_cos((uint16_t)cpu_topi(0)); break; \
-    case 76: fval = meg4_api_sin((uint16_t)cpu_topi(0)); break; \
-    case 77: fval = meg4_api_tan((uint16_t)cpu_topi(0)); break; \
-    case 78:  val = meg4_api_acos((float)cpu_topf(0)); break; \
-    case 79:  val = meg4_api_asin((float)cpu_topf(0)); break; \
-    case 80:  val = meg4_api_atan((float)cpu_topf(0)); break; \
-    case 81:  val = meg4_api_atan2((float)cpu_topf(0),(float)cpu_topf(4)); break; \
-    case 82: fval = meg4_api_dotv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4)); break; \
-    case 83: fval = meg4_api_lenv2((addr_t)cpu_topi(0)); break; \
-    case 84: meg4_api_scalev2((addr_t)cpu_topi(0),(float)cpu_topf(4)); break; \
-    case 85: meg4_api_negv2((addr_t)cpu_topi(0)); break; \
-    case 86: meg4_api_addv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 87: meg4_api_subv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 88: meg4_api_mulv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 89: meg4_api_divv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 90: meg4_api_clampv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(addr_t)cpu_topi(12)); break; \
-    case 91: meg4_api_lerpv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(float)cpu_topf(12)); break; \
-    case 92: meg4_api_normv2((addr_t)cpu_topi(0)); break; \
-    case 93: fval = meg4_api_dotv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4)); break; \
-    case 94: fval = meg4_api_lenv3((addr_t)cpu_topi(0)); break; \
-    case 95: meg4_api_scalev3((addr_t)cpu_topi(0),(float)cpu_topf(4)); break; \
-    case 96: meg4_api_negv3((addr_t)cpu_topi(0)); break; \
-    case 97: meg4_api_addv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 98: meg4_api_subv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 99: meg4_api_mulv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 100: meg4_api_divv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 101: meg4_api_crossv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 102: meg4_api_clampv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(addr_t)cpu_topi(12)); break; \
-    case 103: meg4_api_lerpv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(float)cpu_topf(12)); break; \
-    case 104: meg4_api_normv3((addr_t)cpu_topi(0)); break; \
-    case 105: fval = meg4_api_dotv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4)); break; \
-    case 106: fval = meg4_api_lenv4((addr_t)cpu_topi(0)); break; \
-    case 107: meg4_api_scalev4((addr_t)cpu_topi(0),(float)cpu_topf(4)); break; \
-    case 108: meg4_api_negv4((addr_t)cpu_topi(0)); break; \
-    case 109: meg4_api_addv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 110: meg4_api_subv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 111: meg4_api_mulv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 112: meg4_api_divv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 113: meg4_api_clampv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(addr_t)cpu_topi(12)); break; \
-    case 114: meg4_api_lerpv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(float)cpu_topf(12)); break; \
-    case 115: meg4_api_normv4((addr_t)cpu_topi(0)); break; \
-    case 116: meg4_api_idq((addr_t)cpu_topi(0)); break; \
-    case 117: meg4_api_eulerq((addr_t)cpu_topi(0),(uint16_t)cpu_topi(4),(uint16_t)cpu_topi(8),(uint16_t)cpu_topi(12)); break; \
-    case 118: fval = meg4_api_dotq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4)); break; \
-    case 119: fval = meg4_api_lenq((addr_t)cpu_topi(0)); break; \
-    case 120: meg4_api_scaleq((addr_t)cpu_topi(0),(float)cpu_topf(4)); break; \
-    case 121: meg4_api_negq((addr_t)cpu_topi(0)); break; \
-    case 122: meg4_api_addq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 123: meg4_api_subq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 124: meg4_api_mulq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 125: meg4_api_rotq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 126: meg4_api_lerpq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(float)cpu_topf(12)); break; \
-    case 127: meg4_api_slerpq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(float)cpu_topf(12)); break; \
-    case 128: meg4_api_normq((addr_t)cpu_topi(0)); break; \
-    case 129: meg4_api_idm4((addr_t)cpu_topi(0)); break; \
-    case 130: meg4_api_trsm4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(addr_t)cpu_topi(12)); break; \
-    case 131: fval = meg4_api_detm4((addr_t)cpu_topi(0)); break; \
-    case 132: meg4_api_addm4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 133: meg4_api_subm4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 134: meg4_api_mulm4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 135: meg4_api_mulm4v3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 136: meg4_api_mulm4v4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
-    case 137: meg4_api_invm4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4)); break; \
-    case 138: meg4_api_trpm4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4)); break; \
-    case 139: meg4_api_trns((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(uint8_t)cpu_topi(8),(int16_t)cpu_topi(12),(int16_t)cpu_topi(16),(int16_t)cpu_topi(20),(uint16_t)cpu_topi(24),(uint16_t)cpu_topi(28),(uint16_t)cpu_topi(32),(float)cpu_topf(36)); break; \
-    case 140:  val = meg4_api_inb((addr_t)cpu_topi(0)); break; \
-    case 141:  val = meg4_api_inw((addr_t)cpu_topi(0)); break; \
-    case 142:  val = meg4_api_ini((addr_t)cpu_topi(0)); break; \
-    case 143: meg4_api_outb((addr_t)cpu_topi(0),(uint8_t)cpu_topi(4)); break; \
-    case 144: meg4_api_outw((addr_t)cpu_topi(0),(uint16_t)cpu_topi(4)); break; \
-    case 145: meg4_api_outi((addr_t)cpu_topi(0),(uint32_t)cpu_topi(4)); break; \
-    case 146:  val = meg4_api_memsave((uint8_t)cpu_topi(0),(addr_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
-    case 147:  val = meg4_api_memload((addr_t)cpu_topi(0),(uint8_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
-    case 148: meg4_api_memcpy((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
-    case 149: meg4_api_memset((addr_t)cpu_topi(0),(uint8_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
-    case 150:  val = meg4_api_memcmp((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
-    case 151:  val = meg4_api_deflate((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
-    case 152:  val = meg4_api_inflate((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
-    case 153: fval = meg4_api_time(); break; \
-    case 154:  val = meg4_api_now(); break; \
-    case 155:  val = meg4_api_atoi((str_t)cpu_topi(0)); break; \
-    case 156:  val = meg4_api_itoa((int)cpu_topi(0)); break; \
-    case 157: fval = meg4_api_val((str_t)cpu_topi(0)); break; \
-    case 158:  val = meg4_api_str((float)cpu_topf(0)); break; \
-    case 159:  val = meg4_api_sprintf((str_t)cpu_topi(0)); break; \
-    case 160:  val = meg4_api_strlen((str_t)cpu_topi(0)); break; \
-    case 161:  val = meg4_api_mblen((str_t)cpu_topi(0)); break; \
-    case 162:  val = meg4_api_malloc((uint32_t)cpu_topi(0)); break; \
-    case 163:  val = meg4_api_realloc((addr_t)cpu_topi(0),(uint32_t)cpu_topi(4)); break; \
-    case 164:  val = meg4_api_free((addr_t)cpu_topi(0)); break; 
+    case 49: meg4_api_blit((int16_t)cpu_topi(0),(int16_t)cpu_topi(4),(int16_t)cpu_topi(8),(int16_t)cpu_topi(12),(uint16_t)cpu_topi(16),(uint16_t)cpu_topi(20)); break; \
+    case 50: meg4_api_blitscr((int16_t)cpu_topi(0),(int16_t)cpu_topi(4),(addr_t)cpu_topi(8),(uint16_t)cpu_topi(12),(uint16_t)cpu_topi(16),(uint16_t)cpu_topi(20),(int16_t)cpu_topi(24),(addr_t)cpu_topi(28)); break; \
+    case 51: meg4_api_blitmem((addr_t)cpu_topi(0),(uint16_t)cpu_topi(4),(addr_t)cpu_topi(8),(uint16_t)cpu_topi(12),(uint16_t)cpu_topi(16),(uint16_t)cpu_topi(20),(int16_t)cpu_topi(24),(addr_t)cpu_topi(28)); break; \
+    case 52: meg4_api_blitfill((addr_t)cpu_topi(0),(uint16_t)cpu_topi(4),(uint16_t)cpu_topi(8),(uint16_t)cpu_topi(12),(uint8_t)cpu_topi(16)); break; \
+    case 53:  val = meg4_api_getpad((int)cpu_topi(0),(int)cpu_topi(4)); break; \
+    case 54:  val = meg4_api_prspad((int)cpu_topi(0),(int)cpu_topi(4)); break; \
+    case 55:  val = meg4_api_relpad((int)cpu_topi(0),(int)cpu_topi(4)); break; \
+    case 56:  val = meg4_api_getbtn((int)cpu_topi(0)); break; \
+    case 57:  val = meg4_api_getclk((int)cpu_topi(0)); break; \
+    case 58:  val = meg4_api_getkey((int)cpu_topi(0)); break; \
+    case 59:  val = meg4_api_popkey(); break; \
+    case 60:  val = meg4_api_pendkey(); break; \
+    case 61:  val = meg4_api_lenkey((uint32_t)cpu_topi(0)); break; \
+    case 62:  val = meg4_api_speckey((uint32_t)cpu_topi(0)); break; \
+    case 63:  val = meg4_api_rand(); break; \
+    case 64: fval = meg4_api_rnd(); break; \
+    case 65: fval = meg4_api_float((int)cpu_topi(0)); break; \
+    case 66:  val = meg4_api_int((float)cpu_topf(0)); break; \
+    case 67: fval = meg4_api_floor((float)cpu_topf(0)); break; \
+    case 68: fval = meg4_api_ceil((float)cpu_topf(0)); break; \
+    case 69: fval = meg4_api_sgn((float)cpu_topf(0)); break; \
+    case 70: fval = meg4_api_abs((float)cpu_topf(0)); break; \
+    case 71: fval = meg4_api_exp((float)cpu_topf(0)); break; \
+    case 72: fval = meg4_api_log((float)cpu_topf(0)); break; \
+    case 73: fval = meg4_api_pow((float)cpu_topf(0),(float)cpu_topf(4)); break; \
+    case 74: fval = meg4_api_sqrt((float)cpu_topf(0)); break; \
+    case 75: fval = meg4_api_rsqrt((float)cpu_topf(0)); break; \
+    case 76: fval = meg4_api_clamp((float)cpu_topf(0),(float)cpu_topf(4),(float)cpu_topf(8)); break; \
+    case 77: fval = meg4_api_lerp((float)cpu_topf(0),(float)cpu_topf(4),(float)cpu_topf(8)); break; \
+    case 78: fval = meg4_api_pi(); break; \
+    case 79: fval = meg4_api_cos((uint16_t)cpu_topi(0)); break; \
+    case 80: fval = meg4_api_sin((uint16_t)cpu_topi(0)); break; \
+    case 81: fval = meg4_api_tan((uint16_t)cpu_topi(0)); break; \
+    case 82:  val = meg4_api_acos((float)cpu_topf(0)); break; \
+    case 83:  val = meg4_api_asin((float)cpu_topf(0)); break; \
+    case 84:  val = meg4_api_atan((float)cpu_topf(0)); break; \
+    case 85:  val = meg4_api_atan2((float)cpu_topf(0),(float)cpu_topf(4)); break; \
+    case 86: fval = meg4_api_dotv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4)); break; \
+    case 87: fval = meg4_api_lenv2((addr_t)cpu_topi(0)); break; \
+    case 88: meg4_api_scalev2((addr_t)cpu_topi(0),(float)cpu_topf(4)); break; \
+    case 89: meg4_api_negv2((addr_t)cpu_topi(0)); break; \
+    case 90: meg4_api_addv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 91: meg4_api_subv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 92: meg4_api_mulv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 93: meg4_api_divv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 94: meg4_api_clampv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(addr_t)cpu_topi(12)); break; \
+    case 95: meg4_api_lerpv2((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(float)cpu_topf(12)); break; \
+    case 96: meg4_api_normv2((addr_t)cpu_topi(0)); break; \
+    case 97: fval = meg4_api_dotv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4)); break; \
+    case 98: fval = meg4_api_lenv3((addr_t)cpu_topi(0)); break; \
+    case 99: meg4_api_scalev3((addr_t)cpu_topi(0),(float)cpu_topf(4)); break; \
+    case 100: meg4_api_negv3((addr_t)cpu_topi(0)); break; \
+    case 101: meg4_api_addv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 102: meg4_api_subv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 103: meg4_api_mulv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 104: meg4_api_divv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 105: meg4_api_crossv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 106: meg4_api_clampv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(addr_t)cpu_topi(12)); break; \
+    case 107: meg4_api_lerpv3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(float)cpu_topf(12)); break; \
+    case 108: meg4_api_normv3((addr_t)cpu_topi(0)); break; \
+    case 109: fval = meg4_api_dotv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4)); break; \
+    case 110: fval = meg4_api_lenv4((addr_t)cpu_topi(0)); break; \
+    case 111: meg4_api_scalev4((addr_t)cpu_topi(0),(float)cpu_topf(4)); break; \
+    case 112: meg4_api_negv4((addr_t)cpu_topi(0)); break; \
+    case 113: meg4_api_addv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 114: meg4_api_subv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 115: meg4_api_mulv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 116: meg4_api_divv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 117: meg4_api_clampv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(addr_t)cpu_topi(12)); break; \
+    case 118: meg4_api_lerpv4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(float)cpu_topf(12)); break; \
+    case 119: meg4_api_normv4((addr_t)cpu_topi(0)); break; \
+    case 120: meg4_api_idq((addr_t)cpu_topi(0)); break; \
+    case 121: meg4_api_eulerq((addr_t)cpu_topi(0),(uint16_t)cpu_topi(4),(uint16_t)cpu_topi(8),(uint16_t)cpu_topi(12)); break; \
+    case 122: fval = meg4_api_dotq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4)); break; \
+    case 123: fval = meg4_api_lenq((addr_t)cpu_topi(0)); break; \
+    case 124: meg4_api_scaleq((addr_t)cpu_topi(0),(float)cpu_topf(4)); break; \
+    case 125: meg4_api_negq((addr_t)cpu_topi(0)); break; \
+    case 126: meg4_api_addq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 127: meg4_api_subq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 128: meg4_api_mulq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 129: meg4_api_rotq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 130: meg4_api_lerpq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(float)cpu_topf(12)); break; \
+    case 131: meg4_api_slerpq((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(float)cpu_topf(12)); break; \
+    case 132: meg4_api_normq((addr_t)cpu_topi(0)); break; \
+    case 133: meg4_api_idm4((addr_t)cpu_topi(0)); break; \
+    case 134: meg4_api_trsm4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8),(addr_t)cpu_topi(12)); break; \
+    case 135: fval = meg4_api_detm4((addr_t)cpu_topi(0)); break; \
+    case 136: meg4_api_addm4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 137: meg4_api_subm4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 138: meg4_api_mulm4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 139: meg4_api_mulm4v3((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 140: meg4_api_mulm4v4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(addr_t)cpu_topi(8)); break; \
+    case 141: meg4_api_invm4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4)); break; \
+    case 142: meg4_api_trpm4((addr_t)cpu_topi(0),(addr_t)cpu_topi(4)); break; \
+    case 143: meg4_api_trns((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(uint8_t)cpu_topi(8),(int16_t)cpu_topi(12),(int16_t)cpu_topi(16),(int16_t)cpu_topi(20),(uint16_t)cpu_topi(24),(uint16_t)cpu_topi(28),(uint16_t)cpu_topi(32),(float)cpu_topf(36)); break; \
+    case 144:  val = meg4_api_inb((addr_t)cpu_topi(0)); break; \
+    case 145:  val = meg4_api_inw((addr_t)cpu_topi(0)); break; \
+    case 146:  val = meg4_api_ini((addr_t)cpu_topi(0)); break; \
+    case 147: meg4_api_outb((addr_t)cpu_topi(0),(uint8_t)cpu_topi(4)); break; \
+    case 148: meg4_api_outw((addr_t)cpu_topi(0),(uint16_t)cpu_topi(4)); break; \
+    case 149: meg4_api_outi((addr_t)cpu_topi(0),(uint32_t)cpu_topi(4)); break; \
+    case 150:  val = meg4_api_memsave((uint8_t)cpu_topi(0),(addr_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
+    case 151:  val = meg4_api_memload((addr_t)cpu_topi(0),(uint8_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
+    case 152: meg4_api_memcpy((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
+    case 153: meg4_api_memset((addr_t)cpu_topi(0),(uint8_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
+    case 154:  val = meg4_api_memcmp((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
+    case 155:  val = meg4_api_deflate((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
+    case 156:  val = meg4_api_inflate((addr_t)cpu_topi(0),(addr_t)cpu_topi(4),(uint32_t)cpu_topi(8)); break; \
+    case 157: fval = meg4_api_time(); break; \
+    case 158:  val = meg4_api_now(); break; \
+    case 159:  val = meg4_api_atoi((str_t)cpu_topi(0)); break; \
+    case 160:  val = meg4_api_itoa((int)cpu_topi(0)); break; \
+    case 161: fval = meg4_api_val((str_t)cpu_topi(0)); break; \
+    case 162:  val = meg4_api_str((float)cpu_topf(0)); break; \
+    case 163:  val = meg4_api_sprintf((str_t)cpu_topi(0)); break; \
+    case 164:  val = meg4_api_strlen((str_t)cpu_topi(0)); break; \
+    case 165:  val = meg4_api_mblen((str_t)cpu_topi(0)); break; \
+    case 166:  val = meg4_api_malloc((uint32_t)cpu_topi(0)); break; \
+    case 167:  val = meg4_api_realloc((addr_t)cpu_topi(0),(uint32_t)cpu_topi(4)); break; \
+    case 168:  val = meg4_api_free((addr_t)cpu_topi(0)); break; 
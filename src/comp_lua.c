@@ -92,13 +92,13 @@ static int callback(lua_State *L)
                 /* string */
                 if(!lua_isstring(L, i + 1)) {
 badarg:             state = 3;
-                    luaL_error(L, "MEG-4 API %s:arg %u: %s", api->name, i + 1, LUA_ERR_BADARG);
+                    luaL_error(L, "MEG-4 API %s:arg %d: %s", api->name, i + 1, LUA_ERR_BADARG);
                     return 0;
                 }
                 s = (char*)luaL_tolstring(L, i + 1, &l);
                 if(meg4.dp + l + 5 >= meg4.sp) {
 memory:             state = 3;
-                    luaL_error(L, "MEG-4 API %s:arg %u: %s", api->name, i + 1, LUA_ERR_MEMORY);
+                    luaL_error(L, "MEG-4 API %s:arg %d: %s", api->name, i + 1, LUA_ERR_MEMORY);
                     return 0;
                 } else {
                     cpu_pushi(meg4.dp + MEG4_MEM_USER);
@@ -108,9 +108,11 @@ memory:             state = 3;
                 }
             } else
             if(api->amsk & (1 << i)) {
-                /* memory address, could be a real address or a byte array as well */
+                /* memory address, could be a real address or a byte array as well (bit 0: address, bit 1: table, bit 2:
+                 * table must have exactly 256 entries) */
                 j = 1;
-                if(!strcmp(api->name, "remap")) j = 2; else
+                if(!strcmp(api->name, "remap")) j = 6; else
+                if(i == 7 && (!strcmp(api->name, "blitscr") || !strcmp(api->name, "blitmem"))) j = 7; else
                 if(!strcmp(api->name, "memsave")) j = 3;
                 if(lua_isinteger(L, i + 1) || lua_isnumber(L, i + 1)) {
                     /* real address */
@@ -128,7 +130,7 @@ memory:             state = 3;
                      * Of course the function DOESN'T EVEN EXISTS... I mean it's not that I forget to include
                      * the header; grep it, there's no "luaL_getn" string in the entire Lua source code */
                     /* l = luaL_getn(L, i + 1); */
-                    if(!(j & 2) || (j == 2 && l != 256)) goto badarg;
+                    if(!(j & 2) || ((j & 4) && l != 256)) goto badarg;
                     if(meg4.dp + l + 4 >= meg4.sp) goto memory;
                     cpu_pushi(meg4.dp + MEG4_MEM_USER);
                     /* this is the least efficient solution there could be. But we have no choice, Lua
@@ -293,7 +295,7 @@ static int luab_memcpy(lua_State *L)
     /* check length first */
     if(!lua_isinteger(L, 3) && !lua_isnumber(L, 3)) {
 badarg: state = 3;
-        luaL_error(L, "MEG-4 API %s:arg %u: %s", "memcpy", err, LUA_ERR_BADARG);
+        luaL_error(L, "MEG-4 API %s:arg %d: %s", "memcpy", err, LUA_ERR_BADARG);
         return 0;
     } else {
         if(lua_isinteger(L, 3)) len = lua_tointeger(L, 3);
@@ -366,7 +368,7 @@ static int luab_maze(lua_State *L)
     for(i = 0; i < 10; i++) {
         if(!lua_isinteger(L, i + 1) && !lua_isnumber(L, i + 1)) {
 badarg:     state = 3;
-            luaL_error(L, "MEG-4 API %s:arg %u: %s", "maze", i + 1, LUA_ERR_BADARG);
+            luaL_error(L, "MEG-4 API %s:arg %d: %s", "maze", i + 1, LUA_ERR_BADARG);
             return 0;
         } else {
             if(lua_isinteger(L, i + 1)) par[i] = (uint32_t)lua_tointeger(L, i + 1);
@@ -114,6 +114,7 @@ void meg4_putc(uint32_t c)
 void meg4_api_putc(uint32_t chr)
 {
     uint32_t c = 0;
+    gpu_flush();
     meg4_utf8((char*)&chr, &c);
     meg4_putc(c);
 }
@@ -128,6 +129,7 @@ void meg4_api_printf(str_t fmt, ...)
     uint32_t c;
     char tmp[256], *s;
 
+    gpu_flush();
     if(fmt >= MEG4_MEM_USER && fmt < MEG4_MEM_LIMIT - 1) {
         meg4_snprintf(tmp, sizeof(tmp), (char*)meg4.data + fmt - MEG4_MEM_USER);
         for(s = tmp; s < tmp + sizeof(tmp) && *s;) {
@@ -0,0 +1,14 @@
+/* generated by bin2h, do not edit */
+
+extern const unsigned char binary_icons_png[41410];
+extern const unsigned int default_pal[256];
+extern const unsigned char binary_default_sfn[109729];
+extern const unsigned char binary_floppy_png[36877];
+extern const unsigned char binary_editors_png[9690];
+extern const unsigned char binary_sounds_mod[148492];
+extern unsigned int theme[43];
+extern const unsigned char binary_hl_json[1016];
+extern const unsigned char binary_de_md[22177];
+extern const unsigned char binary_en_md[22176];
+extern const unsigned char binary_hu_md[24532];
+extern const char *help_md[7];
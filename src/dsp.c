@@ -31,9 +31,19 @@
  */
 
 #define DSP_SPT 882.0f  /* 882.0f = 44100 / 50 for PAL clock freq, 735.0f = 44100 / 60 for NTSC clock freq */
+#define DSP_ROWS ((int)(sizeof(meg4.tracks[0]) >> 4))   /* rows in a music track, the track's stream continues after these */
 
 #include "meg4.h"
 #include <math.h>
+#ifndef DSP_NOSIMD
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define DSP_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DSP_NEON 1
+#endif
+#endif
 float sinf(float);
 float fabsf(float);
 float fmodf(float, float);
@@ -72,28 +82,245 @@ static float wave_noise(float t)    { return (float)wave_rand[((int)t) & 0x7f] /
 static float wave_phaser(float t)   { t *= 2; return (fabsf(fmodf(t, 2) - 1) - 0.5f + (fabsf(fmodf((t * 127 / 128), 2) - 1) - 0.5) / 2) - 0.25; }
 static wavefunc_t waves[] = { wave_sine, wave_triangle, wave_sawtooth, wave_square, wave_pulse, wave_organ, wave_noise, wave_phaser };
 static uint8_t *defwaves = NULL;
+/* the functions above are only evaluated once, into base tables with one period each (as many entries as the longest
+ * waveform can have, so a lookup is never coarser than the samples), then stepped through with a fixed point phase.
+ * The last generated waveform of each kind is cached, regenerating it with the same length is a copy */
+#define DSP_WAVEBITS 14
+#define DSP_WAVES (int)(sizeof(waves)/sizeof(waves[0]))
+static int8_t *dsp_wavetab = NULL;
+static int dsp_wavelen[DSP_WAVES];
+
+/* mixer buffers, a tick is at most 44100 / (0.4 * 32) samples long */
+#define DSP_BLK 4096
+static int16_t dsp_smp[DSP_BLK];
+static int32_t dsp_acc[DSP_BLK];
+
+/* resampler: 0 nearest, 1 linear, 2 windowed sinc. The interpolating ones output samples with DSP_FRAC fraction bits.
+ * Sinc coefficients are 1.14 fixed point, with a cut off frequency of 1, 1/2, 1/3 and 1/4 (for increments up to that) */
+#define DSP_FRAC 6
+#define DSP_TAPS 16
+#define DSP_PHASES 128
+static int dsp_quality = 0;
+static int16_t dsp_sinc[4][DSP_PHASES][DSP_TAPS];
 
 /**
- * The global dsp context, this is different for the editors (if compiled with editors, that is)
+ * The dsp context, this is different for the editors (if compiled with editors, that is). Only the audio thread may use it
  */
-meg4_dsp_t *dsp = &meg4.dram;
+static meg4_dsp_t *dsp = &meg4.dram;
+
+/* command queue between the VM (producer) and the audio thread (consumer). Single producer, single consumer, so it is
+ * lock-free: the producer only writes dsp_head, the consumer only writes dsp_tail, and the slot is published by the release
+ * store of the index (plain volatile accesses on compilers without atomic builtins, only correct on x86 there) */
+#define DSP_CMDS 256
+#if defined(__GNUC__) || defined(__clang__)
+#define DSP_LOAD(v) __atomic_load_n(&(v), __ATOMIC_ACQUIRE)
+#define DSP_STORE(v, x) __atomic_store_n(&(v), (x), __ATOMIC_RELEASE)
+#else
+#define DSP_LOAD(v) (v)
+#define DSP_STORE(v, x) (v) = (x)
+#endif
+enum { DSP_RESET, DSP_SELECT, DSP_SFX, DSP_MUSIC, DSP_NOTE, DSP_MASTER, DSP_REWIND, DSP_STREAM };
+typedef struct {
+    uint32_t when;                  /* timestamp in samples */
+    uint8_t cmd, chan, vol, track;
+    uint16_t row, num;
+    uint8_t note[4];
+    uint8_t *data;                  /* stream data, allocated by the producer and freed by the consumer */
+    uint32_t len;
+} dsp_cmd_t;
+static dsp_cmd_t dsp_cmds[DSP_CMDS];
+static volatile uint32_t dsp_head = 0, dsp_tail = 0;
+/* producer side: which context the commands go to. Consumer side: samples rendered so far, offset to the timestamps */
+static int dsp_alt = 0;
+static uint32_t dsp_clock = 0, dsp_lag = 0;
+static int dsp_anchor = 0;
+/* channel status words of the editors' context, like the MMIO dsp_ch registers. Written by the audio thread only */
+static volatile uint32_t dsp_altch[16];
+
+/* the audio thread's copy of the music streams. The VM compacts meg4.strmpool when a stream is replaced, so the sequencer
+ * decodes from this one, which is only changed by queued commands */
+static meg4_strm_t dsp_strm[sizeof(meg4.strm)/sizeof(meg4.strm[0])];
+static uint32_t dsp_strmlen = 0;
+static uint8_t dsp_strmpool[sizeof(meg4.strmpool)];
+
+/* audio device buffer configuration, set by the platform before opening the device, and statistics (audio thread only) */
+static int dsp_bufsmp = 1024, dsp_bufper = 4;
+static uint32_t dsp_nfeed = 0, dsp_minlen = 0, dsp_maxlen = 0, dsp_xrun = 0, dsp_late = 0;
+
+/* offline rendering, a private context which is only touched while a block is rendered, and the rows already played */
+static meg4_dsp_t dsp_off;
+static int dsp_offtype = -1;
+static uint8_t dsp_seen[65536 >> 3];
 
 /**
  * Generate waveform
  */
 void dsp_genwave(int idx, int wave)
 {
+    int8_t *tab, *cache;
+    uint32_t phase, step, frac, rem;
     int i, l;
 
     /* wave 00 is reserved for "keep using previous" */
-    if(idx < 1 || idx > 31 || wave < 0 || wave >= (int)(sizeof(waves)/sizeof(waves[0]))) return;
+    if(idx < 1 || idx > 31 || wave < 0 || wave >= DSP_WAVES) return;
     idx--;
+    /* base tables and the cache after them, generated on first use */
+    if(!dsp_wavetab) {
+        if(!(dsp_wavetab = (int8_t*)malloc(2 * DSP_WAVES << DSP_WAVEBITS))) return;
+        for(l = 0; l < DSP_WAVES; l++) {
+            for(i = 0; i < (1 << DSP_WAVEBITS); i++)
+                dsp_wavetab[(l << DSP_WAVEBITS) + i] = (int8_t)((*waves[l])(i ? (float)i / (float)(1 << DSP_WAVEBITS) : 0.0) * (float)127.0);
+            dsp_wavelen[l] = 0;
+        }
+    }
     memset(&meg4.waveforms[idx][2], 0, sizeof(meg4.waveforms[0]) - 2);
     l = (meg4.waveforms[idx][1]<<8)|meg4.waveforms[idx][0];     /* number of samples */
     if(l < 2) { l = 256; meg4.waveforms[idx][0] = 0; meg4.waveforms[idx][1] = 1; }
     meg4.waveforms[idx][7] = 64;                                /* volume */
-    for(i = 0; i < l; i++)
-        meg4.waveforms[idx][8 + i] = (int8_t)((*waves[wave])(i ? (float)i/(float)l : 0.0) * (float)127.0);
+    tab = dsp_wavetab + (wave << DSP_WAVEBITS); cache = tab + (DSP_WAVES << DSP_WAVEBITS);
+    if(l > (int)sizeof(meg4.waveforms[0]) - 8) {
+        l = sizeof(meg4.waveforms[0]) - 8; meg4.waveforms[idx][0] = l & 0xff; meg4.waveforms[idx][1] = l >> 8;
+    }
+    if(dsp_wavelen[wave] != l) {
+        /* the phase is i * 2^DSP_WAVEBITS / l, accumulated as whole and fractional parts, so it is exact (the jumps of the
+         * square, pulse and sawtooth waves are exactly where the table puts them) */
+        step = (1 << DSP_WAVEBITS) / l; frac = (1 << DSP_WAVEBITS) % l;
+        for(i = 0, phase = rem = 0; i < l; i++) {
+            cache[i] = tab[phase];
+            phase += step; rem += frac; if(rem >= (uint32_t)l) { rem -= l; phase++; }
+        }
+        dsp_wavelen[wave] = l;
+    }
+    memcpy(&meg4.waveforms[idx][8], cache, l);
+}
+
+/**
+ * Queue a command for the audio thread, stamped with the current VM time. Silently dropped if the queue is full, returns 1
+ * if it was queued
+ */
+static int dsp_push(dsp_cmd_t *c)
+{
+    uint32_t head = dsp_head, tick = le32toh(meg4.mmio.tick);
+
+    if(head - DSP_LOAD(dsp_tail) >= DSP_CMDS) return 0;
+    c->when = (tick / 10) * 441 + (tick % 10) * 441 / 10;
+    memcpy(&dsp_cmds[head & (DSP_CMDS - 1)], c, sizeof(dsp_cmd_t));
+    DSP_STORE(dsp_head, head + 1);
+    return 1;
+}
+
+/**
+ * Select the dsp context (for the editors only)
+ */
+void dsp_select(int alt)
+{
+    dsp_cmd_t c;
+
+    memset(&c, 0, sizeof(c));
+    c.cmd = DSP_SELECT; c.chan = dsp_alt = alt;
+    dsp_push(&c);
+}
+
+/**
+ * Set the master volume of a channel (for the editors only)
+ */
+void dsp_master(int channel, int volume)
+{
+    dsp_cmd_t c;
+
+    if(channel < 0 || channel > 15) return;
+    memset(&c, 0, sizeof(c));
+    c.cmd = DSP_MASTER; c.chan = channel; c.vol = volume;
+    dsp_push(&c);
+}
+
+/**
+ * Restart a channel's waveform if it has been played to the end (for the editors only)
+ */
+void dsp_rewind(int channel)
+{
+    dsp_cmd_t c;
+
+    if(channel < 0 || channel > 15) return;
+    memset(&c, 0, sizeof(c));
+    c.cmd = DSP_REWIND; c.chan = channel;
+    dsp_push(&c);
+}
+
+/**
+ * Get a channel's status word in the editors' context, 0 if it isn't audible (for the editors only)
+ */
+uint32_t dsp_status(int channel)
+{
+    return channel < 0 || channel > 15 ? 0 : DSP_LOAD(dsp_altch[channel]);
+}
+
+/**
+ * Replace a stream in a stream pool (the VM's or the audio thread's), and compact the pool. Returns 1 on success, 0 if it
+ * doesn't fit
+ */
+static int dsp_strmset(meg4_strm_t *strm, uint8_t *pool, uint32_t *used, int track, uint8_t *data, int len, int rows)
+{
+    meg4_strm_t *st = &strm[track];
+    int i;
+
+    /* remove the old one and compact the pool */
+    if(st->size) {
+        memmove(pool + st->offs, pool + st->offs + st->size, *used - st->offs - st->size);
+        for(i = 0; i < (int)(sizeof(meg4.strm)/sizeof(meg4.strm[0])); i++)
+            if(strm[i].offs > st->offs) strm[i].offs -= st->size;
+        *used -= st->size;
+    }
+    memset(st, 0, sizeof(meg4_strm_t));
+    if(rows < 1) return 1;
+    if(!data || len < 1 || *used + len > sizeof(meg4.strmpool)) return 0;
+    memcpy(pool + *used, data, len);
+    st->offs = *used; st->size = len; st->rows = rows > 65535 - DSP_ROWS ? 65535 - DSP_ROWS : rows;
+    *used += len;
+    return 1;
+}
+
+/**
+ * Set a music track's stream, rows played after the track's last row. Data is compressed with the floppy's RLE packets,
+ * and is decompressed by the sequencer as it plays. Rows 0 removes the stream. Returns 1 on success, 0 if it doesn't fit
+ */
+int dsp_stream(int track, uint8_t *data, int len, int rows)
+{
+    dsp_cmd_t c;
+    int ret;
+
+    if(track < 0 || track >= (int)(sizeof(meg4.strm)/sizeof(meg4.strm[0]))) return 0;
+    if(!(ret = dsp_strmset(meg4.strm, meg4.strmpool, &meg4.strmlen, track, data, len, rows)) && data && len > 0)
+        main_log(1, "not enough space in the stream pool for track %u (%u rows)", track, rows);
+    /* the audio thread gets its own copy through the queue, the music might be playing */
+    memset(&c, 0, sizeof(c));
+    c.cmd = DSP_STREAM; c.track = track; c.num = meg4.strm[track].rows;
+    if(c.num && (c.data = (uint8_t*)malloc(len))) { memcpy(c.data, data, len); c.len = len; }
+    else c.num = 0;
+    if(!dsp_push(&c) && c.data) free(c.data);
+    return ret;
+}
+
+/**
+ * Compress num rows (16 bytes each) and set them as a music track's stream
+ */
+int dsp_packstream(int track, uint8_t *rows, int num)
+{
+    uint8_t *out;
+    int i, k, l, o, len = num * 16, ret;
+
+    if(!rows || num < 1) return dsp_stream(track, NULL, 0, 0);
+    if(!(out = (uint8_t*)malloc(2 * len + 1))) return 0;
+    /* packets are 0x80 | (n - 1) followed by a byte repeated n times, or n - 1 followed by n bytes */
+    for(i = o = 0, k = -1; i < len; i += l) {
+        for(l = 1; l < 128 && i + l < len && rows[i] == rows[i + l]; l++);
+        if(l > 1) { out[o++] = 0x80 | (l - 1); out[o++] = rows[i]; k = -1; continue; }
+        if(k < 0 || out[k] == 127) { k = o; out[o++] = 0; } else out[k]++;
+        out[o++] = rows[i];
+    }
+    ret = dsp_stream(track, out, o, num);
+    free(out);
+    return ret;
 }
 
 /**
@@ -101,16 +328,36 @@ void dsp_genwave(int idx, int wave)
  */
 void dsp_init(void)
 {
-    int i, j;
+    dsp_cmd_t c;
+    int i, j, b, t, s;
     float f;
+    double x, h[DSP_TAPS], sum;
 
-    dsp = &meg4.dram;
+    /* called on power on, before the audio thread is started */
+    dsp = &meg4.dram; dsp_alt = 0; dsp_anchor = 0;
+    dsp_nfeed = dsp_minlen = dsp_maxlen = dsp_xrun = dsp_late = 0;
+    /* the VM's streams are cleared too, drop the audio thread's copy (an invalid track removes all of them) */
+    memset(&c, 0, sizeof(c));
+    c.cmd = DSP_STREAM; c.track = 255;
+    dsp_push(&c);
     /* generate tables */
     for(i = 1; i < 16; i++) {
         f = powf(2, ((float)-(i < 8 ? i : i - 16) / 12.0) / 8.0);
         for(j = 1; j < MEG4_NUM_NOTE; j++)
             dsp_finetune[i - 1][j - 1] = (int)roundf(f * dsp_periods[j]);
     }
+    /* Blackman windowed sinc, each phase normalized to unity gain */
+    for(b = 0; b < 4; b++)
+        for(i = 0; i < DSP_PHASES; i++) {
+            for(t = 0, sum = 0.0; t < DSP_TAPS; t++) {
+                x = (double)(t - DSP_TAPS / 2 + 1) - (double)i / DSP_PHASES;
+                h[t] = x == 0.0 ? 1.0 : sin(3.14159265358979 * x / (b + 1)) / (3.14159265358979 * x / (b + 1));
+                h[t] *= 0.42 + 0.5 * cos(3.14159265358979 * x / (DSP_TAPS / 2)) + 0.08 * cos(2 * 3.14159265358979 * x / (DSP_TAPS / 2));
+                sum += h[t];
+            }
+            for(t = s = 0; t < DSP_TAPS; t++) s += dsp_sinc[b][i][t] = (int16_t)floor(h[t] * 16384.0 / sum + 0.5);
+            dsp_sinc[b][i][DSP_TAPS / 2 - 1 + (i >= DSP_PHASES / 2)] += 16384 - s;
+        }
 }
 
 /**
@@ -118,7 +365,50 @@ void dsp_init(void)
  */
 void dsp_free(void)
 {
+    if(dsp_nfeed)
+        main_log(1, "audio %u buffers of %u to %u samples (%u x %u, %u msec latency), %u underruns, %u late commands",
+            dsp_nfeed, dsp_minlen, dsp_maxlen, dsp_bufper, dsp_bufsmp, dsp_bufsmp * dsp_bufper * 10 / 441, dsp_xrun, dsp_late);
     if(defwaves) { free(defwaves); defwaves = NULL; }
+    if(dsp_wavetab) { free(dsp_wavetab); dsp_wavetab = NULL; }
+}
+
+/**
+ * Set the audio device's buffer size in samples (rounded down to power of two) and the number of periods (buffers)
+ */
+void meg4_audiobuf(int samples, int periods)
+{
+    int i;
+
+    if(samples > 0) {
+        for(i = 64; i < 8192 && i * 2 <= samples; i <<= 1);
+        dsp_bufsmp = i;
+    }
+    if(periods > 0) dsp_bufper = periods < 2 ? 2 : (periods > 16 ? 16 : periods);
+}
+
+/**
+ * Query the audio device's buffer configuration
+ */
+void meg4_audiogetbuf(int *samples, int *periods)
+{
+    if(samples) *samples = dsp_bufsmp;
+    if(periods) *periods = dsp_bufper;
+}
+
+/**
+ * Select the resampler's quality, 0 nearest (default), 1 linear, 2 windowed sinc
+ */
+void meg4_audioresampler(int quality)
+{
+    dsp_quality = quality < 0 ? 0 : (quality > 2 ? 2 : quality);
+}
+
+/**
+ * Report an underrun (called by the platform from the audio thread)
+ */
+void meg4_audiounderrun(void)
+{
+    dsp_xrun++;
 }
 
 /**
@@ -126,8 +416,12 @@ void dsp_free(void)
  */
 void dsp_reset(void)
 {
-    meg4.mmio.dsp_row = meg4.mmio.dsp_num = meg4.mmio.dsp_track = meg4.mmio.dsp_ticks = 0;
-    memset(&meg4.dram, 0, sizeof(meg4.dram));
+    dsp_cmd_t c;
+
+    meg4.mmio.dsp_row = meg4.mmio.dsp_num = meg4.mmio.dsp_track = meg4.mmio.dsp_ticks = meg4.mmio.dsp_voices = 0;
+    memset(&c, 0, sizeof(c));
+    c.cmd = DSP_RESET;
+    dsp_push(&c);
 }
 
 /**
@@ -218,7 +512,7 @@ static void dsp_note(int channel, uint8_t *note)
         case 0xEA: DSP_MEM(ch->fvsu, ch->ep); break;
         case 0xEB: DSP_MEM(ch->fvsd, ch->ep); break;
         case 0x9: if(period != 0 || note[1] != 0) { if(ch->ep) { ch->offs = ch->ep; } ch->position = ch->offs << 8; } break;
-        case 0xB: dsp->row = (ch->ep > 15 || (int)(ch->ep << 6) >= (int)dsp->num ? 0 : ch->ep << 6) - 1; break;
+        case 0xB: dsp->row = ((int)(ch->ep << 6) >= (int)dsp->num ? 0 : ch->ep << 6) - 1; break;
         case 0xC: ch->volume = (int)ch->ep; ch->dirty |= 2; break;
         case 0xE4: ch->lfo_vib = ch->ep & 3; break;
         case 0xE5: ch->finetune = ch->ep & 0xf; ch->dirty |= 1; break;
@@ -228,13 +522,86 @@ static void dsp_note(int channel, uint8_t *note)
     }
 }
 
+/**
+ * Update the active voices bitmask for a range of channels, called whenever a note, effect or command might have started or
+ * stopped one (the resampler clears the bit itself when a waveform ends)
+ */
+static void dsp_voices(int s, int e)
+{
+    meg4_dsp_ch_t *ch;
+
+    for(; s < e; s++) {
+        ch = &dsp->ch[s];
+        if(ch->master && ch->sample && ch->position >= 0.0f && ch->increment > 0.0f) dsp->live |= 1 << s;
+        else dsp->live &= ~(1 << s);
+    }
+}
+
+/**
+ * Decompress a music track's whole stream into rows (which must be big enough), returns the number of rows
+ */
+int dsp_unpackstream(int track, uint8_t *rows)
+{
+    meg4_strm_t *st;
+    uint8_t *ptr, *end;
+    int l, o = 0, len;
+
+    if(track < 0 || track >= (int)(sizeof(meg4.strm)/sizeof(meg4.strm[0])) || !rows) return 0;
+    st = &meg4.strm[track]; len = st->rows * 16;
+    for(ptr = meg4.strmpool + st->offs, end = ptr + st->size; ptr < end && o < len;) {
+        l = (*ptr & 0x7F) + 1;
+        if(*ptr++ & 0x80) { if(ptr >= end) { break; } for(; l-- && o < len; o++) { rows[o] = *ptr; } ptr++; }
+        else for(; l-- && o < len && ptr < end; o++) rows[o] = *ptr++;
+    }
+    if(o < len) memset(rows + o, 0, len - o);
+    return st->rows;
+}
+
+/**
+ * Get the next decompressed byte of the music track's stream
+ */
+static uint8_t dsp_strmbyte(meg4_strm_t *st, uint8_t *pool)
+{
+    uint8_t b;
+
+    if(!dsp->scnt) {
+        if(dsp->spos >= st->size) return 0;
+        b = pool[(st->offs + dsp->spos++) & (sizeof(meg4.strmpool) - 1)];
+        dsp->scnt = (b & 0x7F) + 1; dsp->srep = b >> 7;
+    }
+    dsp->scnt--;
+    if(dsp->spos >= st->size) return 0;
+    b = pool[(st->offs + dsp->spos) & (sizeof(meg4.strmpool) - 1)];
+    if(!dsp->srep || !dsp->scnt) dsp->spos++;
+    return b;
+}
+
+/**
+ * Get a row from the music track's stream. Rows are decompressed into a ring buffer a few rows ahead of the one being
+ * played, so that a long track needs no more memory than that. Jumping backwards restarts the decoder. The offline
+ * renderer runs on the VM thread, that one uses the VM's streams
+ */
+static uint8_t *dsp_strmrow(int row)
+{
+    meg4_strm_t *st = dsp == &dsp_off ? &meg4.strm[dsp->track] : &dsp_strm[dsp->track];
+    uint8_t *pool = dsp == &dsp_off ? meg4.strmpool : dsp_strmpool;
+    int i, n = (int)(sizeof(dsp->ring) / sizeof(dsp->ring[0]));
+
+    row -= DSP_ROWS;
+    if(row < dsp->srow - n) { dsp->srow = dsp->scnt = 0; dsp->spos = 0; }
+    for(; dsp->srow < row + n && dsp->srow < st->rows; dsp->srow++)
+        for(i = 0; i < 16; i++) dsp->ring[dsp->srow % n][i] = dsp_strmbyte(st, pool);
+    return dsp->ring[row % n];
+}
+
 /**
  * Process one music or sound tick
  */
 static void dsp_next_tick(int type)
 {
     meg4_dsp_ch_t *ch;
-    int i, tick, rate, order, closer, s = (type ? 4 : 0), e = (type ? 16 : 4);
+    int i, row, tick, rate, order, closer, s = (type ? 4 : 0), e = (type ? 16 : 4);
+    uint8_t *note;
     float period;
     static const float arpeggio[16] = {
         1.000000f, 1.059463f, 1.122462f, 1.189207f, 1.259921f, 1.334840f, 1.414214f, 1.498307f,
@@ -246,8 +613,11 @@ static void dsp_next_tick(int type)
         if(dsp->tick[0] >= dsp->ticks_per_row) {
             if(dsp->ticks_per_row > 0) {
                 if(dsp->row >= dsp->num) dsp->row = 0;
+                /* a position jump (0xB) changes dsp->row, the rest of the channels must still get this row's notes */
+                row = dsp->row;
+                note = row < DSP_ROWS ? &meg4.tracks[dsp->track][row << 4] : dsp_strmrow(row);
                 for(i = 0; i < 4; i++)
-                    dsp_note(i, &meg4.tracks[dsp->track][((dsp->row << 2) + i) << 2]);
+                    dsp_note(i, note + (i << 2));
                 dsp->row++;
             }
             dsp->tick[0] = 0;
@@ -316,19 +686,225 @@ tone:               rate = ch->porta; order = ch->period < ch->target; closer =
             ch->dirty &= ~2;
         }
     }
+    dsp_voices(s, e);
 }
 
 /**
- * Feed the audio device with raw PCM data
+ * Get the taps around a sample that are over the loop end or before the start. Loops are periodic with ll, one-shot
+ * waveforms are silent outside of the sample data
  */
-void meg4_audiofeed(float *buf, int len)
+static int8_t *dsp_taps(int8_t *smp, int i, int ls, int ll, int e, int8_t *tmp)
+{
+    int t, j;
+
+    for(t = 0; t < DSP_TAPS; t++) {
+        j = i - DSP_TAPS / 2 + 1 + t;
+        if(ll > 0) {
+            while(j >= e) j -= ll;
+            if(i >= ls) while(j < ls) j += ll;
+        }
+        tmp[t] = j < 0 || j >= e ? 0 : smp[j];
+    }
+    return tmp;
+}
+
+/**
+ * Convolve the taps with one phase of the sinc table
+ */
+static int dsp_fir(int8_t *x, int16_t *c)
+{
+    int r;
+#ifdef DSP_SSE2
+    __m128i v = _mm_loadu_si128((__m128i*)x), s = _mm_cmplt_epi8(v, _mm_setzero_si128());
+    v = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(v, s), _mm_loadu_si128((__m128i*)c)),
+        _mm_madd_epi16(_mm_unpackhi_epi8(v, s), _mm_loadu_si128((__m128i*)(c + 8))));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4E));
+    r = _mm_cvtsi128_si32(_mm_add_epi32(v, _mm_shuffle_epi32(v, 0xB1)));
+#else
+#ifdef DSP_NEON
+    int8x16_t v = vld1q_s8(x);
+    int32x4_t a = vmull_s16(vget_low_s16(vmovl_s8(vget_low_s8(v))), vld1_s16(c));
+    int32x2_t p;
+    a = vmlal_s16(a, vget_high_s16(vmovl_s8(vget_low_s8(v))), vld1_s16(c + 4));
+    a = vmlal_s16(a, vget_low_s16(vmovl_s8(vget_high_s8(v))), vld1_s16(c + 8));
+    a = vmlal_s16(a, vget_high_s16(vmovl_s8(vget_high_s8(v))), vld1_s16(c + 12));
+    p = vpadd_s32(vget_low_s32(a), vget_high_s32(a));
+    r = vget_lane_s32(vpadd_s32(p, p), 0);
+#else
+    int t;
+    for(t = r = 0; t < DSP_TAPS; t++) r += x[t] * c[t];
+#endif
+#endif
+    /* from 1.14 to DSP_FRAC. Leaves room for the ringing of full scale edges, but clamped so that 12 channels at the
+     * highest volume dsp_group allows (255 * 64) can't overflow the accumulator, 12 * 10240 * 16320 < 2^31 */
+    r = (r + (1 << (13 - DSP_FRAC))) >> (14 - DSP_FRAC);
+    return r > 10240 ? 10240 : (r < -10240 ? -10240 : r);
+}
+
+/**
+ * Resample one channel into dsp_smp for the next num samples, returns the number of samples written. With q -1 the position
+ * is only stepped (for silent voices)
+ */
+static int dsp_resample(meg4_dsp_ch_t *ch, int k, int num, int q)
+{
+    int8_t *smp = (int8_t*)&meg4.waveforms[ch->sample - 1][0], tmp[DSP_TAPS];
+    int16_t (*coef)[DSP_TAPS];
+    int i, j, o = 0, l, ls, ll, le, e, s, t;
+    float pos = ch->position, inc = ch->increment;
+
+    l = ((uint8_t)smp[1]<<8)|(uint8_t)smp[0];  ls = ((uint8_t)smp[3]<<8)|(uint8_t)smp[2];
+    ll = ((uint8_t)smp[5]<<8)|(uint8_t)smp[4]; le = ll > 0 ? ls + ll : l;
+    smp += 8;
+    /* the interpolating ones see the data as periodic, so that every note is band limited */
+    e = ll > 0 ? le : l;
+    /* band limit: the higher the pitch, the lower the cut off frequency in the source sample */
+    for(i = 0; i < 3 && inc > (float)(i + 1); i++);
+    coef = dsp_sinc[i];
+    /* split at the loop boundaries, so that the inner loop is nothing but stepping and fetching */
+    while(num > 0) {
+        /* the positions before the loop end (or the end of a one-shot waveform). Not precounted, the rounding of a float
+         * division could step over the end, and the loop must be wrapped at the very same sample no matter how the output
+         * is split */
+        switch(q) {
+            case -1:
+                for(j = 0; j < num && pos < (float)le; j++) pos += inc;
+            break;
+            case 0:
+                for(j = 0; j < num && pos < (float)le; j++, pos += inc)
+                    dsp_smp[o++] = smp[(int)pos];
+            break;
+            case 1:
+                for(j = 0; j < num && pos < (float)le; j++, pos += inc) {
+                    i = (int)pos;
+                    if(i + 1 < e) { s = smp[i]; t = smp[i + 1]; }
+                    else {
+                        s = i < e ? smp[i] : (ll > 0 ? smp[i - ll] : 0);
+                        t = ll > 0 ? smp[i + 1 - ll] : 0;
+                    }
+                    dsp_smp[o++] = s * (1 << DSP_FRAC) + (t - s) * (int)((pos - (float)i) * (1 << DSP_FRAC));
+                }
+            break;
+            default:
+                for(j = 0; j < num && pos < (float)le; j++, pos += inc) {
+                    i = (int)pos;
+                    dsp_smp[o++] = dsp_fir(i >= DSP_TAPS / 2 - 1 && i + DSP_TAPS / 2 < e ? smp + i - DSP_TAPS / 2 + 1 :
+                        dsp_taps(smp, i, ls, ll, e, tmp), coef[(int)((pos - (float)i) * DSP_PHASES)]);
+                }
+            break;
+        }
+        num -= j;
+        /* wrap around (several times in a row if a sample offset effect put the position way past the end) */
+        if(pos >= (float)le) {
+            if(ll > 0) {
+                if(k) {
+                    if(ch->tremolo) ch->tremolo--;
+                    else { pos = -1.0f; ch->tremolo = meg4.waveforms[ch->sample - 1][7]; break; }
+                }
+                pos -= ll;
+            } else { pos = -1.0f; break; }
+        }
+    }
+    ch->position = pos;
+    return o;
+}
+
+/**
+ * Accumulate resampled data with a fixed point volume, at most 255 * 64 (clamped by dsp_group). The SIMD paths multiply it
+ * as unsigned 16 bit
+ */
+static void dsp_accumulate(int n, int vol)
+{
+    int i = 0;
+#ifdef DSP_SSE2
+    __m128i v = _mm_set1_epi16((int16_t)vol), s, lo, hi;
+    for(; i + 8 <= n; i += 8) {
+        s = _mm_loadu_si128((__m128i*)(dsp_smp + i));
+        /* signed sample times unsigned volume: the unsigned high half minus the volume where the sample is negative */
+        lo = _mm_mullo_epi16(s, v); hi = _mm_sub_epi16(_mm_mulhi_epu16(s, v), _mm_and_si128(_mm_srai_epi16(s, 15), v));
+        _mm_storeu_si128((__m128i*)(dsp_acc + i), _mm_add_epi32(_mm_loadu_si128((__m128i*)(dsp_acc + i)), _mm_unpacklo_epi16(lo, hi)));
+        _mm_storeu_si128((__m128i*)(dsp_acc + i + 4), _mm_add_epi32(_mm_loadu_si128((__m128i*)(dsp_acc + i + 4)), _mm_unpackhi_epi16(lo, hi)));
+    }
+#endif
+#ifdef DSP_NEON
+    int16x8_t s;
+    for(; i + 8 <= n; i += 8) {
+        s = vld1q_s16(dsp_smp + i);
+        vst1q_s32(dsp_acc + i, vmlaq_n_s32(vld1q_s32(dsp_acc + i), vmovl_s16(vget_low_s16(s)), vol));
+        vst1q_s32(dsp_acc + i + 4, vmlaq_n_s32(vld1q_s32(dsp_acc + i + 4), vmovl_s16(vget_high_s16(s)), vol));
+    }
+#endif
+    for(; i < n; i++) dsp_acc[i] += dsp_smp[i] * vol;
+}
+
+/**
+ * Convert the accumulated samples to float and add them to the output
+ */
+static void dsp_output(float *out, int n, float scale)
+{
+    int i = 0;
+#ifdef DSP_SSE2
+    __m128 m = _mm_set1_ps(scale);
+    for(; i + 4 <= n; i += 4)
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((__m128i*)(dsp_acc + i))), m)));
+#endif
+#ifdef DSP_NEON
+    for(; i + 4 <= n; i += 4)
+        vst1q_f32(out + i, vaddq_f32(vld1q_f32(out + i), vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(dsp_acc + i)), scale)));
+#endif
+    for(; i < n; i++) out[i] += (float)dsp_acc[i] * scale;
+}
+
+/**
+ * Sequencer: number of samples until the next tick of a clock (0 music, 1 sound effects). The tick lengths are fractional
+ * with some tempos, a tick is due on the first whole sample at or after its exact time, and the remainder is carried over
+ */
+static int dsp_span(int k)
+{
+    float t = (k ? DSP_SPT : dsp->samples_per_tick) - dsp->sample[k];
+    int n = (int)t;
+
+    if((float)n < t) n++;
+    return n < 1 ? 1 : n;
+}
+
+/**
+ * Mixer: resample and accumulate the live voices of a group for num samples, returns the number of audible ones
+ */
+static int dsp_group(float *out, int s, int e, int num, int q, float scale)
 {
     meg4_dsp_ch_t *ch;
-    int8_t *smp;
-    int i, j, k = 1, l, n, m, o, p = 1, s, e, d, num, rem, ls, ll, le;
-    float volume, *ptr, t;
+    int i, n, vol, mixed = 0;
+
+    for(i = s; i < e; i++)
+        if(dsp->live & (1 << i)) {
+            ch = &dsp->ch[i];
+            /* the volume is latched for the span, the resampler might change tremolo on sound effect loops. Silent voices
+             * are only stepped through, so that they are at the right position when they become audible again. Sound
+             * effect loops keep their repeat counter in tremolo (and a negative tremolo slide wraps it), so it is clamped
+             * to the full volume the output is scaled with */
+            vol = ch->master * ch->tremolo;
+            if(vol > 255 * 64) vol = 255 * 64;
+            n = dsp_resample(ch, s >= 4, num, vol ? q : -1);
+            if(vol) {
+                if(!mixed++) memset(dsp_acc, 0, num * sizeof(int32_t));
+                dsp_accumulate(n, vol);
+            }
+            if(ch->position < 0.0f) dsp->live &= ~(1 << i);
+        }
+    if(mixed) dsp_output(out, num, scale);
+    return mixed;
+}
+
+/**
+ * Mix the next len samples
+ */
+static void dsp_mix(float *buf, int len)
+{
+    meg4_dsp_ch_t *ch;
+    uint32_t w;
+    int i, k, d, num, pos, run[2], voices = 0, q = dsp_quality;
+    float scale;
 
-    if(!buf || len < 1 || !dsp) return;
     /* update the DSP status registers */
     if(dsp == &meg4.dram) {
         if(meg4.dram.ticks_per_row > 0) {
@@ -341,49 +917,221 @@ void meg4_audiofeed(float *buf, int len)
         }
     }
     for(i = d = 0; i < 16; i++) {
-        ch = &dsp->ch[i];
+        ch = &dsp->ch[i]; w = 0;
         if(ch->master && ch->tremolo && ch->sample && ch->position >= 0.0f && ch->increment > 0.0f) {
-            if(i >= 4) { d++; k = 1; p = 2; }
-            if(dsp == &meg4.dram)
-                meg4.mmio.dsp_ch[i] = ((((int)ch->tremolo * 255) >> 6) << 24) | (ch->sample << 16) | htole16((int)ch->position & 0xffff);
-        } else if(dsp == &meg4.dram) meg4.mmio.dsp_ch[i] = 0;
+            if(i >= 4) d++;
+            w = ((((int)ch->tremolo * 255) >> 6) << 24) | (ch->sample << 16) | htole16((int)ch->position & 0xffff);
+        }
+        /* the editors must not read meg4.dalt, that's the audio thread's, they get the same status words as programs do */
+        if(dsp == &meg4.dram) meg4.mmio.dsp_ch[i] = w; else
+        if(dsp == &meg4.dalt) DSP_STORE(dsp_altch[i], w);
     }
-    if(dsp->ticks_per_row) { d += 4; k = 0; }
-    /* update the output buffer */
+    run[0] = dsp->ticks_per_row != 0;
+    if(run[0]) d += 4;
+    /* update the output buffer. Channels are mixed with integer volumes (master * tremolo, clamped to 255 * 64) into a 32 bit
+     * accumulator, which is converted to float once per span. A span lasts until the next tick of either clock, so the
+     * sequencer runs at exactly the same samples no matter how the platform splits the output into buffers */
     memset(buf, 0, len * sizeof(float));
-    if(k) { s = 4; e = 16; t = DSP_SPT; } else { s = 0; e = 4; t = dsp->samples_per_tick; }
-    for(; k < p; k++) {
-        for(ptr = buf, rem = len; rem > 0;) {
-            num = (int)(t - dsp->sample[k]); if(num < 1) { break; } if(num > rem) { num = rem; }
-            for(i = s; i < e; i++) {
-                ch = &dsp->ch[i];
-                if(ch->master && ch->sample && ch->position >= 0.0f && ch->increment > 0.0f) {
-                    smp = (int8_t*)&meg4.waveforms[ch->sample - 1][0];
-                    l = ((uint8_t)smp[1]<<8)|(uint8_t)smp[0];  ls = ((uint8_t)smp[3]<<8)|(uint8_t)smp[2];
-                    ll = ((uint8_t)smp[5]<<8)|(uint8_t)smp[4]; le = ll > 0 ? ls + ll : l;
-                    m = num; o = 0; volume = ch->master * ch->tremolo / (float) (128 * 255 * 64 * d);
-                    do {
-                        n = ((float)(le + 1) - ch->position) / ch->increment;
-                        if(n > m) n = m;
-                        for(j = 0; j < n; j++, ch->position += ch->increment)
-                            ptr[o++] += (float)smp[8 + (int)ch->position] * volume;
-                        if(ch->position > le) {
-                            if(ll > 0) {
-                                if(k) {
-                                    if(ch->tremolo) ch->tremolo--;
-                                    else { ch->position = -1.0f; ch->tremolo = meg4.waveforms[ch->sample - 1][7]; break; }
-                                }
-                                ch->position -= ll;
-                            } else { ch->position = -1.0f; break; }
-                        }
-                        m -= n;
-                    } while(n > 0);
-                }
+    /* nothing playing, the whole buffer is silence */
+    if(!dsp->live && !run[0]) { if(dsp == &meg4.dram) meg4.mmio.dsp_voices = 0; return; }
+    scale = d ? 1.0f / ((float)(128 * 255 * 64 * d) * (q ? (float)(1 << DSP_FRAC) : 1.0f)) : 0.0f;
+    for(pos = 0; pos < len; pos += num) {
+        /* the sound effect clock only runs while there's a sound effect playing */
+        for(i = 4, run[1] = 0; i < 16 && !run[1]; i++)
+            run[1] = (dsp->live & (1 << i)) && dsp->ch[i].tremolo;
+        num = len - pos; if(num > DSP_BLK) num = DSP_BLK;
+        for(k = 0; k < 2; k++)
+            if(run[k] && (i = dsp_span(k)) < num) num = i;
+        i = run[0] ? dsp_group(buf + pos, 0, 4, num, q, scale) : 0;
+        if(run[1]) i += dsp_group(buf + pos, 4, 16, num, q, scale);
+        if(i > voices) voices = i;
+        /* events at the end of the span, music first */
+        for(k = 0; k < 2; k++)
+            if(run[k] && (dsp->sample[k] += (float)num) >= (k ? DSP_SPT : dsp->samples_per_tick)) {
+                dsp->sample[k] -= k ? DSP_SPT : dsp->samples_per_tick;
+                dsp_next_tick(k);
+            }
+    }
+    if(dsp == &meg4.dram) meg4.mmio.dsp_voices = voices;
+}
+
+/**
+ * Number of rows in a track (up to the last non-empty one, or all of them plus the stream's if it has one)
+ */
+static int dsp_rows(int track)
+{
+    int i, n = 0;
+
+    if(meg4.strm[track].rows) return DSP_ROWS + meg4.strm[track].rows;
+    for(i = 0; i < (int)(sizeof(meg4.tracks[0]) / 16); i++)
+        if(!meg4_isbyte(&meg4.tracks[track][i * 16], 0, 16)) n = i + 1;
+    return n;
+}
+
+/**
+ * Execute one command on the audio thread
+ */
+static void dsp_exec(dsp_cmd_t *c)
+{
+    int i;
+
+    switch(c->cmd) {
+        case DSP_RESET: memset(&meg4.dram, 0, sizeof(meg4.dram)); break;
+        case DSP_SELECT:
+#ifndef NOEDITORS
+            if(c->chan) { memset(&meg4.dalt, 0, sizeof(meg4.dalt)); dsp = &meg4.dalt; } else
+#endif
+            dsp = &meg4.dram;
+        break;
+        case DSP_SFX:
+            memset(&dsp->ch[4 + c->chan], 0, sizeof(meg4_dsp_ch_t));
+            if(c->note[0] && c->note[1] && c->vol) {
+                dsp_note(4 + c->chan, c->note);
+                dsp->ch[4 + c->chan].master = c->vol;
+                dsp_next_tick(1);
+            }
+        break;
+        case DSP_MUSIC:
+            memset(&dsp->ch, 0, 4 * sizeof(meg4_dsp_ch_t));
+            dsp->track = dsp->row = dsp->num = dsp->ticks_per_row = dsp->srow = dsp->scnt = 0; dsp->spos = 0;
+            if(c->num && c->vol) {
+                dsp->track = c->track; dsp->row = c->row; dsp->num = c->num; dsp->ticks_per_row = dsp->tick[0] = 6;
+                dsp->ch[0].master = dsp->ch[1].master = dsp->ch[2].master = dsp->ch[3].master = c->vol;
+                dsp_next_tick(0);
             }
-            rem -= num; ptr += num; if((dsp->sample[k] += num) >= t) { dsp->sample[k] -= t; dsp_next_tick(k); }
+        break;
+        case DSP_NOTE:
+            if(dsp == &meg4.dram) break;
+            for(i = 0; i < 16; i++) dsp->ch[i].master = 0;
+            dsp->ticks_per_row = 0;
+            if(c->vol) { dsp_note(4, c->note); dsp->ch[4].master = c->vol; dsp->tick[1] = 6; dsp_next_tick(1); }
+        break;
+        case DSP_MASTER: dsp->ch[c->chan].master = c->vol; break;
+        case DSP_REWIND:
+            if(dsp->ch[c->chan].sample && dsp->ch[c->chan].increment > 0.0f && dsp->ch[c->chan].position < 0.0f)
+                dsp->ch[c->chan].position = 0.0f;
+        break;
+        case DSP_STREAM:
+            if(c->track >= sizeof(dsp_strm)/sizeof(dsp_strm[0])) { memset(dsp_strm, 0, sizeof(dsp_strm)); dsp_strmlen = 0; }
+            else {
+                dsp_strmset(dsp_strm, dsp_strmpool, &dsp_strmlen, c->track, c->data, c->len, c->num);
+                /* if it is being played, decode the new one from its start up to the current row */
+                if(meg4.dram.track == c->track) { meg4.dram.srow = meg4.dram.scnt = 0; meg4.dram.spos = 0; }
+#ifndef NOEDITORS
+                if(meg4.dalt.track == c->track) { meg4.dalt.srow = meg4.dalt.scnt = 0; meg4.dalt.spos = 0; }
+#endif
+            }
+            if(c->data) free(c->data);
+        break;
+    }
+    dsp_voices(0, 16);
+}
+
+/**
+ * Execute the queued commands that are due, returns the number of samples to mix before the next one (at most len).
+ * The first command anchors the VM clock to the sample clock, those arriving late or too far ahead re-anchor it
+ */
+static int dsp_poll(int len)
+{
+    dsp_cmd_t *c;
+    int32_t d;
+
+    while(dsp_tail != DSP_LOAD(dsp_head)) {
+        c = &dsp_cmds[dsp_tail & (DSP_CMDS - 1)];
+        d = (int32_t)(c->when + dsp_lag - dsp_clock);
+        if(!dsp_anchor || d < 0 || d > len + 1470) {
+            if(dsp_anchor && d < 0) dsp_late++;
+            dsp_lag = dsp_clock - c->when; dsp_anchor = 1; d = 0;
+        }
+        if(d > 0) return d < len ? d : len;
+        dsp_exec(c);
+        DSP_STORE(dsp_tail, dsp_tail + 1);
+    }
+    return len;
+}
+
+/**
+ * Feed the audio device with raw PCM data
+ */
+void meg4_audiofeed(float *buf, int len)
+{
+    int n;
+
+    if(!buf || len < 1) return;
+    if((uint32_t)len > dsp_maxlen) dsp_maxlen = len;
+    if(!dsp_nfeed++ || (uint32_t)len < dsp_minlen) dsp_minlen = len;
+    while(len > 0) {
+        n = dsp_poll(len);
+        dsp_mix(buf, n);
+        buf += n; len -= n; dsp_clock += n;
+    }
+}
+
+/**
+ * Start rendering a music track (type 0, idx 0 to 7) or a sound effect (type 1, idx 0 to 63) offline. Returns 1 if there's
+ * anything to render. Must not be called while the platform's audio thread is running
+ */
+int meg4_audiooffline(int type, int idx)
+{
+    meg4_dsp_t *save = dsp;
+    uint8_t *note;
+    int n;
+
+    memset(&dsp_off, 0, sizeof(dsp_off)); memset(dsp_seen, 0, sizeof(dsp_seen));
+    dsp_offtype = -1; dsp = &dsp_off;
+    if(!type) {
+        if(idx >= 0 && idx < (int)(sizeof(meg4.tracks)/sizeof(meg4.tracks[0])) && (n = dsp_rows(idx)) > 0) {
+            dsp->track = idx; dsp->num = n; dsp->ticks_per_row = dsp->tick[0] = 6;
+            dsp->ch[0].master = dsp->ch[1].master = dsp->ch[2].master = dsp->ch[3].master = 255;
+            dsp_seen[0] = 1; dsp_offtype = 0;
+            dsp_next_tick(0);
+        }
+    } else
+    if(idx >= 0 && idx < 64) {
+        note = &meg4.mmio.sounds[idx << 2];
+        if(note[0] && note[1]) {
+            dsp_note(4, note); dsp->ch[4].master = 255; dsp_offtype = 1;
+            dsp_next_tick(1);
         }
-        s = e; e = 16; t = DSP_SPT;
     }
+    dsp = save;
+    return dsp_offtype >= 0;
+}
+
+/**
+ * Render the next len samples offline, as fast as possible. Returns the number of samples rendered, less than len at the end
+ * (when the music would start over, or when the sound effect is finished)
+ */
+int meg4_audiorender(float *buf, int len)
+{
+    meg4_dsp_t *save = dsp;
+    meg4_dsp_ch_t *ch = &dsp_off.ch[4];
+    int n, num, r = 0, row = 0;
+    float t, s;
+
+    if(!buf || len < 1 || dsp_offtype < 0) return 0;
+    dsp = &dsp_off;
+    for(n = 0; n < len && dsp_offtype >= 0; n += num) {
+        /* mix up to the next tick, so that we can stop right before a row that has been played already */
+        t = dsp_offtype ? DSP_SPT - dsp->sample[1] : dsp->samples_per_tick - dsp->sample[0];
+        num = (int)t; if((float)num < t) num++;
+        if(!dsp_offtype) {
+            r = dsp->row >= dsp->num ? 0 : dsp->row;
+            row = dsp->tick[0] + 1 >= dsp->ticks_per_row;
+        }
+        if(num < 1) num = 1;
+        if(num > len - n) num = len - n;
+        s = dsp->sample[0];
+        dsp_mix(buf + n, num);
+        if(!dsp_offtype) {
+            if(row && dsp->sample[0] < s + (float)num) {
+                if(dsp_seen[r >> 3] & (1 << (r & 7))) dsp_offtype = -1; else dsp_seen[r >> 3] |= 1 << (r & 7);
+            }
+        } else
+        if(!ch->master || !ch->sample || ch->position < 0.0f || ch->increment <= 0.0f) dsp_offtype = -1;
+    }
+    dsp = save;
+    return n;
 }
 
 /**
@@ -394,41 +1142,41 @@ void meg4_audiofeed(float *buf, int len)
  */
 void meg4_api_sfx(uint8_t sfx, uint8_t channel, uint8_t volume)
 {
-    if(channel > 11 || !dsp) return;
-    memset(&dsp->ch[4 + channel], 0, sizeof(meg4_dsp_ch_t));
-    if(sfx < 64 && meg4.mmio.sounds[sfx << 2] && meg4.mmio.sounds[(sfx << 2) + 1] && volume) {
-        dsp_note(4 + channel, &meg4.mmio.sounds[sfx << 2]);
-        dsp->ch[4 + channel].master = volume;
-        dsp_next_tick(1);
-    }
+    dsp_cmd_t c;
+
+    if(channel > 11) return;
+    memset(&c, 0, sizeof(c));
+    c.cmd = DSP_SFX; c.chan = channel; c.vol = volume;
+    if(sfx < 64) memcpy(c.note, &meg4.mmio.sounds[sfx << 2], 4);
+    dsp_push(&c);
 }
 
 /**
  * Plays a music track.
  * @param track the index of the music track, 0 to 7
- * @param row row to start playing from, 0 to 1023 (max song length)
+ * @param row row to start playing from, 0 to 1023 (max song length, more if the track has a stream)
  * @param volume volume to be used, 0 to 255, 0 turns off music
  */
 void meg4_api_music(uint8_t track, uint16_t row, uint8_t volume)
 {
-    int i, n = 0;
+    dsp_cmd_t c;
+    int n;
 
-    if(!dsp) return;
-    if(dsp == &meg4.dram) { meg4.mmio.dsp_row = meg4.mmio.dsp_num = meg4.mmio.dsp_track = meg4.mmio.dsp_ticks = 0; }
-    memset(&dsp->ch, 0, 4 * sizeof(meg4_dsp_ch_t));
-    dsp->track = dsp->row = dsp->num = dsp->ticks_per_row = 0;
-    if(track > sizeof(meg4.tracks)/sizeof(meg4.tracks[0]) || row >= (sizeof(meg4.tracks[0]) >> 4)) return;
-    for(i = 0; i < (int)(sizeof(meg4.tracks[0]) / 16); i++)
-        if(!meg4_isbyte(&meg4.tracks[track][i * 16], 0, 16)) n = i + 1;
-    if(row >= n) return;
-    if(volume) {
-        if(dsp == &meg4.dram) {
-            meg4.mmio.dsp_row = htole16(row); meg4.mmio.dsp_num = htole16(n); meg4.mmio.dsp_track = track; meg4.mmio.dsp_ticks = 6;
+    memset(&c, 0, sizeof(c));
+    c.cmd = DSP_MUSIC;
+    if(!dsp_alt) { meg4.mmio.dsp_row = meg4.mmio.dsp_num = meg4.mmio.dsp_track = meg4.mmio.dsp_ticks = 0; }
+    if(track < sizeof(meg4.tracks)/sizeof(meg4.tracks[0])) {
+        n = dsp_rows(track);
+        if(row < n && volume) {
+            /* the status registers are updated by the audio thread too, but the VM must see the new values right away */
+            if(!dsp_alt) {
+                meg4.mmio.dsp_row = htole16(row); meg4.mmio.dsp_num = htole16(n); meg4.mmio.dsp_track = track;
+                meg4.mmio.dsp_ticks = 6;
+            }
+            c.track = track; c.row = row; c.num = n; c.vol = volume;
         }
-        dsp->track = track; dsp->row = row; dsp->num = n; dsp->ticks_per_row = dsp->tick[0] = 6;
-        dsp->ch[0].master = dsp->ch[1].master = dsp->ch[2].master = dsp->ch[3].master = volume;
-        dsp_next_tick(0);
     }
+    dsp_push(&c);
 }
 
 #ifndef NOEDITORS
@@ -437,11 +1185,12 @@ void meg4_api_music(uint8_t track, uint16_t row, uint8_t volume)
  */
 void meg4_playnote(uint8_t *note, uint8_t volume)
 {
-    int i;
+    dsp_cmd_t c;
 
-    if(!dsp || dsp == &meg4.dram) return;
-    for(i = 0; i < 16; i++) dsp->ch[i].master = 0;
-    dsp->ticks_per_row = 0;
-    if(note && volume) { dsp_note(4, note); dsp->ch[4].master = volume; dsp->tick[1] = 6; dsp_next_tick(1); }
+    if(!dsp_alt) return;
+    memset(&c, 0, sizeof(c));
+    c.cmd = DSP_NOTE;
+    if(note && volume) { memcpy(c.note, note, 4); c.vol = volume; }
+    dsp_push(&c);
 }
 #endif
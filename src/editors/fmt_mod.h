@@ -93,7 +93,7 @@ static void note_mod2meg(uint8_t *dst, uint8_t *src, int *tr)
 static uint8_t *export_mod(int track, int *len)
 {
     int i, j, l = 0, n = 0, p;
-    uint8_t *out = NULL, *ptr;
+    uint8_t *out = NULL, *ptr, *ext = NULL, *row;
 
     /* n = number of rows */
     if(track == -1) {
@@ -102,8 +102,13 @@ static uint8_t *export_mod(int track, int *len)
     } else {
         for(i = 0; i < (int)(sizeof(meg4.tracks[0]) / 16); i++)
             if(!meg4_isbyte(&meg4.tracks[track][i * 16], 0, 16)) n = i + 1;
+        /* rows in the track's stream (a MOD can't have more than 128 patterns) */
+        if(meg4.strm[track].rows && (ext = (uint8_t*)malloc(meg4.strm[track].rows * 16))) {
+            n = (int)(sizeof(meg4.tracks[0]) / 16) + dsp_unpackstream(track, ext);
+            if(n > 128 * 64) n = 128 * 64;
+        }
     }
-    if(!len || n < 1) return NULL;
+    if(!len || n < 1) { if(ext) { free(ext); } return NULL; }
     /* add patterns' length */
     p = ((n + 63) >> 6) * 1024;
     l += p;
@@ -111,7 +116,7 @@ static uint8_t *export_mod(int track, int *len)
     for(i = 0; i < (int)(sizeof(meg4.waveforms)/sizeof(meg4.waveforms[0])); i++)
         l += ((meg4.waveforms[i][1]<<8)|meg4.waveforms[i][0]) << 1;
     out = (uint8_t*)malloc(1084 + l);
-    if(!out) return NULL;
+    if(!out) { if(ext) { free(ext); } return NULL; }
     *len = 1084 + l;
     memset(out, 0, 1084 + l);
 
@@ -145,12 +150,14 @@ static uint8_t *export_mod(int track, int *len)
         if(track == -1)
             note_meg2mod(ptr, &meg4.mmio.sounds[i]);
         else {
-            note_meg2mod(ptr + 0, &meg4.tracks[track][i * 16 + 0]);
-            note_meg2mod(ptr + 4, &meg4.tracks[track][i * 16 + 4]);
-            note_meg2mod(ptr + 8, &meg4.tracks[track][i * 16 + 8]);
-            note_meg2mod(ptr +12, &meg4.tracks[track][i * 16 +12]);
+            row = i < (int)(sizeof(meg4.tracks[0]) / 16) ? &meg4.tracks[track][i * 16] : ext + (i * 16 - sizeof(meg4.tracks[0]));
+            note_meg2mod(ptr + 0, row + 0);
+            note_meg2mod(ptr + 4, row + 4);
+            note_meg2mod(ptr + 8, row + 8);
+            note_meg2mod(ptr +12, row +12);
         }
     }
+    if(ext) free(ext);
     /* samples */
     for(ptr = out + 1084 + p, i = 0; i < (int)(sizeof(meg4.waveforms)/sizeof(meg4.waveforms[0])); i++)
         for(j = 0; (uint16_t)j < ((meg4.waveforms[i][1]<<8)|meg4.waveforms[i][0]); j++, ptr += 2)
@@ -166,7 +173,7 @@ static int format_mod(int track, uint8_t *buf, int len)
 {
     char tw[32] = { 0 };
     int i, j, l, k, m, n = 0, tr[32] = { 0 };
-    uint8_t *ptr, tmp[sizeof(meg4.waveforms[0])];
+    uint8_t *ptr, *dst, *ext = NULL, tmp[sizeof(meg4.waveforms[0])];
 
     if(!buf || len < 1084 || track < -1 || track >= (int)(sizeof(meg4.tracks)/sizeof(meg4.tracks[0]))) return 0;
     /* get number of patterns */
@@ -182,6 +189,9 @@ static int format_mod(int track, uint8_t *buf, int len)
     } else {
         m = sizeof(meg4.tracks[0]);
         memset(meg4.tracks[track], 0, sizeof(meg4.tracks[0]));
+        dsp_stream(track, NULL, 0, 0);
+        /* rows that don't fit into the track go to the track's stream (every pattern has at most 64 rows) */
+        if(buf[950] > 16 && (ext = (uint8_t*)malloc((buf[950] - 16) * 1024))) m += (buf[950] - 16) * 1024;
         /* get referenced waves */
         for(k = 0, i = 952; i < 952 + buf[950] && 1084 + buf[i] * 1024 < len && k < m; i++)
             for(ptr = buf + 1084 + buf[i] * 1024, j = 0; j < 64 && k < m; j++, k += 16)
@@ -212,12 +222,17 @@ static int format_mod(int track, uint8_t *buf, int len)
             if(track == -1) {
                 note_mod2meg(&meg4.mmio.sounds[k], ptr, tr); k += 4;
             } else {
-                note_mod2meg(&meg4.tracks[track][k], ptr + 0, tr); k += 4;
-                note_mod2meg(&meg4.tracks[track][k], ptr + 4, tr); k += 4;
-                note_mod2meg(&meg4.tracks[track][k], ptr + 8, tr); k += 4;
-                note_mod2meg(&meg4.tracks[track][k], ptr +12, tr); k += 4;
+                dst = k < (int)sizeof(meg4.tracks[0]) ? &meg4.tracks[track][k] : ext + k - sizeof(meg4.tracks[0]);
+                note_mod2meg(dst + 0, ptr + 0, tr);
+                note_mod2meg(dst + 4, ptr + 4, tr);
+                note_mod2meg(dst + 8, ptr + 8, tr);
+                note_mod2meg(dst +12, ptr +12, tr); k += 16;
                 /* handle pattern break command */
                 if((ptr[2] & 0xf) == 0xD || (ptr[6] & 0xf) == 0xD || (ptr[10] & 0xf) == 0xD || (ptr[14] & 0xf) == 0xD) j = 64;
             }
+    if(ext) {
+        if(k > (int)sizeof(meg4.tracks[0])) dsp_packstream(track, ext, (k - sizeof(meg4.tracks[0])) >> 4);
+        free(ext);
+    }
     return 1;
 }
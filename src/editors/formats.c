@@ -474,6 +474,7 @@ int meg4_import(char *name, uint8_t *buf, int len, int lvl)
             if(s) {
                 memcpy(meg4.mmio.palette, default_pal, sizeof(meg4.mmio.palette));
                 memset(meg4.mmio.sprites, 0, sizeof(meg4.mmio.sprites));
+                gpu_dirty(0x80, sizeof(meg4.mmio.palette));
                 main_log(1, "sprites (truecolor png) detected");
                 for(j = k = 0, e = s; j < 256; j++)
                     for(i = 0; i < 256; i++, k++, e += 4)
@@ -902,6 +903,7 @@ readuints:                  for(i = j = 0; j < h; data++) {
 
     ret = 0;
 end:if(uncomp) free(uncomp);
+    gpu_dirty(0x80, sizeof(meg4.mmio.palette));
     meg4_recalcmipmap();
     return ret;
 }
@@ -91,7 +91,7 @@ int music_ctrl(void)
         /* channel enable / disable */
         if(px >= 16 && px < 80 && py >= 254 && py < 299) {
             j = (px - 16) / 16; enabled ^= (1 << j);
-            meg4.dalt.ch[j].master = (enabled & (1 << j)) && playing ? 255 : 0;
+            dsp_master(j, (enabled & (1 << j)) && playing ? 255 : 0);
         } else
         /* note patterns */
         if(py >= 23 && py < 303) {
@@ -111,7 +111,7 @@ play:           playing ^= 1;
                     meg4_api_music(track, idx >> 2, 0);
                 } else {
                     meg4_api_music(track, idx >> 2, 255);
-                    for(j = 0; j < 4; j++) if(!(enabled & (1 << j))) meg4.dalt.ch[j].master = 0;
+                    for(j = 0; j < 4; j++) if(!(enabled & (1 << j))) dsp_master(j, 0);
                 }
             } else
             if(!memcmp(&key, "PgUp", 4)) { track = (track - 1) & 7; idx = 0; music_chkscroll(0); } else
@@ -237,8 +237,8 @@ void music_view(void)
     meg4_text(meg4.valt, 14, 230, 2560, theme[THEME_D], theme[THEME_L], 1, meg4_font, "increment");
     meg4_text(meg4.valt, 80 - meg4_width(meg4_font, 1, tmp, NULL), 230, 2560, theme[THEME_L], 0, 1, meg4_font, tmp);
 
-    /* update the cursor if playing music */
-    if(playing) {
+    /* update the cursor if playing music (not in the track's stream, that's not editable) */
+    if(playing && meg4.dalt.row < MAXROW) {
         idx = (meg4.dalt.row << 2) | (idx & 3);
         music_chkscroll(14);
     }
@@ -264,8 +264,9 @@ del:            if(wave && ptr) {
             }
         }
     }
-    if(wave && playing && meg4.dalt.ch[4].sample && meg4.dalt.ch[4].increment > 0.0f && meg4.dalt.ch[4].position < 0.0f)
-        meg4.dalt.ch[4].position = 0.0f;
+    /* the audio thread checks if the waveform has been played to the end */
+    if(wave && playing && !dsp_status(4))
+        dsp_rewind(4);
     last = clk;
     return 1;
 }
@@ -321,7 +322,7 @@ void sound_menu(uint32_t *dst, int dw, int dh, int dp)
 void sound_view(void)
 {
     int8_t *ptr = NULL;
-    uint32_t fg;
+    uint32_t fg, st = dsp_status(4);
     int i, j, k, y0, y1, s, e, l;
     int clk = le16toh(meg4.mmio.ptrbtn) & MEG4_BTN_L, px = le16toh(meg4.mmio.ptrx), py = le16toh(meg4.mmio.ptry);
     char tmp[32];
@@ -381,9 +382,8 @@ void sound_view(void)
             /* display wave */
             for(i = 0; i < 512; i++)
                 if(minwave[i] <= maxwave[i]) {
-                    j = (l <= 512 && widx == i * l / 512) || (meg4.dalt.ch[4].master &&
-                        meg4.dalt.ch[4].sample == meg4.mmio.sounds[(idx << 2) + 1] &&
-                        (l <= 512 ? i * l / 512 : i * 512 / l) == (int)meg4.dalt.ch[4].position);
+                    j = (l <= 512 && widx == i * l / 512) || (st && ((st >> 16) & 0xff) == meg4.mmio.sounds[(idx << 2) + 1] &&
+                        (l <= 512 ? i * l / 512 : i * 512 / l) == (int)le16toh(st & 0xffff));
                     fg = j ? theme[THEME_SEL_BG] : theme[THEME_L]; k = i * l / 512 == (i + 1) * l / 512;
                     if(l > 256 || k) {
                         if(maxwave[i] < 0)
@@ -146,6 +146,7 @@ int sprite_ctrl(void)
                     meg4.mmio.palette[palidx] = hsv2rgb(C[3], hue, sat, val);
                 break;
             }
+            gpu_dirty(0x80 + palidx * 4, 4);
         }
     } else {
         if(px >= 11 && px < 11+256 && py >= 23 && py < 23+256) {
@@ -23,7 +23,7 @@
 
 /* serialization chunks */
 enum { MEG4_CHUNK_META, MEG4_CHUNK_DATA, MEG4_CHUNK_CODE, MEG4_CHUNK_PAL, MEG4_CHUNK_SPRITES, MEG4_CHUNK_MAP, MEG4_CHUNK_FONT,
-    MEG4_CHUNK_WAVE, MEG4_CHUNK_SFX, MEG4_CHUNK_TRACK, MEG4_CHUNK_OVL };
+    MEG4_CHUNK_WAVE, MEG4_CHUNK_SFX, MEG4_CHUNK_TRACK, MEG4_CHUNK_OVL, MEG4_CHUNK_STRM };
 
 /**
  * Check if a buffer contains only a specific byte
@@ -186,6 +186,14 @@ static int meg4_deserialize(uint8_t *buf, int len)
                 }
             break;
 
+            case MEG4_CHUNK_STRM:
+                /* kept compressed, the sequencer decompresses it while playing */
+                if(s > 3) {
+                    ret |= 32;
+                    dsp_stream(buf[0], buf + 3, s - 3, buf[1] | (buf[2] << 8));
+                }
+            break;
+
             case MEG4_CHUNK_OVL:
                 if(s > 1) {
                     ret |= 64;
@@ -202,6 +210,7 @@ static int meg4_deserialize(uint8_t *buf, int len)
     /* if there was no palette in the data */
     if(meg4_isbyte(meg4.mmio.palette, 0, sizeof(meg4.mmio.palette)))
         memcpy(meg4.mmio.palette, default_pal, sizeof(meg4.mmio.palette));
+    gpu_dirty(0x80, sizeof(meg4.mmio.palette));
     meg4_recalcmipmap();
     return ret;
 }
@@ -272,6 +281,7 @@ uint8_t *meg4_serialize(int *len, int type)
             if(!meg4_isbyte(meg4.tracks[j] + i * 16, 0, 16))
                 trksiz[j] = (i + 1) * 16;
         if(trksiz[j]) siz += 5 + trksiz[j];
+        if(meg4.strm[j].rows) siz += 7 + meg4.strm[j].size;
     }
     for(i = 0; i < 256; i++)
         if(meg4.ovls[i].data && meg4.ovls[i].size > 0) siz += 5 + meg4.ovls[i].size;
@@ -375,6 +385,15 @@ uint8_t *meg4_serialize(int *len, int type)
             memcpy(ptr, meg4.tracks[i], trksiz[i]); ptr += trksiz[i];
         }
 
+    /* track streams */
+    for(i = 0; i < (int)(sizeof(meg4.strm)/sizeof(meg4.strm[0])); i++)
+        if(meg4.strm[i].rows) {
+            hdr = htole32(((7 + meg4.strm[i].size) << 8) | MEG4_CHUNK_STRM);
+            memcpy(ptr, &hdr, 4); ptr += 4; *ptr++ = i;
+            *ptr++ = meg4.strm[i].rows & 0xff; *ptr++ = (meg4.strm[i].rows >> 8) & 0xff;
+            memcpy(ptr, meg4.strmpool + meg4.strm[i].offs, meg4.strm[i].size); ptr += meg4.strm[i].size;
+        }
+
     /* overlays */
     for(i = 0; i < 256; i++)
         if(meg4.ovls[i].data && meg4.ovls[i].size > 0) {
@@ -42,18 +42,53 @@ float cosf(float);
 float sinf(float);
 float tanf(float);
 float fabsf(float);
+float sqrtf(float);
 extern char meg4_kbdtmpbuf[8], meg4_kbdtmpsht, *textinp_cur;
 extern uint32_t meg4_lasttick;
 extern uint16_t oldsx, oldsy;
 void menu_view(uint32_t *dst, int dw, int dh, int dp);
 void textinp_view(uint32_t *dst, int dp);
 typedef struct { uint16_t d, o, id; float x, y; } maze_spr_t;
-static int mazecmp(const void *a, const void *b) { return ((maze_spr_t*)b)->d - ((maze_spr_t*)a)->d; }
+typedef struct { int next; int16_t x0, x1; uint8_t a; } span_t;
+#ifndef NOEDITORS
+static void cap_free(void);
+#endif
+static void gpu_cls(uint32_t bg);
+static void gpu_text(uint8_t palidx, int16_t x, int16_t y, int8_t type, uint8_t shidx, uint8_t sha, char *str);
+static void gpu_stext(int16_t x, int16_t y, uint16_t fs, uint16_t fu, uint8_t sw, uint8_t sh, int8_t scale, char *t);
+static span_t *spans = NULL;
+static int nspan = 0, aspan = 0, spanrow[400], spany0 = 400, spany1 = -1;
 static float posX = 0.0, posY = 0.0;
 static float prj[16], cam[16], cami[16], camp[3] = { 0.0, 0.25, 1.0 };
 static float vpt[3], vps[3];
 static uint16_t zbuf[640*400];
 static int zclear = 0;
+/* hierarchical z-buffer, the farthest depth (smallest value) of each 8x8 block in zbuf. It's allowed to lag behind (be
+ * smaller than the actual minimum), blocks written since the last refresh are marked dirty */
+#define ZT_W 80
+#define ZT_H 50
+static uint16_t ztile[ZT_W * ZT_H];
+static uint8_t zdirty[ZT_W * ZT_H];
+/* mipmaps are recalculated on demand if the palette (2, all texels) or the sprites (1, only the texels of the 8 x 8
+ * sprite cells marked in mipcells, one bit each) were modified since */
+static int mipdirty = 2;
+static uint32_t mipcells[32];
+static const int mipoff[4] = { 0, 0, 128*128*4, 128*128*4 + 64*64*4 };
+/* glyph cache, the most recently drawn characters pre-expanded to the given scale, each row as a list of shadow spans,
+ * quirky scale 4 shadow corner pixels and foreground spans. Plus the widths of recently measured short strings. Both are
+ * dropped by meg4_recalcfont() */
+#define GLYPHCACHE 512
+#define WIDTHCACHE 64
+typedef struct { uint8_t *font; uint32_t key; int l, r, h; uint16_t *row; uint8_t *span; } glyph_t;
+typedef struct { uint8_t *font; int type, len, w; char str[48]; } txtw_t;
+static glyph_t glyphs[GLYPHCACHE];
+static txtw_t txtws[WIDTHCACHE];
+/* inverse palette, a 32 x 32 x 32 cube of colors, each cell with the list of palette entries that could be the nearest
+ * to any color inside that cell (offset << 9 | count into palpool, 0 if not calculated yet). Rebuilt lazily if the
+ * palette was modified since */
+static uint32_t palcell[32 * 32 * 32];
+static uint8_t *palpool = NULL;
+static int paldirty = 1, palpoollen = 0, palpoolmax = 0;
 
 #define clip_funcdef(name, sign, dir, dir1, dir2) \
     static float name(float* c, float* a, float* b) { \
@@ -83,20 +118,86 @@ typedef struct {
     int x, y, z, u, v, r, g, b, a, clip;
 } vert_t;
 
-static vert_t verts[256] = { 0 };
-static int nvert = 0;
-
 typedef struct {
-    int i[3], u[3], v[3], p[3];
+    int i[3], u[3], v[3], p[3], tex;
 } face_t;
 
-static face_t faces[1024] = { 0 };
-static int nface = 0;
+/* growable work buffers, 3D submissions are accumulated here and processed in one pass by gpu_flush() */
+static vert_t *verts = NULL;
+static face_t *faces = NULL;
+static int nvert = 0, avert = 0, nface = 0, aface = 0, gpu_memlimit = 4096 * 1024, gpu_memwarn = 0;
+
+/* static mesh cache, so that face normals and bounds are only calculated once for meshes that don't change */
+#define MESHCACHE   8
+typedef struct {
+    addr_t verts, uvs, tris;
+    uint16_t numtri;
+    uint32_t hash;
+    int nvert, nface;
+    float sph[4];
+    float *nor;
+    face_t *faces;
+} meshcache_t;
+static meshcache_t meshcache[MESHCACHE] = { 0 };
+static int meshlast = 0;
+static uint16_t perf_culltri = 0, perf_cullmesh = 0;
 
 /**
- * Draw a 3D triangle with gradient
+ * Recalculate the farthest depth in an 8x8 block
  */
-static void draw_triangle_grd(vert_t* v0, vert_t* v1, vert_t* v2)
+static void ztile_refresh(int i)
+{
+    uint16_t *pz, m = 0xffff;
+    int x, y;
+
+    zdirty[i] = 0;
+    pz = zbuf + (i / ZT_W) * 8 * 640 + (i % ZT_W) * 8;
+    for(y = 0; y < 8; y++, pz += 640)
+        for(x = 0; x < 8; x++)
+            if(pz[x] < m) m = pz[x];
+    ztile[i] = m;
+}
+
+/**
+ * Refresh the blocks under a triangle's bounding box and return their farthest depth (only rows B0 <= y < B1)
+ */
+static uint16_t ztile_bbox(vert_t *v0, vert_t *v1, vert_t *v2, int B0, int B1, int X0, int X1, int Y0)
+{
+    uint16_t m = 0xffff;
+    int x0, x1, y0, y1, x, y, i;
+
+    x0 = x1 = v0->x; y0 = y1 = v0->y;
+    if(v1->x < x0) { x0 = v1->x; } if(v1->x > x1) { x1 = v1->x; } if(v1->y < y0) { y0 = v1->y; } if(v1->y > y1) { y1 = v1->y; }
+    if(v2->x < x0) { x0 = v2->x; } if(v2->x > x1) { x1 = v2->x; } if(v2->y < y0) { y0 = v2->y; } if(v2->y > y1) { y1 = v2->y; }
+    x0 -= 2; x1 += 2; y1++;
+    if(x0 < X0) { x0 = X0; } if(x0 < 0) { x0 = 0; } if(x1 > X1) { x1 = X1; } if(x1 > 639) { x1 = 639; }
+    if(y0 < Y0) { y0 = Y0; } if(y0 < B0) { y0 = B0; } if(y0 < 0) { y0 = 0; }
+    if(y1 >= B1) { y1 = B1 - 1; } if(y1 > 399) { y1 = 399; }
+    if(x0 > x1 || y0 > y1) return 0;
+    for(y = y0 >> 3; y <= y1 >> 3; y++)
+        for(x = x0 >> 3, i = y * ZT_W + x; x <= x1 >> 3; x++, i++) {
+            if(zdirty[i]) ztile_refresh(i);
+            if(ztile[i] < m) m = ztile[i];
+        }
+    return m;
+}
+
+/**
+ * Get the nearest depth in a span of n + 1 pixels. Returns 0xffffffff if the depth wraps around, because then the
+ * pixels' depth can't be told from the endpoints
+ */
+static uint32_t zspan_max(uint32_t z, int dzdx, int n)
+{
+    double ze = (double)z + (double)dzdx * (double)n;
+
+    if(n < 0 || ze < 0.0 || ze >= 4294967296.0) return 0xffffffff;
+    return (dzdx < 0 ? z : (uint32_t)ze) >> 14;
+}
+
+/**
+ * Draw a 3D triangle with gradient (only rows B0 <= y < B1 are written)
+ */
+static void draw_triangle_grd(vert_t* v0, vert_t* v1, vert_t* v2, int B0, int B1)
 {
     vert_t *p0 = v0, *p1 = v1, *p2 = v2;
     vert_t *pr1, *pr2, *l1, *l2;
@@ -109,8 +210,17 @@ static void draw_triangle_grd(vert_t* v0, vert_t* v1, vert_t* v2)
     int g1, dgdx, dgdy, dgdl_min, dgdl_max;
     int b1, dbdx, dbdy, dbdl_min, dbdl_max;
     int a1, dadx, dady, dadl_min, dadl_max;
+    uint32_t zmax;
+    uint16_t zfar;
     int X0 = le16toh(meg4.mmio.cropx0), X1 = le16toh(meg4.mmio.cropx1), Y0 = le16toh(meg4.mmio.cropy0), Y1 = le16toh(meg4.mmio.cropy1);
 
+    /* hierarchical early-z, skip the whole triangle if it's behind everything under it. The interpolated depth might be
+     * off by a few units from the vertices', so leave a safety margin */
+    zfar = ztile_bbox(v0, v1, v2, B0, B1, X0, X1, Y0);
+    if(v0->z >= 65536 && v1->z >= 65536 && v2->z >= 65536) {
+        zmax = v0->z; if((uint32_t)v1->z > zmax) { zmax = v1->z; } if((uint32_t)v2->z > zmax) { zmax = v2->z; }
+        if(((zmax + 65536) >> 14) < zfar) return;
+    }
     if(p1->y < p0->y) { p0 = v1; p1 = v0; }
     if(p2->y < p0->y) { p2 = p1; p1 = p0; p0 = v2; } else
     if(p2->y < p1->y) { v1 = p1; p2 = p1; p2 = v1; }
@@ -191,26 +301,47 @@ static void draw_triangle_grd(vert_t* v0, vert_t* v1, vert_t* v2)
 
         while(nb_lines > 0) {
             nb_lines--;
-            if(y >= Y0) {
+            if(y >= B1) return;
+            if(y >= Y0 && y >= B0) {
                 register uint8_t* pp;
-                register int n;
+                register int n, m;
                 register uint16_t* pz;
                 register uint32_t z;
                 register int or1, og1, ob1, oa1, da1;
+                uint16_t *zt = y >= 0 && y < 400 ? ztile + (y >> 3) * ZT_W : NULL;
+                uint8_t *zd = zt ? zdirty + (zt - ztile) : NULL;
+                uint32_t zr;
                 n = (x2 >> 16); if(n > X1) { n = X1; } n -= x1; pp = (uint8_t*)(pp1 + x1); pz = pz1 + x1; z = z1;
+                zr = zspan_max(z, dzdx, n);
                 or1 = r1; og1 = g1; ob1 = b1; oa1 = a1; x = x1;
                 while(n >= 0) {
-                    {
-                        register uint32_t zz = z >> 14;
-                        if(x >= X0 && zz >= pz[0]) {
-                            da1 = 255 - oa1;
-                            pp[2] = (ob1*oa1 + da1*pp[2]) >> 8;
-                            pp[1] = (og1*oa1 + da1*pp[1]) >> 8;
-                            pp[0] = (or1*oa1 + da1*pp[0]) >> 8;
-                            pz[0] = zz;
+                    /* early-z, skip the span's part in 8x8 blocks where it's behind everything */
+                    m = 8 - (x & 7); if(m > n + 1) m = n + 1;
+                    if(zt && x >= 0 && x < 640) {
+                        if(zr < zt[x >> 3]) {
+                            /* skip all the consecutive hidden blocks at once */
+                            for(m = 8 - (x & 7); m <= n && x + m < 640 && zr < zt[(x + m) >> 3]; m += 8);
+                            if(m > n + 1) m = n + 1;
+                            z += (uint32_t)dzdx * m; og1 += dgdx * m; or1 += drdx * m; ob1 += dbdx * m; oa1 += dadx * m;
+                            pz += m; pp += 4 * m; n -= m; x += m;
+                            continue;
+                        }
+                        /* zbuf is 16 bit, so when the depth overflows, the stored value could be smaller */
+                        zd[x >> 3] = 1; if(zr > 0xffff) zt[x >> 3] = 0;
+                    }
+                    for(; m > 0; m--) {
+                        {
+                            register uint32_t zz = z >> 14;
+                            if(x >= X0 && zz >= pz[0]) {
+                                da1 = 255 - oa1;
+                                pp[2] = (ob1*oa1 + da1*pp[2]) >> 8;
+                                pp[1] = (og1*oa1 + da1*pp[1]) >> 8;
+                                pp[0] = (or1*oa1 + da1*pp[0]) >> 8;
+                                pz[0] = zz;
+                            }
                         }
+                        z += dzdx; og1 += dgdx; or1 += drdx; ob1 += dbdx; oa1 += dadx; pz++; pp += 4; n--; x++;
                     }
-                    z += dzdx; og1 += dgdx; or1 += drdx; ob1 += dbdx; oa1 += dadx; pz++; pp += 4; n--; x++;
                 }
             }
             error += derror;
@@ -226,9 +357,9 @@ static void draw_triangle_grd(vert_t* v0, vert_t* v1, vert_t* v2)
 }
 
 /**
- * Draw a 3D triangle with texture
+ * Draw a 3D triangle with texture (only rows B0 <= y < B1 are written)
  */
-static void draw_triangle_tex(vert_t* v0, vert_t* v1, vert_t* v2)
+static void draw_triangle_tex(vert_t* v0, vert_t* v1, vert_t* v2, int B0, int B1)
 {
     vert_t *p0 = v0, *p1 = v1, *p2 = v2;
     vert_t *pr1, *pr2, *l1, *l2;
@@ -243,7 +374,12 @@ static void draw_triangle_tex(vert_t* v0, vert_t* v1, vert_t* v2)
     int X0 = le16toh(meg4.mmio.cropx0), X1 = le16toh(meg4.mmio.cropx1), Y0 = le16toh(meg4.mmio.cropy0), Y1 = le16toh(meg4.mmio.cropy1);
     float sz1, dszdx, dszdy, dszdl_min, dszdl_max;
     float tz1, dtzdx, dtzdy, dtzdl_min, dtzdl_max;
-    float fdzdx;
+    float fdzdx, fdzdy;
+    int mip = !(meg4.mmio.texflags & 1);
+
+    /* refresh the hierarchical z-buffer for the early-z span tests. The derivatives here aren't normalized by the area,
+     * so the vertex depths can't be used to reject the whole triangle */
+    ztile_bbox(v0, v1, v2, B0, B1, X0, X1, Y0);
 
     if(p1->y < p0->y) { p0 = v1; p1 = v0; }
     if(p2->y < p0->y) { p2 = p1; p1 = p0; p0 = v2; } else
@@ -295,7 +431,7 @@ static void draw_triangle_tex(vert_t* v0, vert_t* v1, vert_t* v2)
     part = 640 * y;
     pp1 = meg4.screen.buf + part;
     pz1 = zbuf + part;
-    fdzdx = (float)dzdx;
+    fdzdx = (float)dzdx; fdzdy = (float)dzdy;
 
     for (part = 0; part < 2; part++) {
         int nb_lines;
@@ -335,41 +471,71 @@ static void draw_triangle_tex(vert_t* v0, vert_t* v1, vert_t* v2)
 
         while(nb_lines > 0) {
             nb_lines--;
-            if(y >= Y0) {
+            if(y >= B1) return;
+            if(y >= Y0 && y >= B0) {
                 register uint16_t* pz;
                 register uint8_t* pp, *c;
                 register uint32_t s, t, z;
-                register int n;
+                register int n, m, lod = 0;
                 register int or1, og1, ob1, da1;
+                register uint8_t *mm = NULL;
                 float sz, tz, fzl, zinv;
+                uint16_t *zt = y >= 0 && y < 400 ? ztile + (y >> 3) * ZT_W : NULL;
+                uint8_t *zd = zt ? zdirty + (zt - ztile) : NULL;
+                uint32_t zr;
                 or1 = r1; og1 = g1; ob1 = b1;
                 n = (x2 >> 16); if(n > X1) { n = X1; } n -= x1;
                 fzl = (float)z1; zinv = 1.0 / fzl;
                 pp = (uint8_t*)(pp1 + x1);
                 pz = pz1 + x1; z = z1; sz = sz1; tz = tz1; x = x1;
+                zr = zspan_max(z, dzdx, n);
                 {
                     register int dsdx, dtdx;
                     {
-                        float ss, tt;
+                        float ss, tt, dx, dy, ex, ey;
                         ss = (sz * zinv); tt = (tz * zinv);
                         s = (int)ss; t = (int)tt;
-                        dsdx = (int)((dszdx - ss * fdzdx) * zinv);
-                        dtdx = (int)((dtzdx - tt * fdzdx) * zinv);
+                        dx = (dszdx - ss * fdzdx) * zinv; dsdx = (int)dx;
+                        dy = (dtzdx - tt * fdzdx) * zinv; dtdx = (int)dy;
+                        if(mip) {
+                            /* level of detail from the texel footprint of a pixel, the larger of the two directions */
+                            ex = (dszdy - ss * fdzdy) * zinv; ey = (dtzdy - tt * fdzdy) * zinv;
+                            dx = dx * dx + dy * dy; ex = ex * ex + ey * ey; if(ex > dx) dx = ex;
+                            lod = dx < 4.0f ? 0 : (dx < 16.0f ? 1 : (dx < 64.0f ? 2 : 3));
+                            mm = meg4.mipmap + mipoff[lod];
+                        }
                     }
                     while(n >= 0) {
-                        {
-                            register uint32_t zz = z >> 14;
-                            if(x >= X0 && zz >= pz[0]) {
-                                c = (uint8_t*)&meg4.mmio.palette[(int)meg4.mmio.sprites[(t << 8) | s]];
-                                da1 = 255 - c[3];
-                                pp[2] = (((c[2] * ob1) >> 8)*c[3] + da1*pp[2]) >> 8;
-                                pp[1] = (((c[1] * og1) >> 8)*c[3] + da1*pp[1]) >> 8;
-                                pp[0] = (((c[0] * or1) >> 8)*c[3] + da1*pp[0]) >> 8;
-                                pz[0] = zz;
+                        /* early-z, skip the span's part in 8x8 blocks where it's behind everything */
+                        m = 8 - (x & 7); if(m > n + 1) m = n + 1;
+                        if(zt && x >= 0 && x < 640) {
+                            if(zr < zt[x >> 3]) {
+                                /* skip all the consecutive hidden blocks at once */
+                                for(m = 8 - (x & 7); m <= n && x + m < 640 && zr < zt[(x + m) >> 3]; m += 8);
+                                if(m > n + 1) m = n + 1;
+                                z += (uint32_t)dzdx * m; s += (uint32_t)dsdx * m; t += (uint32_t)dtdx * m;
+                                og1 += dgdx * m; or1 += drdx * m; ob1 += dbdx * m;
+                                pz += m; pp += 4 * m; n -= m; x += m;
+                                continue;
+                            }
+                            zd[x >> 3] = 1; if(zr > 0xffff) zt[x >> 3] = 0;
+                        }
+                        for(; m > 0; m--) {
+                            {
+                                register uint32_t zz = z >> 14;
+                                if(x >= X0 && zz >= pz[0]) {
+                                    c = lod ? mm + (((((t & 0xff) >> lod) << (8 - lod)) | ((s & 0xff) >> lod)) << 2) :
+                                        (uint8_t*)&meg4.mmio.palette[(int)meg4.mmio.sprites[((t & 0xff) << 8) | (s & 0xff)]];
+                                    da1 = 255 - c[3];
+                                    pp[2] = (((c[2] * ob1) >> 8)*c[3] + da1*pp[2]) >> 8;
+                                    pp[1] = (((c[1] * og1) >> 8)*c[3] + da1*pp[1]) >> 8;
+                                    pp[0] = (((c[0] * or1) >> 8)*c[3] + da1*pp[0]) >> 8;
+                                    pz[0] = zz;
+                                }
                             }
+                            z += dzdx; s += dsdx; t += dtdx; og1 += dgdx; or1 += drdx; ob1 += dbdx; x++;
+                            pz += 1; pp += 4; n -= 1;
                         }
-                        z += dzdx; s += dsdx; t += dtdx; og1 += dgdx; or1 += drdx; ob1 += dbdx; x++;
-                        pz += 1; pp += 4; n -= 1;
                     }
                 }
             }
@@ -387,6 +553,542 @@ static void draw_triangle_tex(vert_t* v0, vert_t* v1, vert_t* v2)
     }
 }
 
+/**
+ * GPU workers. The clipped screen space triangles are binned into horizontal tiles, and each tile is rasterized by
+ * exactly one worker, in submission order. Since a tile's pixels and z-buffer are only touched by one thread, and the
+ * edge walking is the same as with the serial path, the result is bit-identical. The same pool runs the maze's rows
+ * and columns too.
+ */
+#define TILE_H      16
+#define NUMTILES    ((400 + TILE_H - 1) / TILE_H)
+#define MAXWORKERS  16
+typedef struct { vert_t v[3]; int tex; } bintri_t;
+static bintri_t *bintri = NULL;
+static int *bins[NUMTILES] = { 0 }, nbins[NUMTILES] = { 0 }, nbintri = 0, abintri = 0, gpu_nwrk = 1;
+#ifdef MEG4_THREADS
+#include <pthread.h>
+static pthread_t wrk_thr[MAXWORKERS];
+static pthread_mutex_t wrk_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wrk_cnd = PTHREAD_COND_INITIALIZER, wrk_fin = PTHREAD_COND_INITIALIZER;
+static int wrk_num = 0, wrk_gen = 0, wrk_done = 0, wrk_quit = 0, wrk_next = 0, wrk_njob = 0;
+static void (*wrk_job)(int) = NULL;
+#endif
+
+/**
+ * Add a clipped triangle to the tile bins
+ */
+static void bin_triangle(vert_t* v0, vert_t* v1, vert_t* v2, int tex)
+{
+    bintri_t *b;
+    int i, t0, t1, ymin, ymax, *l;
+
+    if(nbintri >= abintri) {
+        b = (bintri_t*)realloc(bintri, (abintri + 1024) * sizeof(bintri_t));
+        if(!b) return;
+        bintri = b;
+        for(i = 0; i < NUMTILES; i++) {
+            l = (int*)realloc(bins[i], (abintri + 1024) * sizeof(int));
+            if(!l) return;
+            bins[i] = l;
+        }
+        abintri += 1024;
+    }
+    b = &bintri[nbintri];
+    memcpy(&b->v[0], v0, sizeof(vert_t)); memcpy(&b->v[1], v1, sizeof(vert_t)); memcpy(&b->v[2], v2, sizeof(vert_t));
+    b->tex = tex;
+    ymin = ymax = v0->y;
+    if(v1->y < ymin) { ymin = v1->y; } if(v1->y > ymax) { ymax = v1->y; }
+    if(v2->y < ymin) { ymin = v2->y; } if(v2->y > ymax) { ymax = v2->y; }
+    /* first and last tiles are unbounded, just like the serial path */
+    t0 = ymin < 0 ? 0 : ymin / TILE_H; if(t0 >= NUMTILES) t0 = NUMTILES - 1;
+    t1 = ymax < 0 ? 0 : ymax / TILE_H; if(t1 >= NUMTILES) t1 = NUMTILES - 1;
+    for(; t0 <= t1; t0++) bins[t0][nbins[t0]++] = nbintri;
+    nbintri++;
+}
+
+/**
+ * Rasterize all triangles in one tile
+ */
+static void draw_tile(int t)
+{
+    vert_t v[3];
+    bintri_t *b;
+    int i, B0 = t ? t * TILE_H : -32768, B1 = t < NUMTILES - 1 ? (t + 1) * TILE_H : 32767;
+
+    for(i = 0; i < nbins[t]; i++) {
+        /* draw_triangle_tex() writes into the vertices, so work on a local copy */
+        b = &bintri[bins[t][i]]; memcpy(v, b->v, sizeof(v));
+        if(b->tex) draw_triangle_tex(&v[0], &v[1], &v[2], B0, B1);
+        else draw_triangle_grd(&v[0], &v[1], &v[2], B0, B1);
+    }
+}
+
+#ifdef MEG4_THREADS
+/**
+ * Fetch jobs until there are any left
+ */
+static void run_jobs(void)
+{
+    int t;
+    while(1) {
+        pthread_mutex_lock(&wrk_mtx); t = wrk_next++; pthread_mutex_unlock(&wrk_mtx);
+        if(t >= wrk_njob) break;
+        wrk_job(t);
+    }
+}
+
+/**
+ * Worker thread
+ */
+static void *gpu_worker(void *arg)
+{
+    int gen = 0;
+    (void)arg;
+    pthread_mutex_lock(&wrk_mtx);
+    while(1) {
+        while(gen == wrk_gen) pthread_cond_wait(&wrk_cnd, &wrk_mtx);
+        gen = wrk_gen;
+        if(wrk_quit) break;
+        pthread_mutex_unlock(&wrk_mtx);
+        run_jobs();
+        pthread_mutex_lock(&wrk_mtx);
+        if(++wrk_done == wrk_num) pthread_cond_signal(&wrk_fin);
+    }
+    pthread_mutex_unlock(&wrk_mtx);
+    return NULL;
+}
+#endif
+
+/**
+ * Run num independent jobs, on the workers if there are any and it's worth it, and wait for all of them to finish
+ */
+static void gpu_parallel(void (*job)(int), int num, int worth)
+{
+    int i;
+#ifdef MEG4_THREADS
+    if(!wrk_num && gpu_nwrk > 1) {
+        wrk_quit = 0;
+        for(wrk_num = 0; wrk_num < gpu_nwrk - 1 && !pthread_create(&wrk_thr[wrk_num], NULL, gpu_worker, NULL); wrk_num++);
+    }
+    if(wrk_num && worth) {
+        pthread_mutex_lock(&wrk_mtx);
+        wrk_job = job; wrk_njob = num; wrk_next = wrk_done = 0; wrk_gen++; pthread_cond_broadcast(&wrk_cnd);
+        pthread_mutex_unlock(&wrk_mtx);
+        /* the caller thread is a worker too */
+        run_jobs();
+        pthread_mutex_lock(&wrk_mtx); while(wrk_done < wrk_num) { pthread_cond_wait(&wrk_fin, &wrk_mtx); } pthread_mutex_unlock(&wrk_mtx);
+        return;
+    }
+#else
+    (void)worth;
+#endif
+    for(i = 0; i < num; i++) job(i);
+}
+
+/**
+ * Rasterize the binned triangles
+ */
+static void bin_flush(void)
+{
+    if(!nbintri) return;
+    /* waking up the workers isn't worth it for a couple of triangles */
+    gpu_parallel(draw_tile, NUMTILES, nbintri >= 16);
+    memset(nbins, 0, sizeof(nbins));
+    nbintri = 0;
+}
+
+/**
+ * Set the number of triangle rasterizer workers (1 means serial, no threads)
+ */
+void meg4_gpuworkers(int num)
+{
+    gpu_free();
+#ifdef MEG4_THREADS
+    gpu_nwrk = num < 1 ? 1 : (num > MAXWORKERS ? MAXWORKERS : num);
+#else
+    (void)num;
+#endif
+}
+
+/**
+ * Sprite layer. The object attribute table is in user memory, so it is latched at the end of each frame, into one of
+ * three slots: the VM fills one, the render thread might be still drawing the frame of another, and meg4_redraw()
+ * composites the one that belongs to the displayed frame
+ */
+#define OAMSIZE     (8 + MEG4_OAM_MAX * 8)
+static uint8_t oamsnap[3][OAMSIZE];
+static int oamlen[3] = { 0 }, oamseq = 0, oamcur = 0;
+
+/**
+ * Latch the object attribute table, only the visible objects are kept. Returns the slot
+ */
+static int oam_latch(void)
+{
+    uint32_t a = le16toh(meg4.mmio.oamptr) << 4;
+    uint8_t *t, *o, *s = oamsnap[oamseq];
+    int i, n = meg4.mmio.oamnum, ret = oamseq;
+
+    if(n > MEG4_OAM_MAX) n = MEG4_OAM_MAX;
+    oamlen[ret] = 0; memset(s, 0, 8);
+    if(a >= MEG4_MEM_USER && a + 8 + n * 8 <= MEG4_MEM_LIMIT) {
+        t = meg4.data + a - MEG4_MEM_USER;
+        memcpy(s, t, 8);
+        for(i = 0, o = s + 8, t += 8; i < n; i++, t += 8)
+            if(!(t[6] & 0x80)) { memcpy(o, t, 8); o += 8; oamlen[ret]++; }
+    }
+    meg4.mmio.oamcnt = oamlen[ret];
+    oamseq = (oamseq + 1) % 3;
+    return ret;
+}
+
+/**
+ * Render thread. In async mode the draw functions called by the VM are recorded into a command ring instead of being
+ * executed, and a dedicated thread replays them while the VM goes on with its loop(). Everything the commands depend on
+ * (palette, sprites, crop area etc.) is only writable through MMIO and MMIO writes wait for the ring to drain, so there's
+ * no need to snapshot any state, the render thread always sees what the VM saw when it called the draw function
+ */
+enum { RND_WRAP, RND_FRAME, RND_CLS, RND_PSET, RND_TEXT, RND_LINE, RND_QBEZ, RND_CBEZ, RND_TRI, RND_FTRI, RND_TRI2D,
+    RND_TRI3D, RND_TRITX, RND_RECT, RND_FRECT, RND_CIRC, RND_FCIRC, RND_ELLIP, RND_FELLIP, RND_SPR, RND_DLG, RND_STEXT,
+    RND_MAP, RND_BLIT, RND_BLITSCR };
+#ifdef MEG4_THREADS
+#define RNDBUF      65536       /* command ring size in words */
+#define RNDSTR      16384       /* maximum length of a recorded string */
+/* number of integer arguments for each command, strings are stored after these */
+static const uint8_t rndargs[] = { 0, 4, 1, 3, 6, 5, 7, 9, 7, 7, 9, 12, 15, 5, 5, 4, 4, 5, 5, 7, 14, 7, 7, 6, 8 };
+static pthread_t rnd_thr;
+static pthread_mutex_t rnd_mtx = PTHREAD_MUTEX_INITIALIZER, rnd_lck = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rnd_cnd = PTHREAD_COND_INITIALIZER, rnd_fin = PTHREAD_COND_INITIALIZER;
+static int32_t *rndbuf = NULL;
+static uint32_t *vfront = NULL;
+static int rnd_lat = -1, rnd_run = 0, rnd_quit = 0, rndhead = 0, rndtail = 0, rndused = 0, rndframes = 0, rnd_fdone = 0;
+static int rnd_fvalid = 0, rnd_foff = 0, rnd_fw = 0, rnd_fh = 0;
+
+/**
+ * Returns true if called on the render thread
+ */
+static int rnd_self(void)
+{
+    return rnd_run && pthread_equal(pthread_self(), rnd_thr);
+}
+
+/**
+ * Replay one recorded command
+ */
+static void rnd_exec(int32_t *c)
+{
+    int32_t *a = c + 1;
+    char *s = (char*)(a + rndargs[c[0] & 0xff]);
+    int y;
+
+    switch(c[0] & 0xff) {
+        case RND_FRAME:
+            /* keep the finished frame, this is what meg4_redraw() displays while the next one is being drawn */
+            gpu_flush();
+            for(y = 0; y < a[2]; y++) memcpy(vfront + a[0] + y * 640, meg4.vram + a[0] + y * 640, a[1] * sizeof(uint32_t));
+            rnd_foff = a[0]; rnd_fw = a[1]; rnd_fh = a[2]; rnd_fvalid = 1; oamcur = a[3];
+        break;
+        case RND_CLS: gpu_cls((uint32_t)a[0]); break;
+        case RND_PSET: meg4_api_pset(a[0], a[1], a[2]); break;
+        case RND_TEXT: gpu_text(a[0], a[1], a[2], a[3], a[4], a[5], s); break;
+        case RND_LINE: meg4_api_line(a[0], a[1], a[2], a[3], a[4]); break;
+        case RND_QBEZ: meg4_api_qbez(a[0], a[1], a[2], a[3], a[4], a[5], a[6]); break;
+        case RND_CBEZ: meg4_api_cbez(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8]); break;
+        case RND_TRI: meg4_api_tri(a[0], a[1], a[2], a[3], a[4], a[5], a[6]); break;
+        case RND_FTRI: meg4_api_ftri(a[0], a[1], a[2], a[3], a[4], a[5], a[6]); break;
+        case RND_TRI2D: meg4_api_tri2d(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8]); break;
+        case RND_TRI3D: meg4_api_tri3d(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8], a[9], a[10], a[11]); break;
+        case RND_TRITX:
+            meg4_api_tritx(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8], a[9], a[10], a[11], a[12], a[13], a[14]);
+        break;
+        case RND_RECT: meg4_api_rect(a[0], a[1], a[2], a[3], a[4]); break;
+        case RND_FRECT: meg4_api_frect(a[0], a[1], a[2], a[3], a[4]); break;
+        case RND_CIRC: meg4_api_circ(a[0], a[1], a[2], a[3]); break;
+        case RND_FCIRC: meg4_api_fcirc(a[0], a[1], a[2], a[3]); break;
+        case RND_ELLIP: meg4_api_ellip(a[0], a[1], a[2], a[3], a[4]); break;
+        case RND_FELLIP: meg4_api_fellip(a[0], a[1], a[2], a[3], a[4]); break;
+        case RND_SPR: meg4_api_spr(a[0], a[1], a[2], a[3], a[4], a[5], a[6]); break;
+        case RND_DLG:
+            meg4_api_dlg(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8], a[9], a[10], a[11], a[12], a[13]);
+        break;
+        case RND_STEXT: gpu_stext(a[0], a[1], a[2], a[3], a[4], a[5], a[6], s); break;
+        case RND_MAP: meg4_api_map(a[0], a[1], a[2], a[3], a[4], a[5], a[6]); break;
+        case RND_BLIT: meg4_api_blit(a[0], a[1], a[2], a[3], a[4], a[5]); break;
+        case RND_BLITSCR: meg4_api_blitscr(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]); break;
+    }
+}
+
+/**
+ * Render thread
+ */
+static void *rnd_worker(void *arg)
+{
+    int32_t *c;
+    (void)arg;
+    pthread_mutex_lock(&rnd_mtx);
+    while(1) {
+        while(!rndused && !rnd_quit) pthread_cond_wait(&rnd_cnd, &rnd_mtx);
+        if(!rndused) break;
+        c = rndbuf + rndtail;
+        if((c[0] & 0xff) == RND_WRAP) {
+            rndused -= RNDBUF - rndtail; rndtail = 0;
+        } else {
+            pthread_mutex_unlock(&rnd_mtx);
+            /* the lock makes meg4_redraw() and the caches shared with the VM thread wait for the command to finish */
+            pthread_mutex_lock(&rnd_lck); rnd_exec(c); pthread_mutex_unlock(&rnd_lck);
+            pthread_mutex_lock(&rnd_mtx);
+            if((c[0] & 0xff) == RND_FRAME) { rndframes--; rnd_fdone = 1; }
+            rndtail += c[0] >> 8; rndused -= c[0] >> 8;
+            if(rndtail >= RNDBUF) rndtail = 0;
+        }
+        pthread_cond_broadcast(&rnd_fin);
+    }
+    pthread_mutex_unlock(&rnd_mtx);
+    return NULL;
+}
+
+/**
+ * Start the render thread
+ */
+static int rnd_start(void)
+{
+    if((!rndbuf && !(rndbuf = (int32_t*)malloc(RNDBUF * sizeof(int32_t)))) ||
+      (rnd_lat > 0 && !vfront && !(vfront = (uint32_t*)malloc(sizeof(meg4.vram))))) { rnd_lat = -1; return 0; }
+    rndhead = rndtail = rndused = rndframes = rnd_fdone = rnd_quit = rnd_fvalid = 0;
+    if(pthread_create(&rnd_thr, NULL, rnd_worker, NULL)) { rnd_lat = -1; return 0; }
+    rnd_run = 1;
+    return 1;
+}
+
+/**
+ * Stop the render thread, it replays the remaining commands before it quits
+ */
+static void rnd_free(void)
+{
+    if(rnd_run) {
+        pthread_mutex_lock(&rnd_mtx); rnd_quit = 1; pthread_cond_signal(&rnd_cnd); pthread_mutex_unlock(&rnd_mtx);
+        pthread_join(rnd_thr, NULL);
+        rnd_run = 0;
+    }
+    if(rndbuf) { free(rndbuf); rndbuf = NULL; }
+    if(vfront) { free(vfront); vfront = NULL; }
+    rnd_fvalid = 0;
+}
+
+/**
+ * Record a draw command if async mode is on. Returns 1 if the command was recorded and the caller must not draw
+ */
+static int gpu_defer(int cmd, const char *str, ...)
+{
+    __builtin_va_list args;
+    char *end = (char*)meg4.data + sizeof(meg4.data) - 1;
+    int32_t *c;
+    int i, l = 0, n;
+
+    if(rnd_lat < 0 || meg4.mode != MEG4_MODE_GAME || rnd_self() || (!rnd_run && !rnd_start())) return 0;
+    if(str) for(; l < RNDSTR - 1 && str + l < end && str[l]; l++);
+    n = 1 + rndargs[cmd] + (str ? (l + 4) >> 2 : 0);
+    pthread_mutex_lock(&rnd_mtx);
+    /* records are never split, if there's no room at the end of the ring, skip to its beginning */
+    while(RNDBUF - rndused < n + (RNDBUF - rndhead < n ? RNDBUF - rndhead : 0)) pthread_cond_wait(&rnd_fin, &rnd_mtx);
+    if(RNDBUF - rndhead < n) { rndbuf[rndhead] = RND_WRAP; rndused += RNDBUF - rndhead; rndhead = 0; }
+    c = rndbuf + rndhead;
+    c[0] = cmd | (n << 8);
+    __builtin_va_start(args, str);
+    for(i = 1; i <= rndargs[cmd]; i++) c[i] = __builtin_va_arg(args, int);
+    __builtin_va_end(args);
+    if(str) { c[n - 1] = 0; memcpy(c + i, str, l); }
+    rndhead += n; rndused += n;
+    if(rndhead >= RNDBUF) rndhead = 0;
+    if(cmd == RND_FRAME) rndframes++;
+    pthread_cond_signal(&rnd_cnd);
+    pthread_mutex_unlock(&rnd_mtx);
+    return 1;
+}
+
+/**
+ * Keep the render thread away while the caller touches state shared with it
+ */
+static void gpu_lock(void) { if(rnd_run) pthread_mutex_lock(&rnd_lck); }
+static void gpu_unlock(void) { if(rnd_run) pthread_mutex_unlock(&rnd_lck); }
+#else
+static int gpu_defer(int cmd, const char *str, ...) { (void)cmd; (void)str; return 0; }
+static void gpu_lock(void) { }
+static void gpu_unlock(void) { }
+#endif
+
+/**
+ * Wait until the render thread has replayed all recorded commands. Must be called before the VM reads back or modifies
+ * anything the recorded commands use
+ */
+void gpu_sync(void)
+{
+#ifdef MEG4_THREADS
+    if(!rnd_run || rnd_self()) return;
+    pthread_mutex_lock(&rnd_mtx); while(rndused) { pthread_cond_wait(&rnd_fin, &rnd_mtx); } pthread_mutex_unlock(&rnd_mtx);
+#endif
+}
+
+/**
+ * End of a VM frame. Waits for the frame to be drawn, or with one frame latency, only for the previous one
+ */
+void gpu_frame(void)
+{
+    int oam = oam_latch();
+#ifdef MEG4_THREADS
+    if(rnd_run && rnd_lat > 0 && meg4.mode == MEG4_MODE_GAME &&
+      meg4.screen.buf >= meg4.vram && meg4.screen.buf < meg4.vram + 640 * 400) {
+        gpu_defer(RND_FRAME, NULL, (int)(meg4.screen.buf - meg4.vram), meg4.screen.w, meg4.screen.h, oam);
+        pthread_mutex_lock(&rnd_mtx);
+        while(rndframes > rnd_fdone) pthread_cond_wait(&rnd_fin, &rnd_mtx);
+        pthread_mutex_unlock(&rnd_mtx);
+        return;
+    }
+#endif
+    gpu_flush();
+    gpu_lock(); oamcur = oam; gpu_unlock();
+}
+
+/**
+ * Set the render thread's latency: -1 draws immediately on the VM thread, 0 replays the draw calls on the render thread
+ * and waits for them at the end of the frame, 1 lets the render thread finish the frame while the VM runs the next one
+ */
+void meg4_gpuasync(int latency)
+{
+    gpu_free();
+#ifdef MEG4_THREADS
+    rnd_lat = latency < 0 ? -1 : (latency > 1 ? 1 : latency);
+#else
+    (void)latency;
+#endif
+}
+
+/**
+ * Free the glyph and text width caches
+ */
+static void glyph_free(int s, int e)
+{
+    int i;
+    for(i = 0; i < GLYPHCACHE; i++)
+        if(glyphs[i].row && (int)(glyphs[i].key & 0xffff) >= s && (int)(glyphs[i].key & 0xffff) <= e) {
+            free(glyphs[i].row); memset(&glyphs[i], 0, sizeof(glyph_t));
+        }
+    memset(txtws, 0, sizeof(txtws));
+}
+
+/**
+ * Stop the render thread and the rasterizer workers and free the tile bins (they are restarted on demand)
+ */
+void gpu_free(void)
+{
+    int i;
+#ifdef MEG4_THREADS
+    rnd_free();
+    if(wrk_num) {
+        pthread_mutex_lock(&wrk_mtx); wrk_quit = 1; wrk_gen++; pthread_cond_broadcast(&wrk_cnd); pthread_mutex_unlock(&wrk_mtx);
+        for(i = 0; i < wrk_num; i++) pthread_join(wrk_thr[i], NULL);
+        wrk_num = 0;
+    }
+#endif
+    memset(oamsnap, 0, sizeof(oamsnap)); memset(oamlen, 0, sizeof(oamlen)); oamseq = oamcur = 0;
+    for(i = 0; i < NUMTILES; i++) { if(bins[i]) { free(bins[i]); bins[i] = NULL; } nbins[i] = 0; }
+    if(bintri) { free(bintri); bintri = NULL; }
+    nbintri = abintri = 0;
+    for(i = 0; i < MESHCACHE; i++) {
+        if(meshcache[i].nor) free(meshcache[i].nor);
+        if(meshcache[i].faces) free(meshcache[i].faces);
+    }
+    memset(meshcache, 0, sizeof(meshcache)); meshlast = 0; mipdirty = 2;
+    if(verts) { free(verts); verts = NULL; }
+    if(faces) { free(faces); faces = NULL; }
+    nvert = avert = nface = aface = 0;
+    glyph_free(0, 0xffff);
+    if(palpool) { free(palpool); palpool = NULL; }
+    palpoollen = palpoolmax = 0; paldirty = 1;
+#ifndef NOEDITORS
+    cap_free();
+#endif
+    if(spans) { free(spans); spans = NULL; }
+    nspan = aspan = 0;
+}
+
+/**
+ * Mark the mipmaps and the inverse palette outdated if a write to MMIO touches the palette or the sprites, and recalculate the glyphs (and with
+ * that drop them from the glyph cache) if it touches the font
+ */
+void gpu_dirty(addr_t dst, uint32_t len)
+{
+    uint32_t e = dst + len, b = meg4.mmio.fontsel < 16 ? meg4.mmio.fontsel * 4096 : 0, s, f, x;
+    if(dst < 0x480 && e > 0x80) { mipdirty = 2; paldirty = 1; }
+    if(dst < 0x20000 && e > 0x10000) {
+        s = dst < 0x10000 ? 0 : dst - 0x10000; f = (e > 0x20000 ? 0x20000 : e) - 0x10001;
+        if((s >> 8) == (f >> 8))
+            for(x = (s & 255) >> 3; x <= (f & 255) >> 3; x++) mipcells[s >> 11] |= 1U << x;
+        else
+            for(s >>= 11; s <= f >> 11; s++) mipcells[s] = 0xffffffff;
+        if(!mipdirty) mipdirty = 1;
+    }
+    if(dst < MEG4_MEM_USER && e > 0x28000)
+        meg4_recalcfont(b + ((dst < 0x28000 ? 0x28000 : dst) - 0x28000) / 8, b + ((e > MEG4_MEM_USER ? MEG4_MEM_USER : e) - 0x28001) / 8);
+}
+
+/**
+ * Average four texels into one mipmap texel
+ */
+static __inline__ void mip_avg(uint8_t *a, uint8_t *b00, uint8_t *b01, uint8_t *b10, uint8_t *b11)
+{
+    a[0] = (b00[0] + b01[0] + b10[0] + b11[0]) >> 2;
+    a[1] = (b00[1] + b01[1] + b10[1] + b11[1]) >> 2;
+    a[2] = (b00[2] + b01[2] + b10[2] + b11[2]) >> 2;
+    a[3] = (b00[3] + b01[3] + b10[3] + b11[3]) >> 2;
+}
+
+/**
+ * Recalculate the mipmap texels of one 8 x 8 sprite cell (4 x 4, 2 x 2 and 1 texel on the three levels)
+ */
+static void mip_cell(int cx, int cy)
+{
+    uint8_t *a, *b, *s = meg4.mmio.sprites + (cy << 11) + (cx << 3), *pal = (uint8_t*)meg4.mmio.palette;
+    int i, j;
+
+    for(j = 0; j < 4; j++)
+        for(i = 0, a = meg4.mipmap + (((((cy << 2) + j) << 7) + (cx << 2)) << 2), b = s + (j << 9); i < 4; i++, a += 4, b += 2)
+            mip_avg(a, pal + (b[0] << 2), pal + (b[1] << 2), pal + (b[256] << 2), pal + (b[257] << 2));
+    for(j = 0; j < 2; j++)
+        for(i = 0; i < 2; i++) {
+            a = meg4.mipmap + mipoff[2] + (((((cy << 1) + j) << 6) + (cx << 1) + i) << 2);
+            b = meg4.mipmap + (((((cy << 2) + (j << 1)) << 7) + (cx << 2) + (i << 1)) << 2);
+            mip_avg(a, b, b + 4, b + 512, b + 516);
+        }
+    a = meg4.mipmap + mipoff[3] + (((cy << 5) + cx) << 2);
+    b = meg4.mipmap + mipoff[2] + (((cy << 7) + (cx << 1)) << 2);
+    mip_avg(a, b, b + 4, b + 256, b + 260);
+}
+
+/**
+ * Bring the mipmaps up-to-date, only recalculate the modified sprite cells if the palette hasn't changed
+ */
+static void mip_refresh(void)
+{
+    int i, j;
+    if(mipdirty > 1) { meg4_recalcmipmap(); return; }
+    for(j = 0; j < 32; j++)
+        if(mipcells[j])
+            for(i = 0; i < 32; i++)
+                if(mipcells[j] & (1U << i)) mip_cell(i, j);
+    memset(mipcells, 0, sizeof(mipcells));
+    mipdirty = 0;
+}
+
+/**
+ * Publish the GPU performance counters of the last frame
+ */
+void gpu_perf(void)
+{
+    meg4.mmio.culltri = htole16(perf_culltri);
+    meg4.mmio.cullmesh = htole16(perf_cullmesh);
+    perf_culltri = perf_cullmesh = 0;
+}
+
 /**
  * Translate a vertex point
  */
@@ -436,7 +1138,8 @@ static void clip_triangle(vert_t* v0, vert_t* v1, vert_t* v2, int tex, int clip_
     if (co == 0) {
         n = (float)(v1->x - v0->x) * (float)(v2->y - v0->y) - (float)(v2->x - v0->x) * (float)(v1->y - v0->y);
         if(n >= -0.0f) return;
-        tex ? draw_triangle_tex(v0, v1, v2) : draw_triangle_grd(v0, v1, v2);
+        if(gpu_nwrk > 1) bin_triangle(v0, v1, v2, tex); else
+        if(tex) draw_triangle_tex(v0, v1, v2, -32768, 32767); else draw_triangle_grd(v0, v1, v2, -32768, 32767);
     } else {
         ca = cc[0] & cc[1] & cc[2];
         if(!ca) {
@@ -498,7 +1201,7 @@ static void vertex(float x, float y, float z)
     vert_t *v = &verts[nvert];
     float fx, fy, fz;
 
-    if(nvert >= 256) return;
+    if(nvert >= avert) return;
     nvert++;
     memset(v, 0, sizeof(vert_t));
     /* world coordinates */
@@ -520,13 +1223,13 @@ static void vertex(float x, float y, float z)
 /**
  * Add a triangle face to the GPU buffer (EBO)
  */
-static void face(int i0, int p0, int u0, int v0, int i1, int p1, int u1, int v1, int i2, int p2, int u2, int v2)
+static void face(int i0, int p0, int u0, int v0, int i1, int p1, int u1, int v1, int i2, int p2, int u2, int v2, int tex)
 {
     float a[3], b[3], n[3];
     face_t *f = &faces[nface];
 
-    if(nface >= (int)(sizeof(faces)/sizeof(faces[0])) || i0 >= nvert || i1 >= nvert || i2 >= nvert) return;
-    nface++;
+    if(nface >= aface || i0 >= nvert || i1 >= nvert || i2 >= nvert) return;
+    nface++; f->tex = tex;
     f->i[0] = i0; f->p[0] = p0; f->u[0] = u0; f->v[0] = v0;
     f->i[1] = i1; f->p[1] = p1; f->u[1] = u1; f->v[1] = v1;
     f->i[2] = i2; f->p[2] = p2; f->u[2] = u2; f->v[2] = v2;
@@ -539,15 +1242,120 @@ static void face(int i0, int p0, int u0, int v0, int i1, int p1, int u1, int v1,
     verts[i2].nor[0] += n[0]; verts[i2].nor[1] += n[1]; verts[i2].nor[2] += n[2];
 }
 
+/**
+ * Check if a bounding sphere is entirely outside of the view frustum
+ */
+static int frustum_cull(float *sph)
+{
+    float c[16], *p, n[4], l;
+    int i, j;
+
+    /* combined view projection matrix, same as what vertex() does */
+    for(i = 0; i < 4; i++)
+        for(j = 0; j < 4; j++)
+            c[i * 4 + j] = prj[i * 4 + 0] * cam[j] + prj[i * 4 + 1] * cam[4 + j] + prj[i * 4 + 2] * cam[8 + j] + prj[i * 4 + 3] * cam[12 + j];
+    /* the six clipping planes are w + x >= 0, w - x >= 0, w + y >= 0 etc. */
+    for(i = 0; i < 6; i++) {
+        p = &c[(i >> 1) * 4];
+        for(j = 0; j < 4; j++) n[j] = i & 1 ? c[12 + j] - p[j] : c[12 + j] + p[j];
+        l = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if(l > 0.0f && n[0] * sph[0] + n[1] * sph[1] + n[2] * sph[2] + n[3] < -sph[3] * l * 1.0001f) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Restore face normals and faces from the static mesh cache
+ */
+static void meshcache_get(meshcache_t *mc, int base)
+{
+    face_t *f;
+    int i;
+    for(i = 0; base + i < nvert && i < mc->nvert; i++) memcpy(verts[base + i].nor, mc->nor + i * 3, 3 * sizeof(float));
+    for(i = 0; i < mc->nface && nface < aface; i++) {
+        f = &faces[nface++]; memcpy(f, &mc->faces[i], sizeof(face_t));
+        f->i[0] += base; f->i[1] += base; f->i[2] += base;
+    }
+}
+
+/**
+ * Store face normals and faces in the static mesh cache
+ */
+static int meshcache_put(meshcache_t *mc, int base, int fbase)
+{
+    int i, nv = nvert - base, nf = nface - fbase;
+    if(mc->nor) free(mc->nor);
+    if(mc->faces) free(mc->faces);
+    mc->nor = (float*)malloc((nv ? nv : 1) * 3 * sizeof(float));
+    mc->faces = (face_t*)malloc((nf ? nf : 1) * sizeof(face_t));
+    if(!mc->nor || !mc->faces) {
+        if(mc->nor) { free(mc->nor); mc->nor = NULL; }
+        if(mc->faces) { free(mc->faces); mc->faces = NULL; }
+        return 0;
+    }
+    mc->nvert = nv; mc->nface = nf;
+    for(i = 0; i < nv; i++) memcpy(mc->nor + i * 3, verts[base + i].nor, 3 * sizeof(float));
+    for(i = 0; i < nf; i++) {
+        memcpy(&mc->faces[i], &faces[fbase + i], sizeof(face_t));
+        mc->faces[i].i[0] -= base; mc->faces[i].i[1] -= base; mc->faces[i].i[2] -= base;
+    }
+    return 1;
+}
+
+/**
+ * Make room for a new 3D submission in the work buffers. Returns the number of faces that fit
+ */
+static int reserve(int nv, int nf)
+{
+    vert_t *v;
+    face_t *f;
+    int n;
+
+    /* if it doesn't fit into the memory limit, then process what we have so far and start a new batch */
+    if((nvert + nv) * (int)sizeof(vert_t) + (nface + nf) * (int)sizeof(face_t) > gpu_memlimit) gpu_flush();
+    if(nv * (int)sizeof(vert_t) + nf * (int)sizeof(face_t) > gpu_memlimit) {
+        nf = (gpu_memlimit - nv * (int)sizeof(vert_t)) / (int)sizeof(face_t);
+        if(!gpu_memwarn) { main_log(1, "3D work buffers limit %u KiB reached, triangles dropped", gpu_memlimit / 1024); gpu_memwarn = 1; }
+        if(nf < 1) return 0;
+    }
+    if(nvert + nv > avert) {
+        n = avert * 2 > nvert + nv ? avert * 2 : nvert + nv; if(n < 256) n = 256;
+        if(n * (int)sizeof(vert_t) + aface * (int)sizeof(face_t) > gpu_memlimit) n = nvert + nv;
+        if(!(v = (vert_t*)realloc(verts, n * sizeof(vert_t)))) return 0;
+        verts = v; avert = n;
+        main_log(2, "3D work buffers %u KiB (limit %u KiB)", (avert * (int)sizeof(vert_t) + aface * (int)sizeof(face_t)) / 1024,
+            gpu_memlimit / 1024);
+    }
+    if(nface + nf > aface) {
+        n = aface * 2 > nface + nf ? aface * 2 : nface + nf; if(n < 1024) n = 1024;
+        if(avert * (int)sizeof(vert_t) + n * (int)sizeof(face_t) > gpu_memlimit) n = nface + nf;
+        if(!(f = (face_t*)realloc(faces, n * sizeof(face_t)))) return 0;
+        faces = f; aface = n;
+        main_log(2, "3D work buffers %u KiB (limit %u KiB)", (avert * (int)sizeof(vert_t) + aface * (int)sizeof(face_t)) / 1024,
+            gpu_memlimit / 1024);
+    }
+    return nf;
+}
+
+/**
+ * Set the upper limit of the 3D work buffers in kilobytes
+ */
+void meg4_gpumem(int kbytes)
+{
+    gpu_flush();
+    gpu_memlimit = (kbytes < 64 ? 64 : kbytes) * 1024; gpu_memwarn = 0;
+}
+
 /**
  * Process triangles in VBO + EBO, clip and display them
  */
-static void processtri(int tex)
+static void processtri(void)
 {
     face_t *f;
     vert_t *v0, *v1, *v2;
     int i;
     uint32_t col;
+    float det, cullsgn = vps[0] * vps[1];
 
     if(!nvert || !nface) return;
     /* convert using inverse view matrix and normalize normal vectors */
@@ -560,7 +1368,16 @@ static void processtri(int tex)
     }
     for(i = 0, f = faces; i < nface; i++, f++) {
         v0 = &verts[f->i[0]]; v1 = &verts[f->i[1]]; v2 = &verts[f->i[2]];
-        if(tex) {
+        /* back-face culling in homogeneous coordinates, before lighting and clipping. Only for triangles entirely in front
+         * of the camera, and only clearly back-facing ones, the degenerate cases are left for clip_triangle() */
+        if(v0->pc[3] > 0.0f && v1->pc[3] > 0.0f && v2->pc[3] > 0.0f) {
+            det = v0->pc[0] * (v1->pc[1] * v2->pc[3] - v2->pc[1] * v1->pc[3]) -
+                  v1->pc[0] * (v0->pc[1] * v2->pc[3] - v2->pc[1] * v0->pc[3]) +
+                  v2->pc[0] * (v0->pc[1] * v1->pc[3] - v1->pc[1] * v0->pc[3]);
+            if(det * cullsgn > 0.0f) { perf_culltri++; continue; }
+        }
+        if(f->tex) {
+            if(mipdirty && !(meg4.mmio.texflags & 1)) mip_refresh();
             v0->tex[0] = f->u[0]; v0->tex[1] = f->v[0]; v0->col[0] = v0->col[1] = v0->col[2] = v0->col[3] = 1.0f;
             v1->tex[0] = f->u[1]; v1->tex[1] = f->v[1]; v1->col[0] = v1->col[1] = v1->col[2] = v1->col[3] = 1.0f;
             v2->tex[0] = f->u[2]; v2->tex[1] = f->v[2]; v2->col[0] = v2->col[1] = v2->col[2] = v2->col[3] = 1.0f;
@@ -584,8 +1401,19 @@ static void processtri(int tex)
             v2->col[3] = (float)((col >> 24) & 0xff) / 255.0f;
         }
         shader(v0); shader(v1); shader(v2);
-        clip_triangle(v0, v1, v2, tex, 0);
+        clip_triangle(v0, v1, v2, f->tex, 0);
     }
+    bin_flush();
+}
+
+/**
+ * Process the accumulated 3D submissions. Must be called before anything else touches the screen or the z-buffer
+ */
+void gpu_flush(void)
+{
+    gpu_sync();
+    if(nface) processtri();
+    nvert = nface = 0;
 }
 
 /**
@@ -680,24 +1508,288 @@ void meg4_getview(void)
     cami[12] = tmp[3]; cami[13] = tmp[7]; cami[14] = tmp[11]; cami[15] = tmp[15];
 }
 
+#ifndef NOEDITORS
+/**
+ * Screenshot and screen capture queue. The main thread only copies the frame, the PNG encoding, the compression of the
+ * recorded frames and the file writes are done by a background thread (if compiled with threads, otherwise right away).
+ * The recording is a zero terminated "MEG4CAP" magic, 16 bit width, height and fps, then for each frame a 32 bit length and packets
+ * of the frame XOR'd with the previous one: a 16 bit count, if bit 15 is set, then one pixel repeated count & 0x7fff
+ * times, otherwise count literal pixels. Recordings are split into segments of about CAPSEGMENT bytes.
+ */
+#define CAPQUEUE    16
+#define CAPSEGMENT  (64 * 1024 * 1024)
+enum { CAP_PNG, CAP_FRAME, CAP_END };
+typedef struct { uint32_t *buf; int w, h, type; uint64_t now; } capjob_t;
+static uint32_t *capprev = NULL;
+static uint8_t *caprec = NULL;
+static int caplen = 0, capmax = 0, capseq = 0, capw = 0, caph = 0, capon = 0;
+static uint64_t capnow = 0, capstart = 0;
+#ifdef MEG4_THREADS
+static pthread_t cap_thr;
+static pthread_mutex_t cap_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cap_cnd = PTHREAD_COND_INITIALIZER, cap_fin = PTHREAD_COND_INITIALIZER;
+static capjob_t capq[CAPQUEUE];
+static int cap_run = 0, cap_quit = 0, caphead = 0, capnum = 0;
+#endif
+
+/**
+ * Generate a file name with a timestamp (and a segment number if seq isn't negative)
+ */
+static void cap_filename(char *fn, char *type, uint64_t now, int seq)
+{
+    int j;
+    memcpy(fn, "meg4_", 5); memcpy(fn + 5, type, 3); memcpy(fn + 8, "_0000000000", 11);
+    for(j = 18; now > 0 && j > 8; j--, now /= 10) fn[j] += now % 10;
+    if(seq < 0) memcpy(fn + 19, ".png", 5);
+    else {
+        memcpy(fn + 19, "_000.cap", 9);
+        for(j = 22; seq > 0 && j > 19; j--, seq /= 10) fn[j] += seq % 10;
+    }
+}
+
+/**
+ * Write out the recorded segment
+ */
+static void cap_segment(void)
+{
+    char fn[32];
+    if(caplen > 16) {
+        cap_filename(fn, "rec", capnow, capseq++);
+        main_writefile(fn, caprec, caplen);
+    }
+    caplen = 0;
+}
+
+/**
+ * Process a job, encode a screenshot or compress a recorded frame
+ */
+static void cap_process(capjob_t *job)
+{
+    char fn[32];
+    uint8_t *buf, *ptr;
+    uint32_t *s, *e, p, q;
+    int i, n;
+
+    switch(job->type) {
+        case CAP_PNG:
+            buf = stbi_write_png_to_mem((unsigned char*)job->buf, job->w * 4, job->w, job->h, 4, &i, NULL, 0);
+            if(buf) {
+                cap_filename(fn, "scr", job->now, -1);
+                main_writefile(fn, buf, i);
+                free(buf);
+            }
+        break;
+        case CAP_FRAME:
+            if(job->now != capnow || job->w != capw || job->h != caph || caplen >= CAPSEGMENT) {
+                /* new recording, new resolution or segment is full */
+                cap_segment();
+                if(job->now != capnow) capseq = 0;
+                if(capprev) { free(capprev); capprev = NULL; }
+                capnow = job->now; capw = job->w; caph = job->h;
+            }
+            n = capw * caph;
+            if(!capprev && !(capprev = (uint32_t*)calloc(n, sizeof(uint32_t)))) break;
+            /* a packet header for every 3 pixels is the worst case */
+            if(caplen + 16 + n * 6 > capmax) {
+                buf = (uint8_t*)realloc(caprec, caplen + 16 + n * 6);
+                if(!buf) break;
+                caprec = buf; capmax = caplen + 16 + n * 6;
+            }
+            if(!caplen) {
+                memcpy(caprec, "MEG4CAP", 8);
+                caprec[8] = capw & 0xff; caprec[9] = capw >> 8; caprec[10] = caph & 0xff; caprec[11] = caph >> 8;
+                caprec[12] = 60; caprec[13] = 0; caplen = 14;
+            }
+            ptr = caprec + caplen + 4;
+            for(s = job->buf, e = s + n, i = 0; s < e; ) {
+                /* count the repeated pixels of the difference */
+                p = *s ^ capprev[i];
+                for(n = 1; s + n < e && n < 0x7fff && (s[n] ^ capprev[i + n]) == p; n++);
+                if(n > 2) {
+                    ptr[0] = n & 0xff; ptr[1] = (n >> 8) | 0x80; memcpy(ptr + 2, &p, 4); ptr += 6;
+                } else {
+                    /* literal pixels until the next run of three */
+                    for(n = 0; s + n < e && n < 0x7fff; n++) {
+                        q = s[n] ^ capprev[i + n];
+                        if(s + n + 2 < e && q == (s[n + 1] ^ capprev[i + n + 1]) && q == (s[n + 2] ^ capprev[i + n + 2])) break;
+                        memcpy(ptr + 2 + n * 4, &q, 4);
+                    }
+                    ptr[0] = n & 0xff; ptr[1] = n >> 8; ptr += 2 + n * 4;
+                }
+                s += n; i += n;
+            }
+            memcpy(capprev, job->buf, capw * caph * sizeof(uint32_t));
+            n = ptr - caprec - caplen - 4;
+            caprec[caplen] = n & 0xff; caprec[caplen + 1] = (n >> 8) & 0xff; caprec[caplen + 2] = (n >> 16) & 0xff;
+            caprec[caplen + 3] = n >> 24;
+            caplen = ptr - caprec;
+        break;
+        case CAP_END:
+            cap_segment();
+            if(capprev) { free(capprev); capprev = NULL; }
+            capnow = 0; capw = caph = 0;
+        break;
+    }
+    if(job->buf) free(job->buf);
+}
+
+#ifdef MEG4_THREADS
+/**
+ * Capture thread
+ */
+static void *cap_worker(void *arg)
+{
+    capjob_t job;
+    (void)arg;
+    pthread_mutex_lock(&cap_mtx);
+    while(1) {
+        while(!capnum && !cap_quit) pthread_cond_wait(&cap_cnd, &cap_mtx);
+        if(!capnum) break;
+        job = capq[caphead];
+        pthread_mutex_unlock(&cap_mtx);
+        cap_process(&job);
+        pthread_mutex_lock(&cap_mtx);
+        caphead = (caphead + 1) % CAPQUEUE; capnum--;
+        pthread_cond_signal(&cap_fin);
+    }
+    pthread_mutex_unlock(&cap_mtx);
+    return NULL;
+}
+#endif
+
+/**
+ * Queue a capture job. If there's a frame, it's copied, so the caller can go on right away. Never drops a job, if the
+ * queue is full, this waits for the capture thread to catch up
+ */
+static void cap_push(int type, uint64_t now, uint32_t *src, int w, int h, int dp)
+{
+    capjob_t job;
+    int y;
+
+    job.type = type; job.w = w; job.h = h; job.now = now; job.buf = NULL;
+    if(src) {
+        if(!(job.buf = (uint32_t*)malloc(w * h * sizeof(uint32_t)))) return;
+        for(y = 0; y < h; y++) memcpy(job.buf + y * w, (uint8_t*)src + y * dp, w * sizeof(uint32_t));
+    }
+#ifdef MEG4_THREADS
+    pthread_mutex_lock(&cap_mtx);
+    if(!cap_run) { cap_quit = 0; cap_run = !pthread_create(&cap_thr, NULL, cap_worker, NULL); }
+    if(cap_run) {
+        while(capnum >= CAPQUEUE) pthread_cond_wait(&cap_fin, &cap_mtx);
+        capq[(caphead + capnum) % CAPQUEUE] = job; capnum++;
+        pthread_cond_signal(&cap_cnd);
+        pthread_mutex_unlock(&cap_mtx);
+        return;
+    }
+    pthread_mutex_unlock(&cap_mtx);
+#endif
+    cap_process(&job);
+}
+
+/**
+ * Stop the recording, wait for the queued jobs and stop the capture thread
+ */
+static void cap_free(void)
+{
+    if(capon) { cap_push(CAP_END, capstart, NULL, 0, 0, 0); capon = 0; }
+#ifdef MEG4_THREADS
+    if(cap_run) {
+        pthread_mutex_lock(&cap_mtx); cap_quit = 1; pthread_cond_signal(&cap_cnd); pthread_mutex_unlock(&cap_mtx);
+        pthread_join(cap_thr, NULL);
+        cap_run = 0;
+    }
+#endif
+    if(caprec) { free(caprec); caprec = NULL; }
+    caplen = capmax = 0;
+}
+#endif
+
+/**
+ * Blend a palette color on a pixel of the displayed screen
+ */
+static void oam_blend(uint8_t *a, int idx)
+{
+    uint8_t *b = (uint8_t*)&meg4.mmio.palette[idx];
+    int D = 255 - b[3];
+    a[2] = (b[2]*b[3] + D*a[2]) >> 8; a[1] = (b[1]*b[3] + D*a[1]) >> 8; a[0] = (b[0]*b[3] + D*a[0]) >> 8;
+}
+
+/**
+ * Composite one object of the sprite layer
+ */
+static void oam_obj(uint32_t *dst, int dp, int w, int h, uint8_t *o)
+{
+    int x = (int16_t)(o[0] | (o[1] << 8)), y = (int16_t)(o[2] | (o[3] << 8)), s = o[4] | (o[5] << 8);
+    int ow = (((s >> 10) & 7) + 1) << 3, oh = (((s >> 13) & 7) + 1) << 3, sx = (s & 31) << 3, sy = ((s >> 5) & 31) << 3;
+    int i, j, i0, i1, j1, tx, ty, c;
+    uint8_t *d;
+
+    i0 = x < 0 ? -x : 0; i1 = x + ow > w ? w - x : ow;
+    j = y < 0 ? -y : 0; j1 = y + oh > h ? h - y : oh;
+    /* just like with spr, the parts that would be outside of the sprite sheet are transparent */
+    for(; j < j1; j++) {
+        if((ty = sy + (o[6] & 2 ? oh - 1 - j : j)) > 255) continue;
+        for(i = i0, d = (uint8_t*)dst + (y + j) * dp + (x + i) * 4; i < i1; i++, d += 4)
+            if((tx = sx + (o[6] & 1 ? ow - 1 - i : i)) < 256 && (c = meg4.mmio.sprites[(ty << 8) | tx]))
+                oam_blend(d, (c + o[7]) & 255);
+    }
+}
+
+/**
+ * Composite the tilemap layer, which is the whole map scrolled by the table header's offsets, wrapping around
+ */
+static void oam_map(uint32_t *dst, int dp, int w, int h, uint8_t *t)
+{
+    int mx = (int16_t)(t[0] | (t[1] << 8)) % 2560, my = (int16_t)(t[2] | (t[3] << 8)) % 1600, x, y, u, v, s, c;
+    uint8_t *d, *m;
+
+    if(mx < 0) mx += 2560;
+    if(my < 0) my += 1600;
+    for(y = 0, v = my; y < h; y++, v = v + 1 < 1600 ? v + 1 : 0)
+        for(x = 0, u = mx, m = meg4.mmio.map + (v >> 3) * 320, d = (uint8_t*)dst + y * dp; x < w;
+          x++, u = u + 1 < 2560 ? u + 1 : 0, d += 4)
+            if(m[u >> 3]) {
+                s = ((meg4.mmio.mapsel & 3) << 8) | m[u >> 3];
+                if((c = meg4.mmio.sprites[((((s >> 5) << 3) + (v & 7)) << 8) + ((s & 31) << 3) + (u & 7)])) oam_blend(d, c);
+            }
+}
+
+/**
+ * Composite the sprite layer over the displayed screen. Objects with a lower index are on top, and the ones with the
+ * priority bit set are behind the tilemap layer
+ */
+static void gpu_oam(uint32_t *dst, int dp, int w, int h)
+{
+    uint8_t *t = oamsnap[oamcur];
+    int i;
+
+    for(i = oamlen[oamcur] - 1; i >= 0; i--) if(t[8 + i * 8 + 6] & 4) oam_obj(dst, dp, w, h, t + 8 + i * 8);
+    if(t[4] & 1) oam_map(dst, dp, w, h, t);
+    for(i = oamlen[oamcur] - 1; i >= 0; i--) if(!(t[8 + i * 8 + 6] & 4)) oam_obj(dst, dp, w, h, t + 8 + i * 8);
+}
+
 /**
  * Redraw the platform's framebuffer with the MEG-4's VRAM
  */
 void meg4_redraw(uint32_t *dst, int dw, int dh, int dp)
 {
-#ifndef NOEDITORS
-    char fn[32] = "meg4_scr_0000000000.png";
-    uint64_t now = le64toh(meg4.mmio.now);
-    uint8_t *buf;
-#endif
     char tmp[32], *gf = "Software Failure.", *gm = "Guru Meditation #";
     int x, y = 0, w, h, i, j, p = dp >> 2, x0, x1, y0, y1;
     uint32_t *ptr, *d = dst, c;
 
     if(!dst || dw < 1 || dh < 1 || dp < 4) return;
+    gpu_lock();
     ptr = meg4.screen.buf;
     w = (meg4.screen.w < dw ? meg4.screen.w : dw);
     h = meg4.screen.h < dh ? meg4.screen.h : dh;
+#ifdef MEG4_THREADS
+    /* with one frame latency display the last finished frame, the render thread is drawing the current one into vram */
+    if(rnd_fvalid && rnd_lat > 0 && meg4.mode == MEG4_MODE_GAME) {
+        ptr = vfront + rnd_foff;
+        w = rnd_fw < dw ? rnd_fw : dw;
+        h = rnd_fh < dh ? rnd_fh : dh;
+    }
+#endif
     x0 = meg4.mmio.cropx0; meg4.mmio.cropx0 = 0; x1 = meg4.mmio.cropx1; meg4.mmio.cropx1 = htole16(w);
     y0 = meg4.mmio.cropy0; meg4.mmio.cropy0 = 0; y1 = meg4.mmio.cropy1; meg4.mmio.cropy1 = htole16(h);
     /* panic, this should only be shown when editors aren't compiled in. But just in case something really goes wrong, no ifdef */
@@ -714,6 +1806,7 @@ void meg4_redraw(uint32_t *dst, int dw, int dh, int dp)
             for(d = dst + 122 * p + ((320 - x0) >> 1), x = 0; x < 32; x++, d += p) d[0] = d[1] = d[x0-2] = d[x0-1] = c;
         }
         meg4_blit(dst, le16toh(meg4.mmio.ptrx) - 4, le16toh(meg4.mmio.ptry) -4, dp, 8, 8, meg4_icons.buf, 24, 64, meg4_icons.w * 4, 1);
+        gpu_unlock();
         return;
     }
     c = htole32(0xffaaaaaa);
@@ -728,6 +1821,7 @@ void meg4_redraw(uint32_t *dst, int dw, int dh, int dp)
         memcpy(d, ptr, j);
         if(w < dw) d[w] = 0;
     }
+    if(meg4.mode == MEG4_MODE_GAME) gpu_oam(dst, dp, w, h);
 #ifndef NOEDITORS
     if(meg4.mode > MEG4_MODE_SAVE || load_list)
         menu_view(dst, dw, dh, dp);
@@ -758,17 +1852,17 @@ void meg4_redraw(uint32_t *dst, int dw, int dh, int dp)
         }
     }
     meg4.mmio.cropx0 = x0; meg4.mmio.cropx1 = x1; meg4.mmio.cropy0 = y0; meg4.mmio.cropy1 = y1;
+    gpu_unlock();
 #ifndef NOEDITORS
-    /* take a screenshot */
-    if(meg4_takescreenshot) {
-        meg4_takescreenshot = 0;
-        buf = stbi_write_png_to_mem((unsigned char*)dst, dp, w, h, 4, &i, NULL, 0);
-        if(buf) {
-            for(j = 18; now > 0 && j > 8; j--, now /= 10) fn[j] += now % 10;
-            main_writefile(fn, buf, i);
-            free(buf);
-        }
+    /* take a screenshot, or start / stop recording */
+    if(meg4_takescreenshot == 1) cap_push(CAP_PNG, le64toh(meg4.mmio.now), dst, w, h, dp);
+    if(meg4_takescreenshot == 2) {
+        if(capon) cap_push(CAP_END, capstart, NULL, 0, 0, 0);
+        else capstart = le64toh(meg4.mmio.now);
+        capon ^= 1;
     }
+    meg4_takescreenshot = 0;
+    if(capon) cap_push(CAP_FRAME, capstart, dst, w, h, dp);
 #endif
 }
 
@@ -837,6 +1931,7 @@ void meg4_recalcfont(int s, int e)
     int i, x, y, l, r;
 
     if(s < 0 || s > 0xffff || e < 0 || e > 0xffff || e < s) return;
+    glyph_free(s, e);
     memset(ptr, 0, e - s + 1);
     for(i = s; i <= e; i++, fnt += 8, ptr++) {
         if(i == 32 || i == 160) { *ptr = 0x30; continue; }
@@ -857,26 +1952,48 @@ void meg4_recalcfont(int s, int e)
 void meg4_recalcmipmap(void)
 {
     int i, j, k, p;
-    uint8_t *a = meg4.mipmap, *b00, *b01, *b10, *b11;
+    uint8_t *a = meg4.mipmap, *b00;
+    mipdirty = 0;
+    memset(mipcells, 0, sizeof(mipcells));
     for(j = 0; j < 128; j++)
-        for(i = 0; i < 128; i++, a += 4) {
-            b00 = (uint8_t*)&meg4.mmio.palette[(int)meg4.mmio.sprites[(j << 9) + (i << 1)]];
-            b01 = (uint8_t*)&meg4.mmio.palette[(int)meg4.mmio.sprites[(j << 9) + (i << 1) + 1]];
-            b10 = (uint8_t*)&meg4.mmio.palette[(int)meg4.mmio.sprites[(j << 9) + (i << 1) + 256]];
-            b11 = (uint8_t*)&meg4.mmio.palette[(int)meg4.mmio.sprites[(j << 9) + (i << 1) + 257]];
-            a[0] = (b00[0] + b01[0] + b10[0] + b11[0]) >> 2;
-            a[1] = (b00[1] + b01[1] + b10[1] + b11[1]) >> 2;
-            a[2] = (b00[2] + b01[2] + b10[2] + b11[2]) >> 2;
-            a[3] = (b00[3] + b01[3] + b10[3] + b11[3]) >> 2;
-        }
+        for(i = 0; i < 128; i++, a += 4)
+            mip_avg(a, (uint8_t*)&meg4.mmio.palette[(int)meg4.mmio.sprites[(j << 9) + (i << 1)]],
+                (uint8_t*)&meg4.mmio.palette[(int)meg4.mmio.sprites[(j << 9) + (i << 1) + 1]],
+                (uint8_t*)&meg4.mmio.palette[(int)meg4.mmio.sprites[(j << 9) + (i << 1) + 256]],
+                (uint8_t*)&meg4.mmio.palette[(int)meg4.mmio.sprites[(j << 9) + (i << 1) + 257]]);
     for(b00 = meg4.mipmap, k = 64, p = 512; k > 16; k >>= 1, p >>= 1)
         for(j = 0; j < k; j++, b00 += p)
-            for(i = 0; i < k; i++, a += 4, b00 += 8) {
-                a[0] = (b00[0] + b00[4] + b00[p+0] + b00[p+4]) >> 2;
-                a[1] = (b00[1] + b00[5] + b00[p+1] + b00[p+5]) >> 2;
-                a[2] = (b00[2] + b00[6] + b00[p+2] + b00[p+6]) >> 2;
-                a[3] = (b00[3] + b00[7] + b00[p+3] + b00[p+7]) >> 2;
-            }
+            for(i = 0; i < k; i++, a += 4, b00 += 8)
+                mip_avg(a, b00, b00 + 4, b00 + p, b00 + p + 4);
+}
+
+/**
+ * Collect the palette entries that could be the closest match to any color in an inverse palette cell. That's every
+ * entry whose distance to the cell's box is not larger than the smallest worst case distance of any entry
+ */
+static void palidx_cell(uint32_t *cell, uint8_t *rgba)
+{
+    uint8_t *b;
+    int i, j, c, lo, hi, n, m = 0x7fffffff, dmax, dmin[256], w[3] = { 2, 4, 1 };
+
+    for(i = 0; i < 256; i++) {
+        b = (uint8_t*)&meg4.mmio.palette[i];
+        for(j = dmin[i] = dmax = 0; j < 3; j++) {
+            lo = rgba[j] & 0xf8; hi = lo | 7;
+            c = b[j] < lo ? lo - b[j] : (b[j] > hi ? b[j] - hi : 0); dmin[i] += w[j] * c * c;
+            c = b[j] - lo > hi - b[j] ? b[j] - lo : hi - b[j]; dmax += w[j] * c * c;
+        }
+        if(dmax < m) m = dmax;
+    }
+    for(i = n = 0; i < 256; i++) if(dmin[i] <= m) n++;
+    if(palpoollen + n > palpoolmax) {
+        if(palpoolmax + 65536 >= (1 << 23)) return;
+        /* keep the old pool if there's no more memory, this cell just won't be cached */
+        if(!(b = (uint8_t*)realloc(palpool, palpoolmax + 65536))) return;
+        palpool = b; palpoolmax += 65536;
+    }
+    *cell = (palpoollen << 9) | n;
+    for(i = 0; i < 256; i++) if(dmin[i] <= m) palpool[palpoollen++] = i;
 }
 
 /**
@@ -884,17 +2001,21 @@ void meg4_recalcmipmap(void)
  */
 uint8_t meg4_palidx(uint8_t *rgba)
 {
-    uint8_t ret = 0, *b;
-    int i, dr, dg, db, d, dm = 0x7fffffff;
+    uint8_t ret = 0, *b, *p;
+    uint32_t *cell = &palcell[((rgba[0] >> 3) << 10) | ((rgba[1] >> 3) << 5) | (rgba[2] >> 3)];
+    int i, n, dr, dg, db, d, dm = 0x7fffffff;
 
-    for(i = 0; i < 256 && dm > 0; i++) {
-        b = (uint8_t*)&meg4.mmio.palette[i];
-        if(rgba[0] == b[0] && rgba[1] == b[1] && rgba[2] == b[2]) return i;
+    if(paldirty) { memset(palcell, 0, sizeof(palcell)); palpoollen = paldirty = 0; }
+    if(!*cell) palidx_cell(cell, rgba);
+    if(*cell) { p = palpool + (*cell >> 9); n = *cell & 511; } else { p = NULL; n = 256; }
+    for(i = 0; i < n && dm > 0; i++) {
+        b = (uint8_t*)&meg4.mmio.palette[p ? p[i] : i];
+        if(rgba[0] == b[0] && rgba[1] == b[1] && rgba[2] == b[2]) return p ? p[i] : i;
         db = rgba[2] > b[2] ? rgba[2] - b[2] : b[2] - rgba[2];
         dg = rgba[1] > b[1] ? rgba[1] - b[1] : b[1] - rgba[1];
         dr = rgba[0] > b[0] ? rgba[0] - b[0] : b[0] - rgba[0];
         d = ((dr*dr) << 1) + (db*db) + ((dg*dg) << 2);
-        if(d < dm) { dm = d; ret = i; }
+        if(d < dm) { dm = d; ret = p ? p[i] : i; }
     }
     return ret;
 }
@@ -915,6 +2036,7 @@ void meg4_spr(uint32_t *dst, int dp, int x, int y, int sprite, int scale, int ty
     d = (uint8_t*)dst + y * dp + x * 4;
     if(scale < 0) {
         /* downscale, use precalculated average values in mipmap table */
+        if(mipdirty) mip_refresh();
         switch(scale) {
             case -1: s = meg4.mipmap + ((sprite & ~31) << 7) + ((sprite & 31) << 4); p = 9; break;
             case -2: s = meg4.mipmap + 128*128*4 + ((sprite & ~31) << 6) + ((sprite & 31) << 3); p = 8; break;
@@ -1238,6 +2360,73 @@ void meg4_char(uint32_t *dst, int dp, int dx, int dy, uint32_t c, int type, uint
 }
 #endif
 
+/**
+ * Look up a glyph in the glyph cache, expand it into spans if it's not there yet
+ */
+static glyph_t *glyph_get(uint8_t *font, uint32_t c, int t, int inv, int l, int r)
+{
+    uint8_t op[33 * 33], *fnt = font + 8 * c, *o, *sp;
+    uint32_t key = c | (t << 16) | (inv << 19) | (1 << 20);
+    glyph_t *g = &glyphs[(c ^ ((t - 1) << 7) ^ (inv << 6)) & (GLYPHCACHE - 1)];
+    int w = t * (r - l + 1) + 1, h = 8 * t + 1, i, k, x, y, n;
+
+    if(g->font == font && g->key == key && g->l == l && g->r == r) return g;
+    memset(op, 0, sizeof(op));
+    for(y = 0; y < 8; y++)
+        for(x = l; x <= r; x++)
+            if(((fnt[y] >> x) & 1) != inv) {
+                o = op + t * y * 33 + t * (x - l);
+                for(k = 0; k < t; k++)
+                    for(i = 0; i < t; i++) o[k * 33 + i] |= 2;
+                for(k = 1; k < t; k++) o[k * 33 + t] |= 1;
+                for(i = 1; i <= t; i++) o[t * 33 + i] |= 1;
+                if(t == 4) o[t * 33 + t] |= 4;
+            }
+    /* count the spans, shadow and foreground ones separately, the quirky corners are one pixel each */
+    for(n = y = 0; y < h; y++)
+        for(o = op + y * 33, x = 0; x < w; x++) {
+            if((o[x] & 5) == 1 && (!x || (o[x - 1] & 5) != 1)) n++;
+            if((o[x] & 2) && (!x || !(o[x - 1] & 2))) n++;
+            if(o[x] & 4) n++;
+        }
+    if(g->row) free(g->row);
+    memset(g, 0, sizeof(glyph_t));
+    g->row = (uint16_t*)malloc((3 * h + 1) * sizeof(uint16_t) + n * 2);
+    if(!g->row) return NULL;
+    g->span = sp = (uint8_t*)(g->row + 3 * h + 1);
+    for(n = y = 0; y < h; y++) {
+        o = op + y * 33;
+        for(g->row[3 * y] = n, x = 0; x < w; x++)
+            if((o[x] & 5) == 1) {
+                if(!x || (o[x - 1] & 5) != 1) { sp[n] = x; sp[n + 1] = 0; n += 2; }
+                sp[n - 1]++;
+            }
+        for(g->row[3 * y + 1] = n, x = 0; x < w; x++)
+            if(o[x] & 4) { sp[n] = x; sp[n + 1] = 1; n += 2; }
+        for(g->row[3 * y + 2] = n, x = 0; x < w; x++)
+            if(o[x] & 2) {
+                if(!x || !(o[x - 1] & 2)) { sp[n] = x; sp[n + 1] = 0; n += 2; }
+                sp[n - 1]++;
+            }
+    }
+    g->row[3 * h] = n; g->font = font; g->key = key; g->l = l; g->r = r; g->h = h;
+    return g;
+}
+
+/**
+ * Blend a span of pixels with a color, precalculated alpha multiplied channels and inverse alpha
+ */
+static __inline__ void meg4_blendspan(uint8_t *a, int n, uint32_t R, uint32_t G, uint32_t B, uint32_t I)
+{
+    uint32_t *d = (uint32_t*)a, c;
+    if(!I) {
+        /* opaque, the result does not depend on the background, just keep its alpha channel */
+        a = (uint8_t*)&c; a[0] = B >> 8; a[1] = G >> 8; a[2] = R >> 8; a[3] = 0;
+        for(; n > 0; n--, d++) *d = (*d & htole32(0xff000000)) | c;
+    } else
+        for(; n > 0; n--, a += 4) { a[2] = (R + I*a[2]) >> 8; a[1] = (G + I*a[1]) >> 8; a[0] = (B + I*a[0]) >> 8; }
+}
+
 /**
  * Draw string
  * type = 0: do not draw, just return width in pixels
@@ -1249,6 +2438,7 @@ int meg4_text(uint32_t *dst, int dx, int dy, int dp, uint32_t color, uint32_t sh
     int x, y, Y, w = 0, W = 0, j = 0, k, m, n, l, r, p, p2, p3, p4, px, pt, t = type < 0 ? -type : type, s = t * 8, inv = 0;
     uint32_t c, A, B, C, D, E, F, G, H;
     uint8_t *fnt, *a, *b = (uint8_t*)&color, *d, *e;
+    glyph_t *g;
     char *end;
 
     if(type < -4 || type > 4 || !font || !str || (type && (!dst || dx < 0 || dy < 0 || dp < 4))) return 0;
@@ -1304,6 +2494,28 @@ int meg4_text(uint32_t *dst, int dx, int dy, int dp, uint32_t color, uint32_t sh
         w += r - l + 2; if(W < w) W = w;
         if(c == 32) { j += t * (r - l + 1) + 1; continue; }
         if(!type) continue;
+        /* if the whole glyph is inside the crop area, then draw it from the glyph cache with span blending. Rows are
+         * drawn bottom-up so that scale 4's corner shadow pixel can read the original pixel above it */
+        n = dx + j;
+        if(n >= le16toh(meg4.mmio.cropx0) && n + (shadow ? 1 : 0) + t * (r - l) < le16toh(meg4.mmio.cropx1) &&
+          dy >= le16toh(meg4.mmio.cropy0) && dy + s + (shadow ? 1 : 0) < le16toh(meg4.mmio.cropy1) &&
+          (g = glyph_get(font, c, t, inv, l, r))) {
+            for(y = g->h - 1; y >= 0; y--) {
+                e = d + (j << 2) + y * dp; k = 3 * y;
+                if(shadow) {
+                    for(n = g->row[k]; n < g->row[k + 1]; n += 2)
+                        meg4_blendspan(e + (g->span[n] << 2), g->span[n + 1], E, F, G, H);
+                    for(; n < g->row[k + 2]; n += 2) {
+                        a = e + (g->span[n] << 2);
+                        a[2] = (E + H*a[2]) >> 8; a[1] = (F + H*a[1]) >> 8; a[0] = (G + H*((G + H*a[-dp]) >> 8)) >> 8;
+                    }
+                }
+                for(n = g->row[k + 2]; n < g->row[k + 3]; n += 2)
+                    meg4_blendspan(e + (g->span[n] << 2), g->span[n + 1], A, B, C, D);
+            }
+            j += t * (r - l + 1) + 1;
+            continue;
+        }
         for(e = d + (j << 2), y = 0, Y = dy + t + (shadow ? 1 : 0); y < 8 && Y < le16toh(meg4.mmio.cropy1); y++, Y += t, fnt++, e += pt) {
             if(dy + y * t >= le16toh(meg4.mmio.cropy0))
                 for(a = e, x = l, m = (1 << l), n = dx + j, k = n + (shadow ? 1 : 0); x <= r && k < le16toh(meg4.mmio.cropx1); x++, k += t, a += px, m <<= 1)
@@ -1388,13 +2600,21 @@ int meg4_text(uint32_t *dst, int dx, int dy, int dp, uint32_t color, uint32_t sh
  */
 int meg4_width(uint8_t *font, int8_t type, char *str, char *end)
 {
-    int w = 0, W = 0, l, r, t = type < 0 ? -type : (!type ? 1 : type);
-    uint32_t c;
+    int w = 0, W = 0, l, r, n, t = type < 0 ? -type : (!type ? 1 : type);
+    uint32_t c, h = 2166136261U;
+    txtw_t *m = NULL;
 
     if(!font || type < -4 || type > 4 || !str || !*str) return 0;
     if(!end) end = str + 256;
     if((uintptr_t)str >= (uintptr_t)&meg4.data && (uintptr_t)str < (uintptr_t)&meg4.data + sizeof(meg4.data) &&
       (uintptr_t)end > (uintptr_t)&meg4.data + sizeof(meg4.data)) end = (char*)meg4.data + sizeof(meg4.data);
+    /* short strings are looked up in the width cache first */
+    for(n = 0; n < (int)sizeof(m->str) && str + n < end && str[n]; n++) h = (h ^ (uint8_t)str[n]) * 16777619U;
+    if(n < (int)sizeof(m->str)) {
+        m = &txtws[(h ^ type) & (WIDTHCACHE - 1)];
+        if(m->font == font && m->type == type && m->len == n && !memcmp(m->str, str, n)) return m->w;
+        m->font = font; m->type = type; m->len = n; memcpy(m->str, str, n);
+    }
     while(str < end && *str) {
         str = meg4_utf8(str, &c);
         if(W < w) W = w;
@@ -1409,6 +2629,7 @@ int meg4_width(uint8_t *font, int8_t type, char *str, char *end)
         }
     }
     if(W < w) W = w;
+    if(m) m->w = W;
     return W;
 }
 
@@ -1435,18 +2656,126 @@ static __inline__ void meg4_setpixel(uint16_t x, uint16_t y, uint8_t r, uint8_t
 }
 
 /**
- * Fill a scanline
+ * Add a horizontal span with coverage to the span buffer, clipped to the crop area
  */
-static __inline__ void meg4_fill(uint16_t x0, uint16_t x1, uint16_t y, uint8_t *c)
+static __inline__ void span_add(int x0, int x1, int y, int a)
 {
+    span_t *s;
+    if(a <= 0 || y < le16toh(meg4.mmio.cropy0) || y >= le16toh(meg4.mmio.cropy1) || y >= 400) return;
+    if(x0 < le16toh(meg4.mmio.cropx0)) x0 = le16toh(meg4.mmio.cropx0);
+    if(x1 >= le16toh(meg4.mmio.cropx1)) x1 = le16toh(meg4.mmio.cropx1) - 1;
+    if(x1 > 639) x1 = 639;
+    if(x0 > x1) return;
+    if(nspan >= aspan) {
+        s = (span_t*)realloc(spans, (aspan + 1024) * sizeof(span_t));
+        if(!s) return;
+        spans = s; aspan += 1024;
+    }
+    /* spans are kept in per row lists, so that no sorting is needed */
+    if(spany1 < spany0) { spanrow[y] = -1; spany0 = spany1 = y; } else
+    if(y < spany0) { memset(spanrow + y, 0xff, (spany0 - y) * sizeof(int)); spany0 = y; } else
+    if(y > spany1) { memset(spanrow + spany1 + 1, 0xff, (y - spany1) * sizeof(int)); spany1 = y; }
+    s = &spans[nspan]; s->next = spanrow[y]; spanrow[y] = nspan++;
+    s->x0 = x0; s->x1 = x1; s->a = a > 255 ? 255 : a;
+}
+
+/**
+ * Blend the spans in the buffer with a color. Overlapping spans are merged (the larger coverage wins), so that every
+ * pixel of a shape is blended exactly once, no matter how many times the shape's algorithm has touched it
+ */
+static void span_flush(uint8_t *c)
+{
+    static uint8_t cov[640];
+    span_t *s, *row[16];
+    int i, j, k, n, x, xs, xe, y, e[32];
     uint8_t *d;
-    int i, x, xs, xe, r, g, b;
-    if(c[3] && x0 < x1 && y >= le16toh(meg4.mmio.cropy0) && y < le16toh(meg4.mmio.cropy1)) {
-        xs = x0 < le16toh(meg4.mmio.cropx0) ? le16toh(meg4.mmio.cropx0) : x0;
-        xe = x1 < le16toh(meg4.mmio.cropx1) ? x1 : le16toh(meg4.mmio.cropx1);
-        i = 255 - c[3]; r = c[0]*c[3]; g = c[1]*c[3]; b = c[2]*c[3];
-        d = (uint8_t*)&meg4.vram[y * 640 + xs];
-        for(x = xs; x <= xe; x++, d += 4) { d[2] = (b + i*d[2]) >> 8; d[1] = (g + i*d[1]) >> 8; d[0] = (r + i*d[0]) >> 8; }
+
+    for(y = spany0; y <= spany1; y++) {
+        if((i = spanrow[y]) < 0) continue;
+        d = (uint8_t*)&meg4.vram[y * 640];
+        for(n = 0, xs = 640, xe = -1; i >= 0 && n < 16; i = spans[i].next) {
+            s = row[n++] = &spans[i];
+            if(s->x0 < xs) xs = s->x0;
+            if(s->x1 > xe) xe = s->x1;
+        }
+        if(i < 0) {
+            /* if the spans do not overlap, blend them directly */
+            for(j = 0, k = n; j < n - 1 && k == n; j++)
+                for(k = j + 1; k < n && (row[j]->x1 < row[k]->x0 || row[k]->x1 < row[j]->x0); k++);
+            if(k == n) {
+                for(j = 0; j < n; j++) {
+                    s = row[j];
+                    meg4_blendspan(d + (s->x0 << 2), s->x1 - s->x0 + 1, c[2] * s->a, c[1] * s->a, c[0] * s->a, 255 - s->a);
+                }
+                continue;
+            }
+        }
+        if(i < 0 && xe - xs > 8 * n) {
+            /* a few long spans, split the row at their edges and blend each piece with the largest coverage over it */
+            for(j = 0; j < n; j++) {
+                for(x = row[j]->x0, k = 2 * j; k > 0 && e[k - 1] > x; k--) e[k] = e[k - 1];
+                e[k] = x;
+                for(x = row[j]->x1 + 1, k = 2 * j + 1; k > 0 && e[k - 1] > x; k--) e[k] = e[k - 1];
+                e[k] = x;
+            }
+            for(k = 0; k < 2 * n - 1; k++) {
+                if(e[k] == e[k + 1]) continue;
+                for(j = x = 0; j < n; j++)
+                    if(row[j]->a > x && row[j]->x0 <= e[k] && row[j]->x1 >= e[k + 1] - 1) x = row[j]->a;
+                if(x) meg4_blendspan(d + (e[k] << 2), e[k + 1] - e[k], c[2] * x, c[1] * x, c[0] * x, 255 - x);
+            }
+        } else {
+            /* lots of spans or short ones, merge them in a coverage buffer, then blend the runs of equal coverage */
+            for(i = spanrow[y]; i >= 0; i = s->next) {
+                s = &spans[i];
+                if(s->x0 < xs) xs = s->x0;
+                if(s->x1 > xe) xe = s->x1;
+                for(x = s->x0; x <= s->x1; x++)
+                    if(cov[x] < s->a) cov[x] = s->a;
+            }
+            for(x = xs; x <= xe; x = k) {
+                j = cov[x]; cov[x] = 0;
+                for(k = x + 1; k <= xe && cov[k] == j; k++) cov[k] = 0;
+                if(j) meg4_blendspan(d + (x << 2), k - x, c[2] * j, c[1] * j, c[0] * j, 255 - j);
+            }
+        }
+    }
+    nspan = 0; spany0 = 400; spany1 = -1;
+}
+
+/**
+ * Add an anti-aliased line's pixels to the span buffer
+ */
+static void span_line(uint8_t *c, int x0, int y0, int x1, int y1)
+{
+    /* (coordinates here are signed, because the turtle might wander off screen) */
+    int sx = x0 < x1 ? 1 : -1, sy = y0 < y1 ? 1 : -1, x2, a;
+    int dx = abs(x1-x0), dy = abs(y1-y0), err = dx*dx+dy*dy;
+    int e2 = err == 0 ? 1 : 0xffff7fl/sqrt(err);
+
+    if(!c[3] || (x0 == x1 && y0 == y1)) return;
+    dx *= e2; dy *= e2; err = dx-dy;
+    while(1) {
+        a = err-dx+dy; if(a < 0) a = -a;
+        a = 255 - (a >> 16); a = a * c[3] / 255;
+        span_add(x0, x0, y0, a);
+        e2 = err; x2 = x0;
+        if(2*e2 >= -dx) {
+            if(x0 == x1) break;
+            if(e2+dy < 0xff0000l) {
+                a = 255 - ((e2+dy) >> 16); a = a * c[3] / 255;
+                span_add(x0, x0, y0 + sy, a);
+            }
+            err -= dy; x0 += sx;
+        }
+        if(2*e2 <= dy) {
+            if(y0 == y1) break;
+            if(dx-e2 < 0xff0000l) {
+                a = 255 - ((dx-e2) >> 16); a = a * c[3] / 255;
+                span_add(x2 + sx, x2 + sx, y0, a);
+            }
+            err += dx; y0 += sy;
+        }
     }
 }
 
@@ -1454,7 +2783,8 @@ static __inline__ void meg4_fill(uint16_t x0, uint16_t x1, uint16_t y, uint8_t *
  * Recursively calculate Bezier curve
  */
 static int bezx, bezy;
-static __inline__ void meg4_bezier(uint8_t palidx, int x0,int y0, int x1,int y1, int x2,int y2, int x3,int y3, int l)
+static void span_line(uint8_t *c, int x0, int y0, int x1, int y1);
+static __inline__ void meg4_bezier(uint8_t *c, int x0,int y0, int x1,int y1, int x2,int y2, int x3,int y3, int l)
 {
     int m0x, m0y, m1x, m1y, m2x, m2y, m3x, m3y, m4x, m4y,m5x, m5y;
     if(l < 8 && (x0 != x3 || y0 != y3)) {
@@ -1464,17 +2794,34 @@ static __inline__ void meg4_bezier(uint8_t palidx, int x0,int y0, int x1,int y1,
         m3x = ((m1x-m0x)/2) + m0x;  m3y = ((m1y-m0y)/2) + m0y;
         m4x = ((m2x-m1x)/2) + m1x;  m4y = ((m2y-m1y)/2) + m1y;
         m5x = ((m4x-m3x)/2) + m3x;  m5y = ((m4y-m3y)/2) + m3y;
-        meg4_bezier(palidx, x0,y0, m0x,m0y, m3x,m3y, m5x,m5y, l + 1);
-        meg4_bezier(palidx, m5x,m5y, m4x,m4y, m2x,m2y, x3,y3, l + 1);
+        meg4_bezier(c, x0,y0, m0x,m0y, m3x,m3y, m5x,m5y, l + 1);
+        meg4_bezier(c, m5x,m5y, m4x,m4y, m2x,m2y, x3,y3, l + 1);
     }
     if(l) {
         /* FIXME: we should use a specialized line drawing routine here that uses 8 bit fixed precision coordinates and
          * calculates alpha accordingly. This sticks the point to the pixel grid, thus loosing anti-alias details */
-        meg4_api_line(palidx, bezx >> 8, bezy >> 8, x3 >> 8, y3 >> 8);
+        span_line(c, bezx >> 8, bezy >> 8, x3 >> 8, y3 >> 8);
         bezx = x3; bezy = y3;
     }
 }
 
+/**
+ * Clear the vram and the z-buffer, the part of cls that the render thread replays
+ */
+static void gpu_cls(uint32_t bg)
+{
+    int i;
+
+    gpu_flush();
+    for(i = 0; i < 640 * 400; i++) meg4.vram[i] = bg;
+    if(zclear) {
+        zclear = 0;
+        memset(zbuf, 0, sizeof(zbuf));
+        memset(ztile, 0, sizeof(ztile));
+        memset(zdirty, 0, sizeof(zdirty));
+    }
+}
+
 /**
  * Clears the entire screen and resets display offsets, also sets the console's background color.
  * @param palidx color, palette index 0 to 255
@@ -1484,11 +2831,15 @@ void meg4_api_cls(uint8_t palidx)
 {
     uint32_t bg = (0xff << 24) | meg4.mmio.palette[(int)palidx], fg = meg4.mmio.palette[(int)meg4.mmio.conf];
     uint8_t c[4];
-    int i, j;
+    int j;
 
+    if(!gpu_defer(RND_CLS, NULL, (int)bg)) gpu_cls(bg);
     meg4.mmio.scrx = meg4.mmio.scry = meg4.mmio.conx = meg4.mmio.cony = 0;
-    meg4.screen.w = 320; meg4.screen.h = 200; meg4.screen.buf = meg4.vram;
-    for(i = 0; i < 640 * 400; i++) meg4.vram[i] = bg;
+    /* the recorded commands draw on the current screen, only wait for them if that changes */
+    if(meg4.screen.w != 320 || meg4.screen.h != 200 || meg4.screen.buf != meg4.vram) {
+        gpu_sync();
+        meg4.screen.w = 320; meg4.screen.h = 200; meg4.screen.buf = meg4.vram;
+    }
     /* set console's color either black or white depending if this clear color is bright or dark */
     meg4_conrst(); meg4.mmio.conb = palidx; c[3] = 0xff;
     j = ((fg & 0xff) + ((fg >> 8) & 0xff) + ((fg >> 16) & 0xff)) / 3;
@@ -1499,10 +2850,6 @@ void meg4_api_cls(uint8_t palidx)
         /* check if both background and foreground are bright */
         if(j >= 0x80) { c[0] = c[1] = c[2] = 0; meg4.mmio.conf = meg4_palidx(c); }
     }
-    if(zclear) {
-        zclear = 0;
-        memset(zbuf, 0, sizeof(zbuf));
-    }
 }
 
 /**
@@ -1514,6 +2861,7 @@ void meg4_api_cls(uint8_t palidx)
  */
 uint32_t meg4_api_cget(uint16_t x, uint16_t y)
 {
+    gpu_flush();
     return x < 640 && y < 400 ? le32toh(meg4.vram[y * 640 + x]) : 0;
 }
 
@@ -1526,6 +2874,7 @@ uint32_t meg4_api_cget(uint16_t x, uint16_t y)
  */
 uint8_t meg4_api_pget(uint16_t x, uint16_t y)
 {
+    gpu_flush();
     return x < 640 && y < 400 ? meg4_palidx((uint8_t*)&meg4.vram[y * 640 + x]) : 0;
 }
 
@@ -1539,6 +2888,8 @@ uint8_t meg4_api_pget(uint16_t x, uint16_t y)
 void meg4_api_pset(uint8_t palidx, uint16_t x, uint16_t y)
 {
     uint8_t *c = (uint8_t*)&meg4.mmio.palette[(int)palidx];
+    if(gpu_defer(RND_PSET, NULL, palidx, x, y)) return;
+    gpu_flush();
     if(x < 640 && y < 400)
         meg4_setpixel(x, y, c[0], c[1], c[2], c[3]);
 }
@@ -1552,8 +2903,13 @@ void meg4_api_pset(uint8_t palidx, uint16_t x, uint16_t y)
  */
 uint16_t meg4_api_width(int8_t type, str_t str)
 {
+    uint16_t ret;
     if(type < -4 || type > 4 || str < MEG4_MEM_USER || str >= MEG4_MEM_LIMIT) return 0;
-    return meg4_width(meg4.font, type, (char*)meg4.data + str - MEG4_MEM_USER, (char*)meg4.data + sizeof(meg4.data) - 1);
+    /* the width cache is shared with the render thread's text() */
+    gpu_lock();
+    ret = meg4_width(meg4.font, type, (char*)meg4.data + str - MEG4_MEM_USER, (char*)meg4.data + sizeof(meg4.data) - 1);
+    gpu_unlock();
+    return ret;
 }
 
 /**
@@ -1568,12 +2924,23 @@ uint16_t meg4_api_width(int8_t type, str_t str)
  * @see [width]
  */
 void meg4_api_text(uint8_t palidx, int16_t x, int16_t y, int8_t type, uint8_t shidx, uint8_t sha, str_t str)
+{
+    char *s;
+    if(str < MEG4_MEM_USER || str >= MEG4_MEM_LIMIT) return;
+    s = (char*)meg4.data + str - MEG4_MEM_USER;
+    if(gpu_defer(RND_TEXT, s, palidx, x, y, type, shidx, sha)) return;
+    gpu_text(palidx, x, y, type, shidx, sha, s);
+}
+
+/**
+ * Print a zero terminated string (when replayed, a copy of the one in user memory)
+ */
+static void gpu_text(uint8_t palidx, int16_t x, int16_t y, int8_t type, uint8_t shidx, uint8_t sha, char *str)
 {
     uint32_t shadow = shidx ? (meg4.mmio.palette[(int)shidx] & htole32(0xffffff)) | (sha << 24) : 0;
+    gpu_flush();
     if(!type) type = 1;
-    if(str < MEG4_MEM_USER || str >= MEG4_MEM_LIMIT) return;
-    meg4_text(meg4.vram, x, y, 2560, meg4.mmio.palette[(int)palidx], shadow, type, meg4.font,
-        (char*)meg4.data + str - MEG4_MEM_USER);
+    meg4_text(meg4.vram, x, y, 2560, meg4.mmio.palette[(int)palidx], shadow, type, meg4.font, str);
 }
 
 /**
@@ -1587,36 +2954,11 @@ void meg4_api_text(uint8_t palidx, int16_t x, int16_t y, int8_t type, uint8_t sh
  */
 void meg4_api_line(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t y1)
 {
-    /* (coordinates here are signed, because the turtle might wander off screen) */
     uint8_t *c = (uint8_t*)&meg4.mmio.palette[(int)palidx];
-    int sx = x0 < x1 ? 1 : -1, sy = y0 < y1 ? 1 : -1, x2, a;
-    int dx = abs(x1-x0), dy = abs(y1-y0), err = dx*dx+dy*dy;
-    int e2 = err == 0 ? 1 : 0xffff7fl/sqrt(err);
-
-    if(!c[3] || (x0 == x1 && y0 == y1)) return;
-    dx *= e2; dy *= e2; err = dx-dy;
-    while(1) {
-        a = err-dx+dy; if(a < 0) a = -a;
-        a = 255 - (a >> 16); a = a * c[3] / 255;
-        meg4_setpixel(x0, y0, c[0], c[1], c[2], a);
-        e2 = err; x2 = x0;
-        if(2*e2 >= -dx) {
-            if(x0 == x1) break;
-            if(e2+dy < 0xff0000l) {
-                a = 255 - ((e2+dy) >> 16); a = a * c[3] / 255;
-                meg4_setpixel(x0, y0 + sy, c[0], c[1], c[2], a);
-            }
-            err -= dy; x0 += sx;
-        }
-        if(2*e2 <= dy) {
-            if(y0 == y1) break;
-            if(dx-e2 < 0xff0000l) {
-                a = 255 - ((dx-e2) >> 16); a = a * c[3] / 255;
-                meg4_setpixel(x2 + sx, y0, c[0], c[1], c[2], a);
-            }
-            err += dx; y0 += sy;
-        }
-    }
+    if(gpu_defer(RND_LINE, NULL, palidx, x0, y0, x1, y1)) return;
+    gpu_flush();
+    span_line(c, x0, y0, x1, y1);
+    span_flush(c);
 }
 
 /**
@@ -1633,10 +2975,14 @@ void meg4_api_line(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t y
 void meg4_api_qbez(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t y1,
     int16_t cx, int16_t cy)
 {
-    if(((uint8_t*)&meg4.mmio.palette[(int)palidx])[3]) {
+    uint8_t *c = (uint8_t*)&meg4.mmio.palette[(int)palidx];
+    if(gpu_defer(RND_QBEZ, NULL, palidx, x0, y0, x1, y1, cx, cy)) return;
+    gpu_flush();
+    if(c[3]) {
         bezx = x0 << 8; bezy = y0 << 8;
-        meg4_bezier(palidx, x0 << 8, y0 << 8, (x0 << 8) + (((cx << 8) - (x0 << 8)) >> 1), (y0 << 8) + (((cy << 8) - (y0 << 8)) >> 1),
+        meg4_bezier(c, x0 << 8, y0 << 8, (x0 << 8) + (((cx << 8) - (x0 << 8)) >> 1), (y0 << 8) + (((cy << 8) - (y0 << 8)) >> 1),
             (cx << 8) + (((x1 << 8) - (cx << 8)) >> 1), (cy << 8) + (((y1 << 8) - (cy << 8)) >> 1), (x1 << 8), (y1 << 8), 0);
+        span_flush(c);
     }
 }
 
@@ -1656,9 +3002,13 @@ void meg4_api_qbez(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t y
 void meg4_api_cbez(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t y1,
     int16_t cx0, int16_t cy0, int16_t cx1, int16_t cy1)
 {
-    if(((uint8_t*)&meg4.mmio.palette[(int)palidx])[3]) {
+    uint8_t *c = (uint8_t*)&meg4.mmio.palette[(int)palidx];
+    if(gpu_defer(RND_CBEZ, NULL, palidx, x0, y0, x1, y1, cx0, cy0, cx1, cy1)) return;
+    gpu_flush();
+    if(c[3]) {
         bezx = x0 << 8; bezy = y0 << 8;
-        meg4_bezier(palidx, x0 << 8, y0 << 8, cx0 << 8, cy0 << 8, cx1 << 8, cy1 << 8, x1 << 8, y1 << 8, 0);
+        meg4_bezier(c, x0 << 8, y0 << 8, cx0 << 8, cy0 << 8, cx1 << 8, cy1 << 8, x1 << 8, y1 << 8, 0);
+        span_flush(c);
     }
 }
 
@@ -1675,10 +3025,14 @@ void meg4_api_cbez(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t y
  */
 void meg4_api_tri(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2)
 {
-    if(((uint8_t*)&meg4.mmio.palette[(int)palidx])[3]) {
-        meg4_api_line(palidx, x0, y0, x1, y1);
-        meg4_api_line(palidx, x1, y1, x2, y2);
-        meg4_api_line(palidx, x2, y2, x0, y0);
+    uint8_t *c = (uint8_t*)&meg4.mmio.palette[(int)palidx];
+    if(gpu_defer(RND_TRI, NULL, palidx, x0, y0, x1, y1, x2, y2)) return;
+    gpu_flush();
+    if(c[3]) {
+        span_line(c, x0, y0, x1, y1);
+        span_line(c, x1, y1, x2, y2);
+        span_line(c, x2, y2, x0, y0);
+        span_flush(c);
     }
 }
 
@@ -1699,8 +3053,13 @@ void meg4_api_ftri(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t y
     int i, j, h, s, xa, xb, y, d1, d2, d3;
     float a, b, ia, ib;
 
-    meg4_api_tri(palidx, x0, y0, x1, y1, x2, y2);
-    if(!c[3] || (y0 == y1 && y0 == y2) || (x0 == x1 && x0 == x2)) return;
+    if(gpu_defer(RND_FTRI, NULL, palidx, x0, y0, x1, y1, x2, y2)) return;
+    gpu_flush();
+    if(!c[3]) return;
+    span_line(c, x0, y0, x1, y1);
+    span_line(c, x1, y1, x2, y2);
+    span_line(c, x2, y2, x0, y0);
+    if((y0 == y1 && y0 == y2) || (x0 == x1 && x0 == x2)) { span_flush(c); return; }
     if(y0 > y1) { i = x0; x0 = x1; x1 = i; i = y0; y0 = y1; y1 = i; }
     if(y0 > y2) { i = x0; x0 = x2; x2 = i; i = y0; y0 = y2; y2 = i; }
     if(y1 > y2) { i = x1; x1 = x2; x2 = i; i = y1; y1 = y2; y2 = i; }
@@ -1711,8 +3070,9 @@ void meg4_api_ftri(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t y
         a = (float)i / (float)d3; ia = 1.0 - a; b = ((float)i - (float)(h ? d1 : 0)) / (float)s; ib = 1.0 - b;
         xa = ia * x0 + a * x2; xb = h ? ib * x1 + b * x2 : ib * x0 + b * x1;
         if(xa > xb) { j = xa; xa = xb; xb = j; }
-        meg4_fill(xa + 1, xb, y, c);
+        span_add(xa + 1, xb, y, c[3]);
     }
+    span_flush(c);
 }
 
 /**
@@ -1736,6 +3096,8 @@ void meg4_api_tri2d(uint8_t pi0, int16_t x0, int16_t y0,
     int i, j, k, l, m, h, s, x, xa, xb, xs, xe, y, d1, d2, d3;
     float a, b, ia, ib, g, ig;
 
+    if(gpu_defer(RND_TRI2D, NULL, pi0, x0, y0, pi1, x1, y1, pi2, x2, y2)) return;
+    gpu_flush();
     if((y0 == y1 && y0 == y2) || (x0 == x1 && x0 == x2)) return;
     if(y0 > y1) { i = x0; x0 = x1; x1 = i; i = y0; y0 = y1; y1 = i; i = pi0; pi0 = pi1; pi1 = i; }
     if(y0 > y2) { i = x0; x0 = x2; x2 = i; i = y0; y0 = y2; y2 = i; i = pi0; pi0 = pi2; pi2 = i; }
@@ -1788,12 +3150,16 @@ void meg4_api_tri3d(uint8_t pi0, int16_t x0, int16_t y0, int16_t z0,
     uint8_t pi1, int16_t x1, int16_t y1, int16_t z1,
     uint8_t pi2, int16_t x2, int16_t y2, int16_t z2)
 {
-    zclear = 1; nvert = nface = 0;
+    int b;
+
+    if(gpu_defer(RND_TRI3D, NULL, pi0, x0, y0, z0, pi1, x1, y1, z1, pi2, x2, y2, z2)) return;
+    zclear = 1;
+    if(!reserve(3, 1)) return;
+    b = nvert;
     vertex(x0/32767.0f, y0/32767.0f, z0/32767.0f);
     vertex(x1/32767.0f, y1/32767.0f, z1/32767.0f);
     vertex(x2/32767.0f, y2/32767.0f, z2/32767.0f);
-    face(0, pi0, 0, 0, 1, pi1, 0, 0, 2, pi2, 0, 0);
-    processtri(0);
+    face(b, pi0, 0, 0, b + 1, pi1, 0, 0, b + 2, pi2, 0, 0, 0);
 }
 
 /**
@@ -1819,16 +3185,21 @@ void meg4_api_tritx(uint8_t u0, uint8_t v0, int16_t x0, int16_t y0, int16_t z0,
     uint8_t u1, uint8_t v1, int16_t x1, int16_t y1, int16_t z1,
     uint8_t u2, uint8_t v2, int16_t x2, int16_t y2, int16_t z2)
 {
-    zclear = 1; nvert = nface = 0;
+    int b;
+
+    if(gpu_defer(RND_TRITX, NULL, u0, v0, x0, y0, z0, u1, v1, x1, y1, z1, u2, v2, x2, y2, z2)) return;
+    zclear = 1;
+    if(!reserve(3, 1)) return;
+    b = nvert;
     vertex(x0/32767.0f, y0/32767.0f, z0/32767.0f);
     vertex(x1/32767.0f, y1/32767.0f, z1/32767.0f);
     vertex(x2/32767.0f, y2/32767.0f, z2/32767.0f);
-    face(0, 0, u0, v0, 1, 0, u1, v1, 2, 0, u2, v2);
-    processtri(1);
+    face(b, 0, u0, v0, b + 1, 0, u1, v1, b + 2, 0, u2, v2, 1);
 }
 
 /**
  * Draws a mesh made of triangles in [3D space], using indeces to verticles and texture coordinates (or palette).
+ * Meshes entirely out of view and triangles facing away from the camera are skipped.
  * @param verts address of vertices array, 3 x 2 bytes each, X, Y, Z
  * @param uvs address of UVs array (if 0, then palette is used), 2 x 1 bytes each, texture X, Y
  * @param numtri number of triangles
@@ -1839,10 +3210,14 @@ void meg4_api_mesh(addr_t verts, addr_t uvs, uint16_t numtri, addr_t tris)
 {
     int16_t *vs, *v;
     uint8_t *uv, *tr, *ptr;
-    uint32_t i, mi;
+    uint32_t i, mi, hash = 2166136261U;
+    float mn[3], mx[3], d, sph[4];
+    meshcache_t *mc = NULL;
+    int n, b, fb, full = 1;
 
-    zclear = 1; nvert = nface = 0;
-    if(numtri > sizeof(faces)/sizeof(faces[0])) numtri = sizeof(faces)/sizeof(faces[0]);
+    /* the vertices are read from user memory, so this can't be recorded */
+    gpu_sync();
+    zclear = 1;
     if(verts < MEG4_MEM_USER || verts + 6 * 256 >= MEG4_MEM_LIMIT ||
       (uvs && (uvs < MEG4_MEM_USER || uvs + 512 >= MEG4_MEM_LIMIT)) ||
       tris < MEG4_MEM_USER || !numtri || tris + numtri * 6 >= MEG4_MEM_LIMIT) return;
@@ -1854,22 +3229,59 @@ void meg4_api_mesh(addr_t verts, addr_t uvs, uint16_t numtri, addr_t tris)
         if(ptr[2] > mi) mi = ptr[2];
         if(ptr[4] > mi) mi = ptr[4];
     }
-    /* add vertices */
     vs = (int16_t*)(meg4.data + verts - MEG4_MEM_USER);
+    uv = uvs ? (uint8_t*)(meg4.data + uvs - MEG4_MEM_USER) : NULL;
+    /* look up in the static mesh cache. The UVs are stored in the faces, so they must be hashed too */
+    for(i = 0, ptr = (uint8_t*)vs; i < (mi + 1) * 6; i++) hash = (hash ^ ptr[i]) * 16777619U;
+    for(i = 0, ptr = tr; i < (uint32_t)numtri * 6; i++) hash = (hash ^ ptr[i]) * 16777619U;
+    if(uv) for(i = 0; i < 512; i++) hash = (hash ^ uv[i]) * 16777619U;
+    for(i = 0; i < MESHCACHE; i++)
+        if(meshcache[i].nor && meshcache[i].verts == verts && meshcache[i].uvs == uvs && meshcache[i].tris == tris &&
+          meshcache[i].numtri == numtri && meshcache[i].hash == hash) { mc = &meshcache[i]; break; }
+    if(mc) memcpy(sph, mc->sph, sizeof(sph));
+    else {
+        /* calculate bounding sphere */
+        for(i = 0; i < 3; i++) mn[i] = mx[i] = vs[i] / 32767.0f;
+        for(i = 0, v = vs; i <= mi; i++, v += 3) {
+            if(v[0] / 32767.0f < mn[0]) { mn[0] = v[0] / 32767.0f; } if(v[0] / 32767.0f > mx[0]) { mx[0] = v[0] / 32767.0f; }
+            if(v[1] / 32767.0f < mn[1]) { mn[1] = v[1] / 32767.0f; } if(v[1] / 32767.0f > mx[1]) { mx[1] = v[1] / 32767.0f; }
+            if(v[2] / 32767.0f < mn[2]) { mn[2] = v[2] / 32767.0f; } if(v[2] / 32767.0f > mx[2]) { mx[2] = v[2] / 32767.0f; }
+        }
+        sph[0] = (mn[0] + mx[0]) / 2.0f; sph[1] = (mn[1] + mx[1]) / 2.0f; sph[2] = (mn[2] + mx[2]) / 2.0f; sph[3] = 0.0f;
+        for(i = 0, v = vs; i <= mi; i++, v += 3) {
+            mn[0] = v[0] / 32767.0f - sph[0]; mn[1] = v[1] / 32767.0f - sph[1]; mn[2] = v[2] / 32767.0f - sph[2];
+            d = mn[0] * mn[0] + mn[1] * mn[1] + mn[2] * mn[2];
+            if(d > sph[3]) sph[3] = d;
+        }
+        sph[3] = sqrtf(sph[3]);
+    }
+    /* reject the whole mesh if it's not visible at all */
+    if(frustum_cull(sph)) { perf_cullmesh++; return; }
+    if(!(n = reserve(mi + 1, numtri))) return;
+    if(n < numtri) { numtri = n; mc = NULL; full = 0; }
+    b = nvert; fb = nface;
+    /* add vertices */
     for(i = 0, v = vs; i <= mi; i++, v += 3)
         vertex(v[0]/32767.0f, v[1]/32767.0f, v[2]/32767.0f);
-    /* add triangle faces */
-    if(uvs) {
-        uv = (uint8_t*)(meg4.data + uvs - MEG4_MEM_USER);
-        for(i = 0, ptr = tr; i < numtri; i++, ptr += 6)
-            face(ptr[0], 0, uv[ptr[1] << 1], uv[(ptr[1] << 1) + 1],
-                 ptr[2], 0, uv[ptr[3] << 1], uv[(ptr[3] << 1) + 1],
-                 ptr[4], 0, uv[ptr[5] << 1], uv[(ptr[5] << 1) + 1]);
-        processtri(1);
-    } else {
-        for(i = 0, ptr = tr; i < numtri; i++, ptr += 6)
-            face(ptr[0], ptr[1], 0, 0, ptr[2], ptr[3], 0, 0, ptr[4], ptr[5], 0, 0);
-        processtri(0);
+    if(mc) meshcache_get(mc, b);
+    else {
+        /* add triangle faces */
+        if(uv) {
+            for(i = 0, ptr = tr; i < numtri; i++, ptr += 6)
+                face(b + ptr[0], 0, uv[ptr[1] << 1], uv[(ptr[1] << 1) + 1],
+                     b + ptr[2], 0, uv[ptr[3] << 1], uv[(ptr[3] << 1) + 1],
+                     b + ptr[4], 0, uv[ptr[5] << 1], uv[(ptr[5] << 1) + 1], 1);
+        } else {
+            for(i = 0, ptr = tr; i < numtri; i++, ptr += 6)
+                face(b + ptr[0], ptr[1], 0, 0, b + ptr[2], ptr[3], 0, 0, b + ptr[4], ptr[5], 0, 0, 0);
+        }
+        if(full) {
+            mc = &meshcache[meshlast]; meshlast = (meshlast + 1) % MESHCACHE;
+            if(meshcache_put(mc, b, fb)) {
+                mc->verts = verts; mc->uvs = uvs; mc->tris = tris; mc->numtri = numtri; mc->hash = hash;
+                memcpy(mc->sph, sph, sizeof(sph));
+            }
+        }
     }
 }
 
@@ -1885,33 +3297,19 @@ void meg4_api_mesh(addr_t verts, addr_t uvs, uint16_t numtri, addr_t tris)
 void meg4_api_rect(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t y1)
 {
     uint8_t *c = (uint8_t*)&meg4.mmio.palette[(int)palidx];
-    uint8_t *d;
-    int i, x, xs, xe, r, g, b;
-    if(c[3] && x0 < x1 && y0 < y1 && x0 < le16toh(meg4.mmio.cropx1) && x1 > le16toh(meg4.mmio.cropx0) &&
-      y0 < le16toh(meg4.mmio.cropy1) && y1 > le16toh(meg4.mmio.cropy0)) {
-        xs = x0 < le16toh(meg4.mmio.cropx0) ? le16toh(meg4.mmio.cropx0) : x0;
-        xe = x1 < le16toh(meg4.mmio.cropx1) ? x1 : le16toh(meg4.mmio.cropx1);
-        i = 255 - c[3]; r = c[0]*c[3]; g = c[1]*c[3]; b = c[2]*c[3];
-        if(y0 >= le16toh(meg4.mmio.cropy0) && y0 < le16toh(meg4.mmio.cropy1)) {
-            d = (uint8_t*)&meg4.vram[y0 * 640 + xs];
-            for(x = xs; x <= xe; x++, d += 4) { d[2] = (b + i*d[2]) >> 8; d[1] = (g + i*d[1]) >> 8; d[0] = (r + i*d[0]) >> 8; }
-        }
-        if(y1 >= le16toh(meg4.mmio.cropy0) && y1 < le16toh(meg4.mmio.cropy1)) {
-            d = (uint8_t*)&meg4.vram[y1 * 640 + xs];
-            for(x = xs; x <= xe; x++, d += 4) { d[2] = (b + i*d[2]) >> 8; d[1] = (g + i*d[1]) >> 8; d[0] = (r + i*d[0]) >> 8; }
-        }
-        xs = y0 < le16toh(meg4.mmio.cropy0) ? le16toh(meg4.mmio.cropy0) : y0;
-        xe = y1 < le16toh(meg4.mmio.cropy1) ? y1 : le16toh(meg4.mmio.cropy1);
-        for(x = xs + 1; x < xe; x++) {
-            if(x0 >= le16toh(meg4.mmio.cropx0) && x0 < le16toh(meg4.mmio.cropy1)) {
-                d = (uint8_t*)&meg4.vram[x * 640 + x0];
-                d[2] = (b + i*d[2]) >> 8; d[1] = (g + i*d[1]) >> 8; d[0] = (r + i*d[0]) >> 8;
-            }
-            if(x1 >= le16toh(meg4.mmio.cropx0) && x1 < le16toh(meg4.mmio.cropx1)) {
-                d = (uint8_t*)&meg4.vram[x * 640 + x1];
-                d[2] = (b + i*d[2]) >> 8; d[1] = (g + i*d[1]) >> 8; d[0] = (r + i*d[0]) >> 8;
-            }
+    int y, ye;
+    if(gpu_defer(RND_RECT, NULL, palidx, x0, y0, x1, y1)) return;
+    gpu_flush();
+    if(c[3] && x0 < x1 && y0 < y1) {
+        span_add(x0, x1, y0, c[3]);
+        span_add(x0, x1, y1, c[3]);
+        y = y0 < le16toh(meg4.mmio.cropy0) ? le16toh(meg4.mmio.cropy0) - 1 : y0;
+        ye = y1 < le16toh(meg4.mmio.cropy1) ? y1 : le16toh(meg4.mmio.cropy1);
+        for(y++; y < ye; y++) {
+            span_add(x0, x0, y, c[3]);
+            span_add(x1, x1, y, c[3]);
         }
+        span_flush(c);
     }
 }
 
@@ -1927,19 +3325,15 @@ void meg4_api_rect(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t y
 void meg4_api_frect(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t y1)
 {
     uint8_t *c = (uint8_t*)&meg4.mmio.palette[(int)palidx];
-    uint8_t *d;
-    int i, x, xs, xe, y, ys, ye, r, g, b;
-    if(c[3] && x0 < x1 && y0 < y1 && x0 < le16toh(meg4.mmio.cropx1) && x1 > le16toh(meg4.mmio.cropx0) &&
-      y0 < le16toh(meg4.mmio.cropy1) && y1 > le16toh(meg4.mmio.cropy0)) {
-        xs = x0 < le16toh(meg4.mmio.cropx0) ? le16toh(meg4.mmio.cropx0) : x0;
-        xe = x1 < le16toh(meg4.mmio.cropx1) ? x1 : le16toh(meg4.mmio.cropx1);
-        ys = y0 < le16toh(meg4.mmio.cropy0) ? le16toh(meg4.mmio.cropy0) : y0;
-        ye = y1 < le16toh(meg4.mmio.cropy1) ? y1 : le16toh(meg4.mmio.cropy1);
-        i = 255 - c[3]; r = c[0]*c[3]; g = c[1]*c[3]; b = c[2]*c[3];
-        for(y = ys; y <= ye; y++) {
-            d = (uint8_t*)&meg4.vram[y * 640 + xs];
-            for(x = xs; x <= xe; x++, d += 4) { d[2] = (b + i*d[2]) >> 8; d[1] = (g + i*d[1]) >> 8; d[0] = (r + i*d[0]) >> 8; }
-        }
+    int y, ye;
+    if(gpu_defer(RND_FRECT, NULL, palidx, x0, y0, x1, y1)) return;
+    gpu_flush();
+    if(c[3] && x0 < x1 && y0 < y1) {
+        y = y0 < le16toh(meg4.mmio.cropy0) ? le16toh(meg4.mmio.cropy0) : y0;
+        ye = y1 < le16toh(meg4.mmio.cropy1) ? y1 : le16toh(meg4.mmio.cropy1) - 1;
+        for(; y <= ye; y++)
+            span_add(x0, x1, y, c[3]);
+        span_flush(c);
     }
 }
 
@@ -1955,39 +3349,42 @@ void meg4_api_circ(uint8_t palidx, int16_t x, int16_t y, uint16_t r)
 {
     uint8_t *c = (uint8_t*)&meg4.mmio.palette[(int)palidx];
     int x1 = -r, y1 = 0, a, x2, e2, err = 2-2*r;
+    if(gpu_defer(RND_CIRC, NULL, palidx, x, y, r)) return;
+    gpu_flush();
     if(r > 0) {
         r = 1-err;
         do {
             a = err-2*(x1+y1)-2; if(a < 0) a = -a;
             a = 255 * a / r; a = (255 - a) * c[3] / 255;
-            meg4_setpixel(x - x1, y + y1, c[0], c[1], c[2], a);
-            meg4_setpixel(x - y1, y - x1, c[0], c[1], c[2], a);
-            meg4_setpixel(x + x1, y - y1, c[0], c[1], c[2], a);
-            meg4_setpixel(x + y1, y + x1, c[0], c[1], c[2], a);
+            span_add(x - x1, x - x1, y + y1, a);
+            span_add(x - y1, x - y1, y - x1, a);
+            span_add(x + x1, x + x1, y - y1, a);
+            span_add(x + y1, x + y1, y + x1, a);
             e2 = err; x2 = x1;
             if(err+y1 > 0) {
                 a = 255*(err-2*x1-1)/r; a = (255 - a) * c[3] / 255;
                 if(a > 0) {
-                    meg4_setpixel(x - x1, y + y1 + 1, c[0], c[1], c[2], a);
-                    meg4_setpixel(x - y1 - 1, y - x1, c[0], c[1], c[2], a);
-                    meg4_setpixel(x + x1, y - y1 - 1, c[0], c[1], c[2], a);
-                    meg4_setpixel(x + y1 + 1, y + x1, c[0], c[1], c[2], a);
+                    span_add(x - x1, x - x1, y + y1 + 1, a);
+                    span_add(x - y1 - 1, x - y1 - 1, y - x1, a);
+                    span_add(x + x1, x + x1, y - y1 - 1, a);
+                    span_add(x + y1 + 1, x + y1 + 1, y + x1, a);
                 }
                 err += ++x1*2+1;
             }
             if(e2+x2 <= 0) {
                 a = 255*(2*y1+3-e2)/r; a = (255 - a) * c[3] / 255;
                 if(a > 0) {
-                    meg4_setpixel(x - x2 - 1, y + y1, c[0], c[1], c[2], a);
-                    meg4_setpixel(x - y1, y - x2 - 1, c[0], c[1], c[2], a);
-                    meg4_setpixel(x + x2 + 1, y - y1, c[0], c[1], c[2], a);
-                    meg4_setpixel(x + y1, y + x2 + 1, c[0], c[1], c[2], a);
+                    span_add(x - x2 - 1, x - x2 - 1, y + y1, a);
+                    span_add(x - y1, x - y1, y - x2 - 1, a);
+                    span_add(x + x2 + 1, x + x2 + 1, y - y1, a);
+                    span_add(x + y1, x + y1, y + x2 + 1, a);
                 }
                 err += ++y1*2+1;
             }
         } while(x1 < 0);
     } else
-    meg4_setpixel(x, y, c[0], c[1], c[2], c[3]);
+        span_add(x, x, y, c[3]);
+    span_flush(c);
 }
 
 /**
@@ -2002,35 +3399,38 @@ void meg4_api_fcirc(uint8_t palidx, int16_t x, int16_t y, uint16_t r)
 {
     uint8_t *c = (uint8_t*)&meg4.mmio.palette[(int)palidx];
     int x1 = -r, y1 = 0, a, x2, e2, err = 2-2*r;
+    if(gpu_defer(RND_FCIRC, NULL, palidx, x, y, r)) return;
+    gpu_flush();
     if(r < 2)
-        meg4_setpixel(x, y, c[0], c[1], c[2], c[3]);
+        span_add(x, x, y, c[3]);
     if(r > 0) {
         r = 1-err;
         do {
             a = err-2*(x1+y1)-2; if(a < 0) a = -a;
             a = 255 * a / r; a = (255 - a) * c[3] / 255;
-            meg4_setpixel(x - x1, y + y1, c[0], c[1], c[2], a);
-            meg4_setpixel(x - y1, y - x1, c[0], c[1], c[2], a);
-            meg4_setpixel(x + x1, y - y1, c[0], c[1], c[2], a);
-            meg4_setpixel(x + y1, y + x1, c[0], c[1], c[2], a);
+            span_add(x - x1, x - x1, y + y1, a);
+            span_add(x - y1, x - y1, y - x1, a);
+            span_add(x + x1, x + x1, y - y1, a);
+            span_add(x + y1, x + y1, y + x1, a);
             if(x1) {
-                meg4_fill(x + x1 + 1, x - x1 - 1, y + y1, c);
-                meg4_fill(x + x1 + 1, x - x1 - 1, y - y1, c);
+                span_add(x + x1 + 1, x - x1 - 1, y + y1, c[3]);
+                span_add(x + x1 + 1, x - x1 - 1, y - y1, c[3]);
             }
             e2 = err; x2 = x1;
             if(err+y1 > 0) {
                 a = 255*(err-2*x1-1)/r; a = (255 - a) * c[3] / 255;
                 if(a > 0) {
-                    meg4_setpixel(x - x1, y + y1 + 1, c[0], c[1], c[2], a);
-                    meg4_setpixel(x - y1 - 1, y - x1, c[0], c[1], c[2], a);
-                    meg4_setpixel(x + x1, y - y1 - 1, c[0], c[1], c[2], a);
-                    meg4_setpixel(x + y1 + 1, y + x1, c[0], c[1], c[2], a);
+                    span_add(x - x1, x - x1, y + y1 + 1, a);
+                    span_add(x - y1 - 1, x - y1 - 1, y - x1, a);
+                    span_add(x + x1, x + x1, y - y1 - 1, a);
+                    span_add(x + y1 + 1, x + y1 + 1, y + x1, a);
                 }
                 err += ++x1*2+1;
             }
             if(e2+x2 <= 0) err += ++y1*2+1;
         } while(x1 < 0);
     }
+    span_flush(c);
 }
 
 /**
@@ -2049,6 +3449,8 @@ void meg4_api_ellip(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t
     float dx = 4*(a-1.0)*b*b, dy = 4*(b1+1)*a*a;
     float ed, i, err = b1*a*a-dx+dy;
 
+    if(gpu_defer(RND_ELLIP, NULL, palidx, x0, y0, x1, y1)) return;
+    gpu_flush();
     if(!c[3]) return;
     if(a == 0 || b == 0) { meg4_api_line(palidx, x0,y0, x1,y1); return; }
     if(x0 > x1) { x0 = x1; x1 += a; }
@@ -2062,30 +3464,30 @@ void meg4_api_ellip(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t
         else ed = 255/(ed+2*ed*i*i/(4*ed*ed+i*i));
         i = ed*fabsf(err+dx-dy); A = (255 - (int)i) * c[3] / 255;
         if(A > 0) {
-            meg4_setpixel(x0, y0, c[0], c[1], c[2], A);
-            meg4_setpixel(x0, y1, c[0], c[1], c[2], A);
-            meg4_setpixel(x1, y0, c[0], c[1], c[2], A);
-            meg4_setpixel(x1, y1, c[0], c[1], c[2], A);
+            span_add(x0, x0, y0, A);
+            span_add(x0, x0, y1, A);
+            span_add(x1, x1, y0, A);
+            span_add(x1, x1, y1, A);
         }
         if((f = (2*err+dy >= 0))) {
             if(x0 >= x1) break;
             i = ed*(err+dx);
             if(i < 255) {
                 A = (255 - (int)i) * c[3] / 255;
-                meg4_setpixel(x0, y0 + 1, c[0], c[1], c[2], A);
-                meg4_setpixel(x0, y1 - 1, c[0], c[1], c[2], A);
-                meg4_setpixel(x1, y0 + 1, c[0], c[1], c[2], A);
-                meg4_setpixel(x1, y1 - 1, c[0], c[1], c[2], A);
+                span_add(x0, x0, y0 + 1, A);
+                span_add(x0, x0, y1 - 1, A);
+                span_add(x1, x1, y0 + 1, A);
+                span_add(x1, x1, y1 - 1, A);
             }
         }
         if(2*err <= dx) {
             i = ed*(dy-err);
             if(i < 255) {
                 A = (255 - (int)i) * c[3] / 255;
-                meg4_setpixel(x0 + 1, y0, c[0], c[1], c[2], A);
-                meg4_setpixel(x1 - 1, y0, c[0], c[1], c[2], A);
-                meg4_setpixel(x0 + 1, y1, c[0], c[1], c[2], A);
-                meg4_setpixel(x1 - 1, y0, c[0], c[1], c[2], A);
+                span_add(x0 + 1, x0 + 1, y0, A);
+                span_add(x1 - 1, x1 - 1, y0, A);
+                span_add(x0 + 1, x0 + 1, y1, A);
+                span_add(x1 - 1, x1 - 1, y1, A);
             }
             y0++; y1--; err += dy += a;
         }
@@ -2095,13 +3497,14 @@ void meg4_api_ellip(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t
         while(y0-y1 < b) {
             i = 255*4*fabsf(err+dx)/b1; ++y0; --y1; A = (255 - (int)i) * c[3] / 255;
             if(A > 0) {
-                meg4_setpixel(x0, y0, c[0], c[1], c[2], A);
-                meg4_setpixel(x0, y1, c[0], c[1], c[2], A);
-                meg4_setpixel(x1, y0, c[0], c[1], c[2], A);
-                meg4_setpixel(x1, y1, c[0], c[1], c[2], A);
+                span_add(x0, x0, y0, A);
+                span_add(x0, x0, y1, A);
+                span_add(x1, x1, y0, A);
+                span_add(x1, x1, y1, A);
             }
             err += dy += a;
         }
+    span_flush(c);
 }
 
 /**
@@ -2120,6 +3523,8 @@ void meg4_api_fellip(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t
     float dx = 4*(a-1.0)*b*b, dy = 4*(b1+1)*a*a;
     float ed, i, err = b1*a*a-dx+dy;
 
+    if(gpu_defer(RND_FELLIP, NULL, palidx, x0, y0, x1, y1)) return;
+    gpu_flush();
     if(!c[3]) return;
     if(a == 0 || b == 0) { meg4_api_line(palidx, x0,y0, x1,y1); return; }
     if(x0 > x1) { x0 = x1; x1 += a; }
@@ -2133,32 +3538,32 @@ void meg4_api_fellip(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t
         else ed = 255/(ed+2*ed*i*i/(4*ed*ed+i*i));
         i = ed*fabsf(err+dx-dy); A = (255 - (int)i) * c[3] / 255;
         if(A > 0) {
-            meg4_setpixel(x0, y0, c[0], c[1], c[2], A);
-            meg4_setpixel(x0, y1, c[0], c[1], c[2], A);
-            meg4_setpixel(x1, y0, c[0], c[1], c[2], A);
-            meg4_setpixel(x1, y1, c[0], c[1], c[2], A);
+            span_add(x0, x0, y0, A);
+            span_add(x0, x0, y1, A);
+            span_add(x1, x1, y0, A);
+            span_add(x1, x1, y1, A);
         }
-        meg4_fill(x0 + 1, x1 - 1, y0, c);
-        meg4_fill(x0 + 1, x1 - 1, y1, c);
+        span_add(x0 + 1, x1 - 1, y0, c[3]);
+        span_add(x0 + 1, x1 - 1, y1, c[3]);
         if((f = (2*err+dy >= 0))) {
             if(x0 >= x1) break;
             i = ed*(err+dx);
             if(i < 255) {
                 A = (255 - (int)i) * c[3] / 255;
-                meg4_setpixel(x0, y0 + 1, c[0], c[1], c[2], A);
-                meg4_setpixel(x0, y1 - 1, c[0], c[1], c[2], A);
-                meg4_setpixel(x1, y0 + 1, c[0], c[1], c[2], A);
-                meg4_setpixel(x1, y1 - 1, c[0], c[1], c[2], A);
+                span_add(x0, x0, y0 + 1, A);
+                span_add(x0, x0, y1 - 1, A);
+                span_add(x1, x1, y0 + 1, A);
+                span_add(x1, x1, y1 - 1, A);
             }
         }
         if(2*err <= dx) {
             i = ed*(dy-err);
             if(i < 255) {
                 A = (255 - (int)i) * c[3] / 255;
-                meg4_setpixel(x0 + 1, y0, c[0], c[1], c[2], A);
-                meg4_setpixel(x1 - 1, y0, c[0], c[1], c[2], A);
-                meg4_setpixel(x0 + 1, y1, c[0], c[1], c[2], A);
-                meg4_setpixel(x1 - 1, y0, c[0], c[1], c[2], A);
+                span_add(x0 + 1, x0 + 1, y0, A);
+                span_add(x1 - 1, x1 - 1, y0, A);
+                span_add(x0 + 1, x0 + 1, y1, A);
+                span_add(x1 - 1, x1 - 1, y1, A);
             }
             y0++; y1--; err += dy += a;
         }
@@ -2168,13 +3573,14 @@ void meg4_api_fellip(uint8_t palidx, int16_t x0, int16_t y0, int16_t x1, int16_t
         while(y0-y1 < b) {
             i = 255*4*fabsf(err+dx)/b1; ++y0; --y1; A = (255 - (int)i) * c[3] / 255;
             if(A > 0) {
-                meg4_setpixel(x0, y0, c[0], c[1], c[2], A);
-                meg4_setpixel(x0, y1, c[0], c[1], c[2], A);
-                meg4_setpixel(x1, y0, c[0], c[1], c[2], A);
-                meg4_setpixel(x1, y1, c[0], c[1], c[2], A);
+                span_add(x0, x0, y0, A);
+                span_add(x0, x0, y1, A);
+                span_add(x1, x1, y0, A);
+                span_add(x1, x1, y1, A);
             }
             err += dy += a;
         }
+    span_flush(c);
 }
 
 /**
@@ -2288,6 +3694,8 @@ void meg4_api_back(uint16_t cnt)
 void meg4_api_spr(int16_t x, int16_t y, uint16_t sprite, uint8_t sw, uint8_t sh, int8_t scale, uint8_t type)
 {
     int i, j, k, m, l, s, siz[] = { 1, 2, 4, 0, 8, 16, 24, 32 }, X, Y;
+    if(gpu_defer(RND_SPR, NULL, x, y, sprite, sw, sh, scale, type)) return;
+    gpu_flush();
     if(sprite > 1023 || sw < 1 || sh < 1 || scale < -3 || scale > 4 || type > 7) return;
     s = siz[(!scale ? 1 : scale) + 3];
     m = 32 - (sprite & 31); if(sw < m) m = sw;
@@ -2329,6 +3737,8 @@ void meg4_api_dlg(int16_t x, int16_t y, uint16_t w, uint16_t h, int8_t scale,
     uint16_t bl, uint16_t bm, uint16_t br)
 {
     int i, j, k, l, x0, x1, y0, y1, s, siz[] = { 1, 2, 4, 0, 8, 16, 24, 32 };
+    if(gpu_defer(RND_DLG, NULL, x, y, w, h, scale, tl, tm, tr, ml, bg, mr, bl, bm, br)) return;
+    gpu_flush();
     if(scale < -3 || scale > 4) return;
     s = siz[(!scale ? 1 : scale) + 3];
     if(x + s >= le16toh(meg4.mmio.cropx1) || y + s >= le16toh(meg4.mmio.cropy1) || w > 640 - 2 * s || h > 400 - 2 * s ||
@@ -2375,15 +3785,27 @@ void meg4_api_dlg(int16_t x, int16_t y, uint16_t w, uint16_t h, int8_t scale,
  * @see [spr], [dlg]
  */
 void meg4_api_stext(int16_t x, int16_t y, uint16_t fs, uint16_t fu, uint8_t sw, uint8_t sh, int8_t scale, str_t str)
+{
+    char *t;
+
+    if(str < MEG4_MEM_USER || str >= MEG4_MEM_LIMIT) return;
+    t = (char*)meg4.data + str - MEG4_MEM_USER;
+    if(gpu_defer(RND_STEXT, t, x, y, fs, fu, sw, sh, scale)) return;
+    gpu_stext(x, y, fs, fu, sw, sh, scale, t);
+}
+
+/**
+ * Display a zero terminated string using sprites (when replayed, a copy of the one in user memory)
+ */
+static void gpu_stext(int16_t x, int16_t y, uint16_t fs, uint16_t fu, uint8_t sw, uint8_t sh, int8_t scale, char *t)
 {
     uint32_t c;
-    char *end, *t;
+    char *end;
     int l, s, siz[] = { 1, 2, 4, 0, 8, 16, 24, 32 };
 
-    if(x >= le16toh(meg4.mmio.cropx1) || y >= le16toh(meg4.mmio.cropy1) || fs > 1023 || sw < 1 || sh < 1 || scale < -3 || scale > 4 ||
-      str < MEG4_MEM_USER || str >= MEG4_MEM_LIMIT) return;
-    t = (char*)meg4.data + str - MEG4_MEM_USER;
-    if(!*t) return;
+    gpu_flush();
+    if(x >= le16toh(meg4.mmio.cropx1) || y >= le16toh(meg4.mmio.cropy1) || fs > 1023 || sw < 1 || sh < 1 || scale < -3 ||
+      scale > 4 || !*t) return;
     s = siz[(!scale ? 1 : scale) + 3];
     /* force a maximum number of characters to display just in case */
     l = strlen(t); if(l > 256) { l = 256; } end = t + l;
@@ -2409,6 +3831,7 @@ void meg4_api_stext(int16_t x, int16_t y, uint16_t fs, uint16_t fu, uint8_t sw,
  */
 void meg4_api_remap(addr_t replace)
 {
+    gpu_flush();
     if(replace < MEG4_MEM_USER || replace >= MEG4_MEM_LIMIT - 256) return;
     meg4_remap(meg4.data + replace - MEG4_MEM_USER);
 }
@@ -2436,6 +3859,7 @@ void meg4_api_mset(uint16_t mx, uint16_t my, uint16_t sprite)
 {
     uint16_t val = htole16(sprite);
     if(mx >= 320 || my >= 200 || sprite >= 0x3ff) return;
+    gpu_sync();
     meg4.mmio.mapsel = val >> 8;
     meg4.mmio.map[my * 320 + mx] = val & 0xff;
 }
@@ -2454,6 +3878,8 @@ void meg4_api_mset(uint16_t mx, uint16_t my, uint16_t sprite)
 void meg4_api_map(int16_t x, int16_t y, uint16_t mx, uint16_t my, uint16_t mw, uint16_t mh, int8_t scale)
 {
     int i, j, k, l, s, siz[] = { 1, 2, 4, 0, 8, 16, 24, 32 };
+    if(gpu_defer(RND_MAP, NULL, x, y, mx, my, mw, mh, scale)) return;
+    gpu_flush();
     if(x >= le16toh(meg4.mmio.cropx1) || y >= le16toh(meg4.mmio.cropy1) || scale < -3 || scale > 4) return;
     if(mw < 1) mw = 320;
     if(mh < 1) mh = 200;
@@ -2467,6 +3893,133 @@ void meg4_api_map(int16_t x, int16_t y, uint16_t mx, uint16_t my, uint16_t mw, u
                     meg4_spr(meg4.vram, 2560, l, y, le16toh((meg4.mmio.mapsel << 8) | meg4.mmio.map[k + i]), scale, 0);
 }
 
+/**
+ * Get a texel from the sprites' mipmap at a given level of detail (sprite sheet index)
+ */
+static uint32_t mip_texel(int idx, int lod)
+{
+    return *(uint32_t*)(meg4.mipmap + mipoff[lod] + (((((idx >> 8) >> lod) << (8 - lod)) + ((idx & 255) >> lod)) << 2));
+}
+
+/* maze rendering is split into independent jobs for the workers, first bands of floor and ceiling rows, then bands of
+ * columns with the walls and the sprites. Everything a job needs is stored here */
+#define SPRMAX 512
+#define MAZE_ROWS 8
+#define MAZE_COLS 32
+typedef struct { float rY; int ti, z, j, l, s, e, cx, cy; uint16_t o, d; } maze_prj_t;
+static struct {
+    float dirX, dirY, planeX, planeY, dX, dY, zb[640];
+    int x0, x1, y0, y1, w, h, hh, mw, mh, mx, my, scale, ts, tw, tn, tb, si, sky, grd, door, wall, obj, mip, nspr;
+    uint32_t *inp;
+    maze_prj_t spr[SPRMAX];
+} mz;
+
+/**
+ * Draw a band of maze floor rows and the mirrored ceiling rows
+ */
+static void maze_rows(int job)
+{
+    float rd, fX, fY, sX, sY, rX;
+    int i, j, x, y, z, p, l, e, cx, cy, ti, lod = 0;
+
+    for(y = mz.hh + job * MAZE_ROWS, e = y + MAZE_ROWS < mz.h ? y + MAZE_ROWS : mz.h; y < e; y++) {
+        p = y * 640; l = (2 * mz.hh - 1 - y) * 640;
+        rd = (float)mz.hh / (float)(y - mz.hh + 1);
+        sX = rd * mz.dX; sY = rd * mz.dY;
+        if(mz.mip) {
+            /* texels per pixel, along the row or between rows, whichever is larger */
+            fX = fabsf(sX) > fabsf(sY) ? fabsf(sX) : fabsf(sY); rX = rd / (float)(y - mz.hh + 1); if(rX > fX) fX = rX;
+            fX *= (float)mz.ts; lod = fX < 2.0f ? 0 : (fX < 4.0f ? 1 : (fX < 8.0f ? 2 : 3));
+        }
+        fX = posX + rd * (mz.dirX - mz.planeX) + (float)mz.x0 * sX;
+        fY = posY + rd * (mz.dirY - mz.planeY) + (float)mz.x0 * sY;
+        for(x = mz.x0; x < mz.x1; x++, fX += sX, fY += sY) {
+            cx = (int)(fX < 0.0 ? -1.0 : fX); cy = (int)(fY < 0.0 ? -1.0 : fY);
+            z = mz.h - y - 1;
+            i = (((int)(mz.ts * (fY - (float)cy)) & (mz.ts - 1)) << 8) + ((int)(mz.ts * (fX - (float)cx)) & (mz.ts - 1));
+            if(y >= mz.y0 && y < mz.y1) {
+                j = cx >= 0 && cx < mz.mh && cy >= 0 && cy < mz.mw ? meg4.mmio.map[(mz.my + cx) * 320 + cy + mz.mx] : mz.grd;
+                if(j < 1 || j >= mz.obj || (j >= mz.door && j < mz.wall)) j = mz.grd;
+                if(j > 0 && j < mz.wall) {
+                    ti = ((j >> (5 - mz.scale)) << (mz.scale + 11)) + ((j & (mz.tw - 1)) << (mz.scale + 3)) + mz.tb;
+                    meg4.screen.buf[p + x] = lod ? mip_texel(i + ti, lod) : meg4.mmio.palette[meg4.mmio.sprites[i + ti]];
+                }
+            }
+            if(mz.sky && z >= mz.y0 && z < mz.y1)
+                meg4.screen.buf[l + x] = lod ? mip_texel(i + mz.si, lod) : meg4.mmio.palette[meg4.mmio.sprites[i + mz.si]];
+        }
+    }
+}
+
+/**
+ * Draw a band of maze columns, walls and then the sprites back to front
+ */
+static void maze_cols(int job)
+{
+    float rd, dX, dY, fX, sX, sY, rX, rY;
+    int i, j, k, s, e, l, x, y, n, p, cx, cy, tx, ty, ti, lod, xs, xe;
+    maze_prj_t *q;
+    uint32_t c;
+    uint8_t *a, *b;
+
+    xs = mz.x0 + job * MAZE_COLS; xe = xs + MAZE_COLS < mz.x1 ? xs + MAZE_COLS : mz.x1;
+    for(x = xs; x < xe; x++) {
+        cx = (int)posX; cy = (int)posY;
+        rd = (float)(x << 1) / (float)mz.w - 1; rX = mz.dirX + rd * mz.planeX; rY = mz.dirY + rd * mz.planeY;
+        dX = (rX == 0.0 || rX == -0.0) ? 65536.0 : fabsf(1 / rX);
+        dY = (rY == 0.0 || rY == -0.0) ? 65536.0 : fabsf(1 / rY);
+        if(rX < 0.0) { tx = -1; sX = (posX - (float)cx) * dX; } else { tx = 1; sX = ((float)cx + 1.0 - posX) * dX; }
+        if(rY < 0.0) { ty = -1; sY = (posY - (float)cy) * dY; } else { ty = 1; sY = ((float)cy + 1.0 - posY) * dY; }
+        i = cx >= 0 && cx < mz.mh && cy >= 0 && cy < mz.mw ? meg4.mmio.map[(cx + mz.my) * 320 + cy + mz.mx] : 0;
+        n = (i >= mz.door && i < mz.wall) ? mz.wall : mz.door;
+        j = sX >= sY ? 1 : 0; mz.zb[x] = 65536.0;
+        while(cx >= 0 && cx < mz.mh && cy >= 0 && cy < mz.mw) {
+            i = meg4.mmio.map[(cx + mz.my) * 320 + cy + mz.mx];
+            if(i >= n && i < mz.obj) {
+                mz.zb[x] = rd = j ? sY - dY : sX - dX;
+                if(i >= mz.tn) break;
+                l = (int)((float)mz.h / rd) >> 1;
+                s = -l + mz.hh; if(s < mz.y0) s = mz.y0;
+                e = l + mz.hh;  if(e >= mz.y1) e = mz.y1 - 1;
+                ti = ((i >> (5 - mz.scale)) << (mz.scale + 11)) + ((i & (mz.tw - 1)) << (mz.scale + 3)) + mz.tb;
+                fX = j ? posX + rd * rX : posY + rd * rY; fX -= (int)fX;
+                tx = (int)(fX * (float)mz.ts); if((!j && rX > 0.0) || (j && rY < 0.0)) tx = mz.ts - tx - 1;
+                n = l << 1;
+                /* texels per pixel is the tile size per wall height */
+                lod = !mz.mip || mz.ts < 2 * n ? 0 : (mz.ts < 4 * n ? 1 : (mz.ts < 8 * n ? 2 : 3));
+                for(y = s, p = s * 640; y < e; y++, p += 640) {
+                    ty = (((y - mz.hh + l) << (mz.scale + 11)) / n) & 0xffffff00;
+                    c = lod ? mip_texel(ty + tx + ti, lod) : meg4.mmio.palette[meg4.mmio.sprites[ty + tx + ti]];
+                    if(j) { c >>= 1; c &= 0x7F7F7F; }
+                    meg4.screen.buf[p + x] = c;
+                }
+                break;
+            }
+            if(sX < sY) { sX += dX; cx += tx; j = 0; } else { sY += dY; cy += ty; j = 1; }
+            n = mz.door;
+        }
+    }
+    for(k = 0, q = mz.spr; k < mz.nspr; k++, q++)
+        for(x = q->cx < xs ? xs : q->cx; x < q->cy && x < xe; x++) {
+            tx = (((x - q->cx) << (mz.scale + 11)) / q->j) >> 8;
+            if(q->rY < mz.zb[x]) {
+                /* set the MSB of tile id in array if the NPC can see the player and they are close */
+                if(x == q->z && mz.inp && q->o != 0xffff) {
+                    y = q->o * 3 + 2;
+                    if(q->d < 64) mz.inp[y] |= htole32(0x80000000); /* distance is less than 8 tiles */
+                    if(q->d < 16) mz.inp[y] |= htole32(0x40000000); /* distance is less than 4 tiles */
+                    if(q->d <  4) mz.inp[y] |= htole32(0x20000000); /* distance is less than 2 tiles */
+                    if(q->d <  2) mz.inp[y] |= htole32(0x10000000); /* they are on the same or neightbouring tiles */
+                }
+                for(y = q->s, p = q->s * 640; y < q->e; y++, p += 640) {
+                    ty = (((y - mz.hh + q->l)  << (mz.scale + 11)) / q->j) & 0xffffff00;
+                    a = (uint8_t*)&meg4.screen.buf[p + x]; b = (uint8_t*)&meg4.mmio.palette[meg4.mmio.sprites[ty + tx + q->ti]];
+                    if(b[3] > 0) { i = 255 - b[3]; a[0] = (a[0]*i + b[0]*b[3]) >> 8; a[1] = (a[1]*i + b[1]*b[3]) >> 8; a[2] = (a[2]*i + b[2]*b[3]) >> 8; }
+                }
+            }
+        }
+}
+
 /**
  * Displays map as a 3D maze, using turtle's position.
  * @param mx X coordinate on map in tiles
@@ -2486,22 +4039,26 @@ void meg4_api_map(int16_t x, int16_t y, uint16_t mx, uint16_t my, uint16_t mw, u
 void meg4_api_maze(uint16_t mx, uint16_t my, uint16_t mw, uint16_t mh, uint8_t scale,
     uint16_t sky, uint16_t grd, uint16_t door, uint16_t wall, uint16_t obj, uint8_t numnpc, addr_t npc)
 {
-#define SPRMAX 512
     float dirX = -1.0, dirY = 0.0, planeX = 0.0, planeY = 0.66;
-    float rd, dX, dY, fX, fY, sX, sY, rX, rY, zb[640];
+    float rd, dX, fX, fY, rX, rY;
     int x0 = le16toh(meg4.mmio.cropx0), x1 = le16toh(meg4.mmio.cropx1), y0 = le16toh(meg4.mmio.cropy0), y1 = le16toh(meg4.mmio.cropy1);
-    int i, j, s, e, l, x, y, z, n, p, w = meg4.screen.w, h = meg4.screen.h, hw = w / 2, hh = h / 2, cx, cy, tx, ty, ts, tw, tn, tb, ti, si;
+    int i, j, s, e, l, x, y, z, n, w = meg4.screen.w, h = meg4.screen.h, hw = w / 2, hh = h / 2, cx, cy, tx, ty, ts, tw, tn, tb;
+    int cnt[576];
+    uint16_t ord[SPRMAX];
     maze_spr_t spr[SPRMAX];
-    uint32_t *inp, c;
-    uint8_t *a, *b;
+    maze_prj_t *q;
+    uint32_t *inp;
 
     /* this code originally from Lode's raycasting tutorial, but heavily rewritten an optimized. Unfortunately Lode fucked up
      * the coordinates and I'm too lazy to fix all his calculations. Quick'n'dirty workaround: transpoze the map instead */
 
+    gpu_flush();
     if(mx >= 320 || my >= 200 || scale > 3) return;
     if(mx + mw > 320) mw = 320 - mx;
     if(my + mh > 200) mh = 200 - my;
     if(mw < 1 || mh < 1) return;
+    mz.mip = !(meg4.mmio.texflags & 1);
+    if(mz.mip && mipdirty) mip_refresh();
     if(wall < 1) wall = 1;
     if(!door || door > wall) door = wall;
     if(obj < wall) obj = 1024;
@@ -2509,7 +4066,7 @@ void meg4_api_maze(uint16_t mx, uint16_t my, uint16_t mw, uint16_t mh, uint8_t s
     if(sky >= tn) sky = 0;
     if(grd >= tn) grd = 0;
     tb = scale ? 0 : (meg4.mmio.mapsel & 1) * 256 * 64;
-    si = ((sky >> (5 - scale)) << (scale + 11)) + ((sky & (tw - 1)) << (scale + 3)) + tb;
+    mz.si = ((sky >> (5 - scale)) << (scale + 11)) + ((sky & (tw - 1)) << (scale + 3)) + tb;
 
     /* failsafe, make sure turtle is on the map, on a walkable tile */
     if(le16toh(meg4.mmio.turtlex) >= ((mw + 1) << 7) || le16toh(meg4.mmio.turtley) >= ((mh + 1) << 7) ||
@@ -2529,65 +4086,10 @@ void meg4_api_maze(uint16_t mx, uint16_t my, uint16_t mw, uint16_t mh, uint8_t s
     fY = meg4_api_cos(le16toh(meg4.mmio.turtlea + 180)); fX = meg4_api_sin(le16toh(meg4.mmio.turtlea + 180));
     dX = dirX; dirX = dirX * fX - dirY * fY; dirY = dX * fY + dirY * fX;
     dX = planeX; planeX = planeX * fX - planeY * fY; planeY = dX * fY + planeY * fX;
-
-    /* ceiling and floor */
-    dX = ((dirX + planeX) - (dirX - planeX)) / (float)w;
-    dY = ((dirY + planeY) - (dirY - planeY)) / (float)w;
-    for(y = hh, p = hh * 640, l = p - 640; y < h; y++, p += 640, l -= 640) {
-        rd = (float)hh / (float)(y - hh + 1);
-        sX = rd * dX; sY = rd * dY;
-        fX = posX + rd * (dirX - planeX) + (float)x0 * sX;
-        fY = posY + rd * (dirY - planeY) + (float)x0 * sY;
-        for(x = x0; x < x1; x++, fX += sX, fY += sY) {
-            cx = (int)(fX < 0.0 ? -1.0 : fX); cy = (int)(fY < 0.0 ? -1.0 : fY);
-            z = h - y - 1; i = (((int)(ts * (fY - (float)cy)) & (ts - 1)) << 8) + ((int)(ts * (fX - (float)cx)) & (ts - 1));
-            if(y >= y0 && y < y1) {
-                j = cx >= 0 && cx < mh && cy >= 0 && cy < mw ? meg4.mmio.map[(my + cx) * 320 + cy + mx] : grd;
-                if(j < 1 || j >= obj || (j >= door && j < wall)) j = grd;
-                if(j > 0 && j < (int)wall) {
-                    ti = ((j >> (5 - scale)) << (scale + 11)) + ((j & (tw - 1)) << (scale + 3)) + tb;
-                    meg4.screen.buf[p + x] = meg4.mmio.palette[meg4.mmio.sprites[i + ti]];
-                }
-            }
-            if(sky && z >= y0 && z < y1)
-                meg4.screen.buf[l + x] = meg4.mmio.palette[meg4.mmio.sprites[i + si]];
-        }
-    }
-
-    /* walls */
-    for(x = x0; x < x1; x++) {
-        cx = (int)posX; cy = (int)posY;
-        rd = (float)(x << 1) / (float)w - 1; rX = dirX + rd * planeX; rY = dirY + rd * planeY;
-        dX = (rX == 0.0 || rX == -0.0) ? 65536.0 : fabsf(1 / rX);
-        dY = (rY == 0.0 || rY == -0.0) ? 65536.0 : fabsf(1 / rY);
-        if(rX < 0.0) { tx = -1; sX = (posX - (float)cx) * dX; } else { tx = 1; sX = ((float)cx + 1.0 - posX) * dX; }
-        if(rY < 0.0) { ty = -1; sY = (posY - (float)cy) * dY; } else { ty = 1; sY = ((float)cy + 1.0 - posY) * dY; }
-        i = cx >= 0 && cx < mh && cy >= 0 && cy < mw ? meg4.mmio.map[(cx + my) * 320 + cy + mx] : 0;
-        n = (i >= (int)door && i < (int)wall) ? wall : door;
-        j = sX >= sY ? 1 : 0; zb[x] = 65536.0;
-        while(cx >= 0 && cx < mh && cy >= 0 && cy < mw) {
-            i = meg4.mmio.map[(cx + my) * 320 + cy + mx];
-            if(i >= n && i < obj) {
-                zb[x] = rd = j ? sY - dY : sX - dX;
-                if(i >= tn) break;
-                l = (int)((float)h / rd) >> 1;
-                s = -l + hh; if(s < y0) s = y0;
-                e = l + hh;  if(e >= y1) e = y1 - 1;
-                ti = ((i >> (5 - scale)) << (scale + 11)) + ((i & (tw - 1)) << (scale + 3)) + tb;
-                fX = j ? posX + rd * rX : posY + rd * rY; fX -= (int)fX;
-                tx = (int)(fX * (float)ts); if((!j && rX > 0.0) || (j && rY < 0.0)) tx = ts - tx - 1;
-                n = l << 1;
-                for(y = s, p = s * 640; y < e; y++, p += 640) {
-                    ty = (((y - hh + l) << (scale + 11)) / n) & 0xffffff00;
-                    c = meg4.mmio.palette[meg4.mmio.sprites[ty + tx + ti]]; if(j) { c >>= 1; c &= 0x7F7F7F; }
-                    meg4.screen.buf[p + x] = c;
-                }
-                break;
-            }
-            if(sX < sY) { sX += dX; cx += tx; j = 0; } else { sY += dY; cy += ty; j = 1; }
-            n = door;
-        }
-    }
+    mz.dirX = dirX; mz.dirY = dirY; mz.planeX = planeX; mz.planeY = planeY;
+    mz.x0 = x0; mz.x1 = x1; mz.y0 = y0; mz.y1 = y1; mz.w = w; mz.h = h; mz.hh = hh;
+    mz.mw = mw; mz.mh = mh; mz.mx = mx; mz.my = my; mz.scale = scale; mz.ts = ts; mz.tw = tw; mz.tn = tn; mz.tb = tb;
+    mz.sky = sky; mz.grd = grd; mz.door = door; mz.wall = wall; mz.obj = obj;
 
     /* sprites */
     n = 0; inp = NULL;
@@ -2627,41 +4129,39 @@ void meg4_api_maze(uint16_t mx, uint16_t my, uint16_t mw, uint16_t mh, uint8_t s
                 }
             }
     }
+    /* sort them back to front. The distance is small, so a stable bucket sort instead of a qsort */
+    memset(cnt, 0, sizeof(cnt));
+    for(i = 0; i < n; i++) cnt[spr[i].d]++;
+    for(i = 575, j = 0; i >= 0; i--) { z = cnt[i]; cnt[i] = j; j += z; }
+    for(i = 0; i < n; i++) ord[cnt[spr[i].d]++] = i;
+    /* project the visible ones to the screen */
+    mz.nspr = 0; mz.inp = inp;
     if(n > 0) {
-        qsort(spr, n, sizeof(maze_spr_t), mazecmp);
         rd = 1.0 / (planeX * dirY - dirX * planeY);
-        for(i = 0; i < n; i++) {
-            ti = ((spr[i].id >> (5 - scale)) << (scale + 11)) + ((spr[i].id & (tw - 1)) << (scale + 3)) + tb;
-            fX = spr[i].x - posX; fY = spr[i].y - posY;
+        for(i = 0, q = mz.spr; i < n; i++) {
+            x = ord[i];
+            fX = spr[x].x - posX; fY = spr[x].y - posY;
             rX = rd * (dirY * fX - dirX * fY); rY = rd * (-planeY * fX + planeX * fY);
             if(rY > 0) {
-                z = (int)((float)hw * (1 + rX / rY)); j = (int)((float)h / rY); if(j < 0) { j = -j; } l = j >> 1;
-                s = -l + hh; if(s < y0) s = y0;
-                e = l + hh;  if(e >= y1) e = y1 - 1;
-                cy = l + z; if(cy >= x1) cy = x1 - 1;
-                cx = -l + z;
-                for(x = cx < x0 ? x0 : cx; x < cy; x++) {
-                    tx = (((x - cx) << (scale + 11)) / j) >> 8;
-                    if(rY < zb[x]) {
-                        /* set the MSB of tile id in array if the NPC can see the player and they are close */
-                        if(x == z && inp && spr[i].o != 0xffff) {
-                            y = spr[i].o * 3 + 2;
-                            if(spr[i].d < 64) inp[y] |= htole32(0x80000000); /* distance is less than 8 tiles */
-                            if(spr[i].d < 16) inp[y] |= htole32(0x40000000); /* distance is less than 4 tiles */
-                            if(spr[i].d <  4) inp[y] |= htole32(0x20000000); /* distance is less than 2 tiles */
-                            if(spr[i].d <  2) inp[y] |= htole32(0x10000000); /* they are on the same or neightbouring tiles */
-                        }
-                        for(y = s, p = s * 640; y < e; y++, p += 640) {
-                            ty = (((y - hh + l)  << (scale + 11)) / j) & 0xffffff00;
-                            a = (uint8_t*)&meg4.screen.buf[p + x]; b = (uint8_t*)&meg4.mmio.palette[meg4.mmio.sprites[ty + tx + ti]];
-                            if(b[3] > 0) { si = 255 - b[3]; a[0] = (a[0]*si + b[0]*b[3]) >> 8; a[1] = (a[1]*si + b[1]*b[3]) >> 8; a[2] = (a[2]*si + b[2]*b[3]) >> 8; }
-                        }
-                    }
-                }
+                q->ti = ((spr[x].id >> (5 - scale)) << (scale + 11)) + ((spr[x].id & (tw - 1)) << (scale + 3)) + tb;
+                q->z = z = (int)((float)hw * (1 + rX / rY)); j = (int)((float)h / rY); if(j < 0) { j = -j; } l = j >> 1;
+                q->s = -l + hh; if(q->s < y0) q->s = y0;
+                q->e = l + hh;  if(q->e >= y1) q->e = y1 - 1;
+                q->cy = l + z; if(q->cy >= x1) q->cy = x1 - 1;
+                q->cx = -l + z;
+                q->j = j; q->l = l; q->rY = rY; q->o = spr[x].o; q->d = spr[x].d;
+                q++; mz.nspr++;
             }
         }
     }
 
+    /* ceiling and floor */
+    mz.dX = ((dirX + planeX) - (dirX - planeX)) / (float)w;
+    mz.dY = ((dirY + planeY) - (dirY - planeY)) / (float)w;
+    if(h > hh) gpu_parallel(maze_rows, (h - hh + MAZE_ROWS - 1) / MAZE_ROWS, 1);
+    /* walls and sprites */
+    if(x1 > x0) gpu_parallel(maze_cols, (x1 - x0 + MAZE_COLS - 1) / MAZE_COLS, 1);
+
     /* navigate in the maze */
     if(meg4_api_getpad(0, MEG4_BTN_U) || meg4_api_getpad(0, MEG4_BTN_D)) {
         rd = (le32toh(meg4.mmio.tick) - meg4_lasttick) / 1000.0 * (float)(le16toh(meg4.mmio.mazew)) * (meg4_api_getpad(0, MEG4_BTN_D) ? -1 : 1);
@@ -2706,3 +4206,156 @@ void meg4_api_maze(uint16_t mx, uint16_t my, uint16_t mw, uint16_t mh, uint8_t s
     if(meg4_api_getpad(0, MEG4_BTN_L)) meg4_api_left(i); else
     if(meg4_api_getpad(0, MEG4_BTN_R)) meg4_api_right(i);
 }
+
+/**
+ * Returns a pointer to a rectangular area of palette indeces, either on the map, on the sprites or in the user memory
+ */
+static uint8_t *blt_mem(addr_t addr, int pitch, int w, int h)
+{
+    uint32_t end = addr + (h - 1) * pitch + w;
+    if(w < 1 || h < 1 || (h > 1 && w > pitch)) return NULL;
+    if(addr >= 0x600 && end <= sizeof(meg4.mmio)) return (uint8_t*)&meg4.mmio + addr;
+    if(addr >= MEG4_MEM_USER && end <= MEG4_MEM_LIMIT) return meg4.data + addr - MEG4_MEM_USER;
+    return NULL;
+}
+
+/**
+ * Clip a destination rectangle on the vram to the crop area, returns the source offsets in ox, oy
+ */
+static int blt_crop(int *x, int *y, int *w, int *h, int *ox, int *oy)
+{
+    int X0 = le16toh(meg4.mmio.cropx0), X1 = le16toh(meg4.mmio.cropx1), Y0 = le16toh(meg4.mmio.cropy0);
+    int Y1 = le16toh(meg4.mmio.cropy1);
+
+    if(X1 > 640) X1 = 640;
+    if(Y1 > 400) Y1 = 400;
+    if(*x < X0) { *ox += X0 - *x; *w -= X0 - *x; *x = X0; }
+    if(*y < Y0) { *oy += Y0 - *y; *h -= Y0 - *y; *y = Y0; }
+    if(*x + *w > X1) *w = X1 - *x;
+    if(*y + *h > Y1) *h = Y1 - *y;
+    return *w > 0 && *h > 0;
+}
+
+/**
+ * Copies a rectangular area on the screen, the areas may overlap. The source can be anywhere in the 640 x 400 video
+ * memory, not just on the displayed part.
+ * @param dx destination X coordinate in pixels
+ * @param dy destination Y coordinate in pixels
+ * @param sx source X coordinate in pixels
+ * @param sy source Y coordinate in pixels
+ * @param w width in pixels
+ * @param h height in pixels
+ * @see [blitscr], [blitmem], [blitfill]
+ */
+void meg4_api_blit(int16_t dx, int16_t dy, int16_t sx, int16_t sy, uint16_t w, uint16_t h)
+{
+    int X = dx, Y = dy, SX = sx, SY = sy, W = w, H = h, j, p = 640;
+    uint32_t *d, *s;
+
+    if(gpu_defer(RND_BLIT, NULL, dx, dy, sx, sy, w, h)) return;
+    gpu_flush();
+    /* the source can be anywhere in the vram, not just in the crop area */
+    if(SX < 0) { X -= SX; W += SX; SX = 0; }
+    if(SY < 0) { Y -= SY; H += SY; SY = 0; }
+    if(SX + W > 640) W = 640 - SX;
+    if(SY + H > 400) H = 400 - SY;
+    if(W < 1 || H < 1 || !blt_crop(&X, &Y, &W, &H, &SX, &SY)) return;
+    d = meg4.vram + Y * 640 + X; s = meg4.vram + SY * 640 + SX;
+    /* when scrolling down, copy the bottom rows first so that the source is not overwritten before it's copied */
+    if(Y > SY) { d += (H - 1) * 640; s += (H - 1) * 640; p = -640; }
+    for(j = 0; j < H; j++, d += p, s += p)
+        memmove(d, s, W * sizeof(uint32_t));
+}
+
+/**
+ * Copies a rectangular area of palette indeces from memory to the screen.
+ * @param x X coordinate in pixels
+ * @param y Y coordinate in pixels
+ * @param src source address, on the map, on the sprites or in the user memory
+ * @param sp source pitch, bytes per line
+ * @param w width in pixels
+ * @param h height in pixels
+ * @param key color key, palette index not drawn, or -1 to draw all
+ * @param pal address of an array of 256 palette indeces to remap colors, or 0
+ * @see [blit], [blitmem], [blitfill]
+ */
+void meg4_api_blitscr(int16_t x, int16_t y, addr_t src, uint16_t sp, uint16_t w, uint16_t h, int16_t key, addr_t pal)
+{
+    uint32_t lut[256], m = htole32(0xff000000), *d;
+    uint8_t op[256], idx[256], *s, *r = NULL, *c, *a;
+    int X = x, Y = y, W = w, H = h, ox = 0, oy = 0, i, j, A, all = 1;
+
+    /* the map and the sprites only change after a sync, but the user memory could be overwritten before the replay */
+    if(src < MEG4_MEM_USER && !pal && gpu_defer(RND_BLITSCR, NULL, x, y, (int)src, sp, w, h, key, 0)) return;
+    gpu_flush();
+    if(!(s = blt_mem(src, sp, w, h)) || (pal && !(r = blt_mem(pal, 256, 256, 1))) ||
+      !blt_crop(&X, &Y, &W, &H, &ox, &oy)) return;
+    /* resolve color key, remap and palette once, so that the row kernel is just a table lookup */
+    for(i = 0; i < 256; i++) {
+        idx[i] = r ? r[i] : i; c = (uint8_t*)&meg4.mmio.palette[(int)idx[i]];
+        op[i] = i == key || !c[3] ? 0 : (c[3] == 255 ? 1 : 2);
+        lut[i] = meg4.mmio.palette[(int)idx[i]] & ~m;
+        if(op[i] != 1) all = 0;
+    }
+    s += oy * sp + ox; d = meg4.vram + Y * 640 + X;
+    for(j = 0; j < H; j++, s += sp, d += 640)
+        if(all)
+            for(i = 0; i < W; i++) d[i] = (d[i] & m) | lut[s[i]];
+        else
+            for(i = 0; i < W; i++)
+                switch(op[s[i]]) {
+                    case 1: d[i] = (d[i] & m) | lut[s[i]]; break;
+                    case 2:
+                        c = (uint8_t*)&meg4.mmio.palette[(int)idx[s[i]]]; a = (uint8_t*)&d[i]; A = 255 - c[3];
+                        a[2] = (c[2]*c[3] + A*a[2]) >> 8; a[1] = (c[1]*c[3] + A*a[1]) >> 8; a[0] = (c[0]*c[3] + A*a[0]) >> 8;
+                    break;
+                }
+}
+
+/**
+ * Copies a rectangular area of palette indeces in memory, the areas may overlap.
+ * @param dst destination address, on the map, on the sprites or in the user memory
+ * @param dp destination pitch, bytes per line
+ * @param src source address, on the map, on the sprites or in the user memory
+ * @param sp source pitch, bytes per line
+ * @param w width in bytes
+ * @param h height in lines
+ * @param key color key, palette index not copied, or -1 to copy all
+ * @param pal address of an array of 256 palette indeces to remap colors, or 0
+ * @see [blit], [blitscr], [blitfill]
+ */
+void meg4_api_blitmem(addr_t dst, uint16_t dp, addr_t src, uint16_t sp, uint16_t w, uint16_t h, int16_t key, addr_t pal)
+{
+    uint8_t tab[256], *d, *s, *r = NULL;
+    int D = dp, S = sp, W = w, i, j;
+
+    if(!(d = blt_mem(dst, dp, w, h)) || !(s = blt_mem(src, sp, w, h)) || (pal && !(r = blt_mem(pal, 256, 256, 1))))
+        return;
+    for(i = 0; i < 256; i++) tab[i] = r ? r[i] : i;
+    if(dst < MEG4_MEM_USER) { gpu_flush(); gpu_dirty(dst, (h - 1) * dp + w); }
+    /* copy backwards if the destination is after the source, so that overlapping areas work */
+    if(dst > src) { d += (h - 1) * D; s += (h - 1) * S; D = -D; S = -S; }
+    for(j = 0; j < h; j++, d += D, s += S)
+        if(key < 0 && !r) memmove(d, s, W); else
+        if(dst > src) { for(i = W - 1; i >= 0; i--) if(s[i] != key) d[i] = tab[s[i]]; }
+        else { for(i = 0; i < W; i++) if(s[i] != key) d[i] = tab[s[i]]; }
+}
+
+/**
+ * Fills a rectangular area in memory with a palette index.
+ * @param dst destination address, on the map, on the sprites or in the user memory
+ * @param dp destination pitch, bytes per line
+ * @param w width in bytes
+ * @param h height in lines
+ * @param palidx value to set, palette index 0 to 255
+ * @see [blit], [blitscr], [blitmem], [frect]
+ */
+void meg4_api_blitfill(addr_t dst, uint16_t dp, uint16_t w, uint16_t h, uint8_t palidx)
+{
+    uint8_t *d;
+    int j;
+
+    if(!(d = blt_mem(dst, dp, w, h))) return;
+    if(dst < MEG4_MEM_USER) { gpu_flush(); gpu_dirty(dst, (h - 1) * dp + w); }
+    for(j = 0; j < h; j++, d += dp) memset(d, palidx, w);
+}
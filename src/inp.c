@@ -424,7 +424,9 @@ normal:
                 case MEG4_KEY_F8: meg4_switchmode(MEG4_MODE_OVERLAY); return;
                 case MEG4_KEY_F9: meg4_switchmode(MEG4_MODE_VISUAL); return;
                 case MEG4_KEY_F10: meg4_switchmode(MEG4_MODE_DEBUG); return;
-                case MEG4_KEY_F12: meg4_takescreenshot = 1; return;
+                case MEG4_KEY_F12:
+                    meg4_takescreenshot = meg4_api_getkey(MEG4_KEY_LSHIFT) || meg4_api_getkey(MEG4_KEY_RSHIFT) ? 2 : 1;
+                return;
 #endif
             }
         }
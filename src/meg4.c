@@ -197,6 +197,7 @@ static void meg4_free(void)
         if(meg4.ovls[i].data) free(meg4.ovls[i].data);
     dsp_free();
     cpu_free();
+    gpu_free();
     memset(&meg4, 0, sizeof(meg4_t));
 }
 
@@ -410,7 +411,6 @@ void meg4_insert(char *name, uint8_t *buf, int len)
 /**
  * Switch operating mode
  */
-extern meg4_dsp_t *dsp;
 void meg4_switchmode(int mode)
 {
     int i;
@@ -421,6 +421,8 @@ void meg4_switchmode(int mode)
     meg4.mmio.kbdhead = meg4.mmio.kbdtail = meg4.mmio.kbdkeys[0] = 0;
     textinp_free();
     if(mode < 0 || mode >= MEG4_NUM_MODE || mode == meg4.mode) return;
+    /* the editors read and write the screen directly, let the render thread finish the game's frame first */
+    gpu_sync();
     /* free old mode's resources */
     switch(meg4.mode) {
         case MEG4_MODE_LOAD: load_free(); break;
@@ -453,8 +455,7 @@ void meg4_switchmode(int mode)
              &meg4_edicons.w, &meg4_edicons.h, &i, 4);
         meg4.mmio.cropx0 = meg4.mmio.cropy0 = 0; meg4.mmio.cropx1 = htole16(640); meg4.mmio.cropy1 = htole16(400);
         menu_scroll = menu_scrmax = 0;
-        memset(&meg4.dalt, 0, sizeof(meg4.dalt));
-        dsp = &meg4.dalt;
+        dsp_select(1);
     } else {
         if(meg4_defwaves) { free(meg4_defwaves); meg4_defwaves = NULL; }
         if(meg4_edicons.buf) { free(meg4_edicons.buf); memset(&meg4_edicons, 0, sizeof(meg4_edicons)); }
@@ -462,7 +463,7 @@ void meg4_switchmode(int mode)
         meg4.mmio.cropx0 = oldx0; meg4.mmio.cropx1 = oldx1;
         meg4.mmio.cropy0 = oldy0; meg4.mmio.cropy1 = oldy1;
         meg4.mmio.scrx = oldsx; meg4.mmio.scry = oldsy;
-        dsp = &meg4.dram;
+        dsp_select(0);
     }
     /* enter new mode */
     switch(meg4.mode) {
@@ -515,6 +516,7 @@ void meg4_run(void)
 #endif
     /* calculate how many msecs were unspent in the last frame, make sure not to overflow */
     i = 1000/60 - (le32toh(meg4.mmio.tick) - meg4_lasttick); meg4.mmio.perf = i < -127 ? -127 : i;
+    gpu_perf();
 #ifndef NOEDITORS
     if(meg4.mode != MEG4_MODE_GAME) {
         /* clear the editors' screen */
@@ -553,6 +555,7 @@ void meg4_run(void)
 #endif
     {
         cpu_run();
+        gpu_frame();
     }
     meg4_lasttick = le32toh(meg4.mmio.tick);
 }
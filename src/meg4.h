@@ -82,8 +82,14 @@ typedef struct {
     int8_t   camfov;                        /* 004A8 camera field of view */
     uint8_t  lsc;                           /* 004A9 light source color (palette index) */
     int16_t  lspx, lspy, lspz;              /* 004AA light source position */
-    uint8_t  mbz2[10];                      /* reserved for future GPU use */
+    uint16_t culltri;                       /* 004B0 number of back-facing triangles culled in the last frame */
+    uint16_t cullmesh;                      /* 004B2 number of meshes culled by the view frustum in the last frame */
+    uint8_t  texflags;                      /* 004B4 3D texture flags (bit 0: no mipmaps) */
+    uint8_t  oamnum;                        /* 004B5 number of objects in the sprite layer (0 turns it off) */
+    uint16_t oamptr;                        /* 004B6 object attribute table's address in user memory divided by 16 */
+    uint8_t  oamcnt;                        /* 004B8 number of objects composited in the last frame */
     /* DSP */
+    uint8_t  dsp_voices;                    /* 004B9 number of voices mixed in the last audio buffer */
     uint8_t  dsp_ticks;                     /* 004BA current tempo */
     uint8_t  dsp_track;                     /* 004BB current track being played */
     uint16_t dsp_row;                       /* 004BC current row being played */
@@ -108,6 +114,7 @@ meg4_mmio_t;
 #endif
 #define MEG4_MEM_USER  0x30000              /* sizeof(meg4.mmio) + 0x10000 */
 #define MEG4_MEM_LIMIT 0xC0000              /* sizeof(meg4.mmio) + 0x10000 + sizeof(meg4.data) */
+#define MEG4_OAM_MAX   128                  /* maximum number of objects in the sprite layer */
 
 /* mouse and gamepad buttons */
 #define MEG4_BTN_L   1                      /* mouse left button, gamepad left */
@@ -231,6 +238,11 @@ typedef struct {
     uint16_t num;                           /* number of total rows in track */
     int tick[2];                            /* Current tick in row */
     float sample[2];                        /* Current sample in tick */
+    uint16_t live;                          /* Active voices bitmask (channels that need mixing) */
+    uint16_t srow;                          /* Next row to be decoded from the music stream */
+    uint32_t spos;                          /* Read position in the compressed music stream */
+    uint8_t  scnt, srep;                    /* Stream decoder state, bytes left from packet and is it a repeat packet */
+    uint8_t  ring[16][16];                  /* Decoded music stream rows (ring buffer, a few rows ahead) */
 } meg4_dsp_t;
 
 /* GPU pixel buffer */
@@ -245,6 +257,13 @@ typedef struct {
     uint8_t *data;                          /* buffer data */
 } meg4_ovl_t;
 
+/* music stream, compressed rows played after a music track's last row */
+typedef struct {
+    uint32_t offs;                          /* offset in the stream pool */
+    uint32_t size;                          /* compressed size */
+    uint16_t rows;                          /* number of rows */
+} meg4_strm_t;
+
 /* main MEG-4 context */
 typedef struct {
     meg4_pixbuf_t screen;                   /* screen, buf not allocated, points into vram */
@@ -261,6 +280,9 @@ typedef struct {
 #endif
     uint8_t waveforms[31][16384];           /* waveforms */
     uint8_t tracks[8][16384];               /* music tracks */
+    meg4_strm_t strm[8];                    /* music track streams */
+    uint32_t strmlen;                       /* used bytes in stream pool */
+    uint8_t strmpool[131072];               /* stream pool, compressed rows */
     uint8_t data[576 * 1024];               /* freely usable ram */
     uint32_t *code, code_len;               /* compiled bytecode and length */
     uint8_t  code_type;                     /* bytecode's type */
@@ -581,7 +603,20 @@ void dsp_init(void);
 void dsp_free(void);
 void dsp_reset(void);
 void dsp_genwave(int idx, int wave);
+void dsp_select(int alt);
+void dsp_master(int channel, int volume);
+void dsp_rewind(int channel);
+uint32_t dsp_status(int channel);
+int  dsp_stream(int track, uint8_t *data, int len, int rows);
+int  dsp_packstream(int track, uint8_t *rows, int num);
+int  dsp_unpackstream(int track, uint8_t *rows);
 void meg4_audiofeed(float *buf, int len);
+void meg4_audiobuf(int samples, int periods);
+void meg4_audiogetbuf(int *samples, int *periods);
+void meg4_audioresampler(int quality);
+void meg4_audiounderrun(void);
+int  meg4_audiooffline(int type, int idx);
+int  meg4_audiorender(float *buf, int len);
 void meg4_api_sfx(uint8_t sfx, uint8_t channel, uint8_t volume);
 void meg4_api_music(uint8_t track, uint16_t row, uint8_t volume);
 #ifndef NOEDITORS
@@ -594,6 +629,15 @@ int meg4_api_gpio_get(uint8_t pin);
 int meg4_api_gpio_set(uint8_t pin, int value);
 
 /* gpu.c - graphics and screen output */
+void gpu_free(void);
+void gpu_perf(void);
+void gpu_flush(void);
+void gpu_sync(void);
+void gpu_frame(void);
+void gpu_dirty(addr_t dst, uint32_t len);
+void meg4_gpuworkers(int num);
+void meg4_gpuasync(int latency);
+void meg4_gpumem(int kbytes);
 void meg4_getscreen(void);
 void meg4_getview(void);
 void meg4_redraw(uint32_t *dst, int dw, int dh, int dp);
@@ -657,6 +701,10 @@ void meg4_api_mset(uint16_t mx, uint16_t my, uint16_t sprite);
 void meg4_api_map(int16_t x, int16_t y, uint16_t mx, uint16_t my, uint16_t mw, uint16_t mh, int8_t scale);
 void meg4_api_maze(uint16_t mx, uint16_t my, uint16_t mw, uint16_t mh, uint8_t scale,
     uint16_t sky, uint16_t grd, uint16_t door, uint16_t wall, uint16_t obj, uint8_t numnpc, addr_t npc);
+void meg4_api_blit(int16_t dx, int16_t dy, int16_t sx, int16_t sy, uint16_t w, uint16_t h);
+void meg4_api_blitscr(int16_t x, int16_t y, addr_t src, uint16_t sp, uint16_t w, uint16_t h, int16_t key, addr_t pal);
+void meg4_api_blitmem(addr_t dst, uint16_t dp, addr_t src, uint16_t sp, uint16_t w, uint16_t h, int16_t key, addr_t pal);
+void meg4_api_blitfill(addr_t dst, uint16_t dp, uint16_t w, uint16_t h, uint8_t palidx);
 
 #ifdef  __cplusplus
 }
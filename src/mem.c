@@ -185,6 +185,8 @@ void meg4_freerec(addr_t addr, uint32_t size)
 uint8_t meg4_api_inb(addr_t src)
 {
     uint8_t *ptr = meg4_memaddr(src);
+    /* the render thread might be in the middle of a dlg(), which temporarily modifies the crop area */
+    if(src >= 0x480 && src < 0x488) gpu_sync();
     return ptr ? *ptr : 0;
 }
 
@@ -216,9 +218,13 @@ uint32_t meg4_api_ini(addr_t src)
 void meg4_api_outb(addr_t dst, uint8_t value)
 {
     uint8_t *ptr = meg4_memaddr(dst);
-    /* do not allow overwriting the firmware version, the timers or the status registers */
-    if(dst < 16 || (dst >= 0x4BA && dst < 0x500) || dst >= MEG4_MEM_LIMIT || !ptr) return;
+    /* do not allow overwriting the firmware version, the timers or the status registers (but the texture flags and the
+     * sprite layer registers at 004B4 - 004B7 are writable) */
+    if(dst < 16 || (dst >= 0x4B0 && dst < 0x500 && (dst < 0x4B4 || dst > 0x4B7)) || dst >= MEG4_MEM_LIMIT || !ptr) return;
+    /* pending 3D triangles must be drawn with the old palette, sprites, camera etc. */
+    if(dst < MEG4_MEM_USER) gpu_flush();
     *ptr = value;
+    if(dst < MEG4_MEM_USER) gpu_dirty(dst, 1);
     if(dst >= 0x488 && dst < 0x48C) meg4_getscreen();
     if(dst >= 0x49E && dst < 0x4A9) meg4_getview();
 }
@@ -333,6 +339,7 @@ void meg4_api_memcpy(addr_t dst, addr_t src, uint32_t len)
     if(src + l >= MEG4_MEM_LIMIT) l = MEG4_MEM_LIMIT - src;
     if(dst + l >= MEG4_MEM_LIMIT) l = MEG4_MEM_LIMIT - dst;
     if(src >= 16 && dst >= 16 && src + l < sizeof(meg4.mmio) && dst + l < sizeof(meg4.mmio)) {
+        gpu_flush(); gpu_dirty(dst, l);
         memmove((uint8_t*)&meg4.mmio + dst, (uint8_t*)&meg4.mmio + src, l);
         if(dst <= 0x48C && dst + l >= 0x488) meg4_getscreen();
         if(dst <= 0x4A9 && dst + l >= 0x49E) meg4_getview();
@@ -360,6 +367,7 @@ void meg4_api_memset(addr_t dst, uint8_t value, uint32_t len)
     if(dst >= MEG4_MEM_LIMIT) { MEG4_DEBUGGER(ERR_BADADR); return; }
     if(dst + l >= MEG4_MEM_LIMIT) l = MEG4_MEM_LIMIT - dst;
     if(dst >= 16 && dst + l < sizeof(meg4.mmio)) {
+        gpu_flush(); gpu_dirty(dst, l);
         memset((uint8_t*)&meg4.mmio + dst, value, l);
         if(dst <= 0x48C && dst + l >= 0x488) meg4_getscreen();
         if(dst <= 0x4A9 && dst + l >= 0x49E) meg4_getview();
@@ -23,6 +23,7 @@
 
 #define _POSIX_C_SOURCE 199309L    /* needed for timespec and nanosleep() */
 #include <stdio.h>
+#include <time.h>
 #include "../../src/meg4.h"
 #include "editors.h"
 
@@ -50,6 +51,7 @@ char meg4_title[64], meg4_author[64], meg4_pro = 0;
 void meg4_switchmode(int mode) { (void)mode; }
 void meg4_recalcfont(int s, int e) { (void)s; (void)e; }
 void meg4_recalcmipmap(void) { }
+void gpu_dirty(addr_t dst, uint32_t len) { (void)dst; (void)len; }
 
 uint8_t meg4_palidx(uint8_t *rgba)
 {
@@ -124,6 +126,54 @@ int main_import(char *name, uint8_t *buf, int len)
         return meg4_import(name, buf, len, 0);
 }
 
+/**
+ * Render every music track and sound effect offline into 16 bit mono WAV files, and report how fast that was
+ */
+int export_wavs(char *dir)
+{
+    struct timespec t0, t1;
+    char fn[1024];
+    float *out = NULL, *tmp;
+    uint8_t *wav;
+    int16_t *d;
+    double ns, all = 0.0, total = 0.0;
+    int i, j, n, len, size, v, ret = 0;
+
+    for(i = 0; i < 8 + 64; i++) {
+        if(!meg4_audiooffline(i >= 8, i < 8 ? i : i - 8)) continue;
+        /* music loops forever with a jump backwards, so there must be a limit (10 minutes) */
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for(len = size = 0, n = 1; n > 0 && len < 600 * 44100; len += n) {
+            if(len + 65536 > size) {
+                size += 1024 * 1024;
+                if(!(tmp = (float*)realloc(out, size * sizeof(float)))) { printf("memory allocation error\n"); free(out); return 1; }
+                out = tmp;
+            }
+            n = meg4_audiorender(out + len, 65536);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ns = (double)(t1.tv_sec - t0.tv_sec) * 1e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+        all += ns; total += len;
+        /* RIFF header and 16 bit samples */
+        if(!(wav = (uint8_t*)malloc(44 + len * 2))) { printf("memory allocation error\n"); free(out); return 1; }
+        memcpy(wav, "RIFF\0\0\0\0WAVEfmt \x10\0\0\0\x01\0\x01\0\x44\xAC\0\0\x88\x58\x01\0\x02\0\x10\0data", 40);
+        *((uint32_t*)(wav + 4)) = htole32(36 + len * 2);
+        *((uint32_t*)(wav + 40)) = htole32(len * 2);
+        for(j = 0, d = (int16_t*)(wav + 44); j < len; j++) {
+            v = (int)(out[j] * 32767.0f);
+            d[j] = htole16(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+        }
+        sprintf(fn, "%s%s%s%02X.wav", dir ? dir : "", dir ? "/" : "", i < 8 ? "music" : "sfx", i < 8 ? i : i - 8);
+        if(!main_writefile(fn, wav, 44 + len * 2)) { printf("unable to write %s\n", fn); ret = 1; }
+        else printf("%-16s %8.2f sec, %8.1f x real time\n", fn, (double)len / 44100.0, ns > 0.0 ? (double)len / 44100.0 / (ns / 1e9) : 0.0);
+        free(wav);
+    }
+    if(out) free(out);
+    if(total > 0.0) printf("total %.2f sec of audio rendered in %.3f sec, %.1f x real time\n", total / 44100.0, all / 1e9, total / 44100.0 / (all / 1e9));
+    else printf("no music or sound effects\n");
+    return ret;
+}
+
 /**
  * Main function
  */
@@ -131,12 +181,14 @@ int main(int argc, char **argv)
 {
     FILE *f;
     uint8_t *buf = NULL;
-    int i, len = 0;
+    int i, len = 0, wav = 0;
 
     /* load input */
-    if(argc < 1 || !argv[1]) {
+    if(argc > 1 && argv[1] && !strcmp(argv[1], "-w")) { wav = 1; argv++; argc--; }
+    if(argc < 2 || !argv[1]) {
         printf("MEG-4 Converter by bzt Copyright (C) 2023 GPLv3+\r\n\r\n");
-        printf("%s <somefile>\r\n", argv[0]);
+        printf("%s <somefile> [output.zip]\r\n", argv[0]);
+        printf("%s -w <somefile> [outdir]\r\n", argv[0]);
         exit(1);
     }
     f = fopen(argv[1], "rb");
@@ -166,6 +218,14 @@ int main(int argc, char **argv)
 
     printf("exporting...\n");
 
+    /* render audio */
+    if(wav) {
+        dsp_init();
+        i = export_wavs(argv[2]);
+        dsp_free();
+        return i;
+    }
+
     /* export */
     meg4_export(argv[2] ? argv[2] : "output.zip", 0);
     return 0;
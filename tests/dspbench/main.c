@@ -0,0 +1,266 @@
+/*
+ * meg4/tests/dspbench/main.c
+ *
+ * Copyright (C) 2023 bzt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @brief A simple CLI tool to benchmark the audio mixer
+ *
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <time.h>
+#include "../../src/meg4.h"
+meg4_t meg4;
+int verbose = 0;
+
+int meg4_isbyte(void *buf, uint8_t byte, int len)
+{
+    uint8_t *ptr = (uint8_t*)buf;
+    int i;
+    if(!buf || len < 1) return 0;
+    for(i = 0; i < len && ptr[i] == byte; i++);
+    return i >= len;
+}
+
+#include "../../src/editors/fmt_mod.h"
+
+/**
+ * Log messages
+ */
+void main_log(int lvl, const char* fmt, ...)
+{
+    __builtin_va_list args;
+    __builtin_va_start(args, fmt);
+    if(verbose >= lvl) { printf("meg4: "); vprintf(fmt, args); printf("\r\n"); }
+    __builtin_va_end(args);
+}
+
+/**
+ * Generated songs. These are built as Amiga MOD files and imported with format_mod(), just like a real .mod would be
+ */
+#define NPAT 8
+#define NSMP 4
+static uint8_t mod[1084 + NPAT * 1024 + 2 * (128 + 64 + 4000 + 6000)];
+static uint32_t seed;
+
+/* own generator, so that the songs (and the checksums) are the same with every libc */
+static int rnd(int n)
+{
+    seed = seed * 1103515245U + 12345U;
+    return (int)((seed >> 16) % (uint32_t)n);
+}
+
+/* store a cell: waveform 1 to 4 (0 none), MEG-4 note number (0 none), effect type (0xE0 - 0xEF extended) and parameter */
+static void cell(int pat, int row, int ch, int w, int note, int et, int ep)
+{
+    uint8_t *c = mod + 1084 + pat * 1024 + row * 16 + ch * 4;
+    int period = note ? dsp_periods[note] : 0;
+
+    if(et >= 0xE0) { ep = ((et & 0xf) << 4) | (ep & 0xf); et = 0xE; }
+    c[0] = (w & 0xf0) | ((period >> 8) & 0xf); c[1] = period & 0xff;
+    c[2] = ((w & 0xf) << 4) | (et & 0xf); c[3] = ep;
+}
+
+static void notes_pat(int pat, int row, int ch)
+{
+    static const int w[] = { 1, 2, 4 };
+    cell(pat, row, ch, w[rnd(3)], 24 + rnd(48), 0, 0);
+    if(!row && !ch) { cell(pat, row, ch, 1, 36, 0xF, 6); }
+}
+
+static void effects_pat(int pat, int row, int ch)
+{
+    static const uint8_t fx[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x9, 0xA, 0xC, 0xE1, 0xE2, 0xE9, 0xEA, 0xEB, 0xEC,
+        0xED };
+    int et = fx[rnd(sizeof(fx))], ep = 1 + rnd(255);
+
+    /* notes on every other row only, so that the continuous effects have something to work on */
+    if(et == 0xC) ep &= 63;
+    if(et >= 0xE0) ep = 1 + (ep & 7);
+    cell(pat, row, ch, row & 1 ? 0 : 1 + rnd(NSMP), row & 1 ? 0 : 24 + rnd(48), et, ep);
+}
+
+static void sparse_pat(int pat, int row, int ch)
+{
+    /* a drum on the beat and a long pad every now and then, silence otherwise */
+    if(!ch && !(row & 7)) cell(pat, row, ch, 3, 36, 0, 0); else
+    if(ch == 1 && !(row & 31)) cell(pat, row, ch, 4, 24 + rnd(24), 0, 0);
+}
+
+static void tempo_pat(int pat, int row, int ch)
+{
+    cell(pat, row, ch, 1 + rnd(NSMP), 24 + rnd(48), 0, 0);
+    /* odd BPMs make ticks that aren't whole samples long, low speeds make lots of ticks */
+    if(!ch && !(row & 15)) cell(pat, row, ch, 1, 36, 0xF, row & 16 ? 1 + rnd(4) : 0x20 + rnd(224));
+}
+
+/**
+ * Build a MOD with the generated patterns and four waveforms: two short looped ones, a one-shot drum and a long pad
+ */
+static int genmod(void (*pat)(int, int, int))
+{
+    static const int len[NSMP] = { 128, 64, 4000, 6000 }, loop[NSMP] = { 0, 0, -1, 2000 };
+    int8_t *s;
+    int i, j, k, p;
+
+    seed = 1;
+    memset(mod, 0, sizeof(mod));
+    strcpy((char*)mod, "dspbench");
+    for(i = 0; i < NSMP; i++) {
+        mod[42 + i * 30] = len[i] >> 8; mod[43 + i * 30] = len[i] & 0xff;
+        mod[45 + i * 30] = 64;
+        if(loop[i] >= 0) {
+            mod[46 + i * 30] = loop[i] >> 8; mod[47 + i * 30] = loop[i] & 0xff;
+            mod[48 + i * 30] = (len[i] - loop[i]) >> 8; mod[49 + i * 30] = (len[i] - loop[i]) & 0xff;
+        } else mod[49 + i * 30] = 1;
+    }
+    mod[950] = NPAT; mod[951] = 127;
+    for(i = 0; i < NPAT; i++) mod[952 + i] = i;
+    memcpy(mod + 1080, "M.K.", 4);
+    for(p = 0; p < NPAT; p++)
+        for(i = 0; i < 64; i++)
+            for(j = 0; j < 4; j++) pat(p, i, j);
+    /* sample data, lengths are in words */
+    for(s = (int8_t*)mod + 1084 + NPAT * 1024, i = 0; i < NSMP; s += len[i++] * 2)
+        for(j = 0; j < len[i] * 2; j++) {
+            switch(i) {
+                case 0: k = j < 128 ? j * 2 - 128 : 383 - j * 2; break;
+                case 1: k = (j * 2) - 128; break;
+                case 2: k = (rnd(256) - 128) * (8000 - j) / 8000; break;
+                default: k = ((j / 50) & 1 ? 90 : -90) + rnd(32) - 16; break;
+            }
+            s[j] = k < -128 ? -128 : (k > 127 ? 127 : k);
+        }
+    return (int)sizeof(mod);
+}
+
+/**
+ * Benchmark scenes
+ */
+static struct { char *name, *desc; void (*pat)(int, int, int); } scenes[] = {
+    { "notes", "a note on every row and channel, no effects", notes_pat },
+    { "effects", "notes with every effect, on every other row", effects_pat },
+    { "sparse", "drums and pads, mostly silent channels", sparse_pat },
+    { "tempo", "notes with frequent speed and BPM changes", tempo_pat },
+    { NULL, NULL, NULL }
+};
+
+/**
+ * Render the music plus sound effects, and measure every block
+ */
+static const char *resamplers[] = { "nearest", "linear", "sinc" };
+static int run(char *name, uint8_t *buf, int len, int chans, int q, int secs, int blk, uint32_t *sum)
+{
+    struct timespec t0, t1;
+    float *out;
+    double ns, total = 0.0, peak = 0.0, voices = 0.0;
+    uint32_t h = 2166136261U;
+    int i, n, pos, sfx = 0, next = 0, w[31], nw = 0, num = secs * 44100;
+
+    if(!(out = (float*)malloc(num * sizeof(float)))) { printf("memory allocation error\r\n"); return 1; }
+    memset(out, 0, num * sizeof(float));
+    memset(&meg4, 0, sizeof(meg4));
+    dsp_init();
+    meg4_audioresampler(q);
+    if(!format_mod(0, buf, len)) { printf("unable to load mod\r\n"); free(out); return 1; }
+    /* sound effects use the waveforms the song has loaded */
+    for(i = 0; i < 31; i++) if(meg4.waveforms[i][0] || meg4.waveforms[i][1]) w[nw++] = i + 1;
+    for(seed = 2, i = 0; i < 64 && nw; i++) {
+        meg4.mmio.sounds[i * 4 + 0] = 36 + rnd(36);
+        meg4.mmio.sounds[i * 4 + 1] = w[rnd(nw)];
+    }
+    meg4_api_music(0, 0, 255);
+    for(pos = 0; pos < num; pos += n) {
+        n = num - pos < blk ? num - pos : blk;
+        /* retrigger the sound effect channels round robin, 30 times a second */
+        for(; chans > 4 && nw && pos >= next; next += 1470, sfx++) meg4_api_sfx(sfx & 63, sfx % (chans - 4), 255);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        meg4_audiofeed(out + pos, n);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ns = (double)(t1.tv_sec - t0.tv_sec) * 1e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+        total += ns; if(ns > peak) peak = ns;
+        voices += (double)meg4.mmio.dsp_voices * n;
+    }
+    for(i = 0; i < (int)(num * sizeof(float)); i++) h = (h ^ ((uint8_t*)out)[i]) * 16777619U;
+    printf("%-10s %2d ch %-8s %5.1f voices %8.3f ns/sample %6.2f ns/voice/sample, peak %8.1f usec/block, checksum %08x\r\n",
+        name, chans, resamplers[q], voices / num, total / num, voices > 0.0 ? total / voices : 0.0, peak / 1000.0, h);
+    *sum = h;
+    dsp_free();
+    free(out);
+    return 0;
+}
+
+/**
+ * The main procedure
+ */
+int main(int argc, char **argv)
+{
+    FILE *f;
+    uint8_t *buf = NULL;
+    uint32_t sum, chk;
+    int i, s, len = 0, q = 0, secs = 20, blk = 1024, chans = 0, check = 0, ret = 0;
+    static const int numch[] = { 4, 8, 16 };
+
+    /* "parse" command line arguments */
+    for(i = 1; i < argc && argv[i][0] == '-'; i++)
+        switch(argv[i][1]) {
+            case 'q': if(++i < argc) q = atoi(argv[i]); break;
+            case 's': if(++i < argc) secs = atoi(argv[i]); break;
+            case 'b': if(++i < argc) blk = atoi(argv[i]); break;
+            case 'c': if(++i < argc) chans = atoi(argv[i]); break;
+            case 'k': check = 1; break;
+            case 'v': verbose = 1; break;
+        }
+    if(i >= argc) {
+        printf("MEG-4 DSP Benchmark by bzt Copyright (C) 2023 GPLv3+\r\n\r\n");
+        printf("%s [-q resampler] [-s seconds] [-b block] [-c channels] [-k] [-v] <scene | in.mod>\r\n\r\nScenes:\r\n", argv[0]);
+        for(s = 0; scenes[s].name; s++) printf("  %-10s %s\r\n", scenes[s].name, scenes[s].desc);
+        printf("  %-10s %s\r\n", "all", "all of the above");
+        return 0;
+    }
+    if(q < 0 || q > 2) q = 0;
+    if(secs < 1) secs = 1;
+    if(blk < 1) blk = 1;
+    if(chans != 0 && chans != 4 && chans != 8 && chans != 16) { printf("channels must be 4, 8 or 16\r\n"); return 1; }
+    for(s = 0; scenes[s].name && strcmp(scenes[s].name, argv[i]); s++);
+    if(!scenes[s].name && strcmp(argv[i], "all")) {
+        if(!(f = fopen(argv[i], "rb"))) { printf("unknown scene '%s'\r\n", argv[i]); return 1; }
+        fseek(f, 0, SEEK_END);
+        len = (int)ftell(f);
+        fseek(f, 0, SEEK_SET);
+        buf = (uint8_t*)malloc(len);
+        if(!buf || (int)fread(buf, 1, len, f) != len) { printf("unable to read '%s'\r\n", argv[i]); fclose(f); return 1; }
+        fclose(f);
+    }
+    for(s = buf ? -1 : (scenes[s].name ? s : 0); !ret && (s < 0 || scenes[s].name); s++) {
+        if(s >= 0) len = genmod(scenes[s].pat);
+        for(i = 0; !ret && i < 3; i++)
+            if(!chans || chans == numch[i]) {
+                ret = run(s < 0 ? "mod" : scenes[s].name, s < 0 ? buf : mod, len, numch[i], q, secs, blk, &sum);
+                /* render the music again with an odd block size, the output must not depend on how it was split. Not with sound
+                 * effects, those are retriggered at block boundaries, and the mixer's gain follows the number of voices per block */
+                if(!ret && check && numch[i] == 4) {
+                    ret = run(s < 0 ? "mod" : scenes[s].name, s < 0 ? buf : mod, len, numch[i], q, secs, blk == 61 ? 67 : 61, &chk);
+                    if(!ret && chk != sum) { printf("checksum differs with another block size\r\n"); ret = 1; }
+                }
+            }
+        if(s < 0 || strcmp(argv[argc - 1], "all")) break;
+    }
+    if(buf) free(buf);
+    return ret;
+}
@@ -0,0 +1,380 @@
+/*
+ * meg4/tests/gpubench/main.c
+ *
+ * Copyright (C) 2023 bzt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @brief A simple CLI tool to benchmark the graphics processor
+ *
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "meg4.h"
+
+int verbose = 1;
+
+/**
+ * Hooks that libmeg4.a might call and a platform must provide
+ */
+void main_log(int lvl, const char* fmt, ...)
+{
+    __builtin_va_list args;
+    __builtin_va_start(args, fmt);
+    if(verbose >= lvl) { printf("meg4: "); vprintf(fmt, args); printf("\r\n"); }
+    __builtin_va_end(args);
+}
+
+uint8_t* main_readfile(char *file, int *size) { (void)file; (void)size; return NULL; }
+int main_writefile(char *file, uint8_t *buf, int size) { (void)file; (void)buf; (void)size; return 0; }
+
+/* callbacks that can be empty */
+void main_openfile(void) { }
+int main_savefile(const char *name, uint8_t *buf, int len) { (void)name; (void)buf; (void)len; return 0; }
+char **main_getfloppies(void) { return NULL; }
+int main_cfgsave(char *cfg, uint8_t *buf, int len) { (void)cfg; (void)buf; (void)len; return 1; }
+uint8_t *main_cfgload(char *cfg, int *len) { (void)cfg; (void)len; return NULL; }
+void main_fullscreen(void) { }
+char *main_getclipboard(void) { return NULL; }
+void main_setclipboard(char *str) { (void)str; }
+void main_osk_show(void) { }
+void main_osk_hide(void) { }
+
+/**
+ * Overdraw: a stack of screen sized quads, nearest first, so that most of the fragments are behind the first layer
+ */
+#define LAYERS 32
+static void overdraw_init(void)
+{
+    int16_t *v = (int16_t*)meg4.data;
+    uint8_t *t = meg4.data + 1024;
+    int i;
+
+    /* look towards -X, with the light at the camera */
+    meg4.mmio.camyaw = htole16(90); meg4_getview();
+    meg4.mmio.lspx = meg4.mmio.lspy = meg4.mmio.lspz = 0;
+    for(i = 0; i < LAYERS; i++) {
+        /* vertices, slightly tilted planes facing the camera */
+        v[i * 12 + 0] = -6000 - i * 800; v[i * 12 + 1] = -32000; v[i * 12 + 2] = -32000;
+        v[i * 12 + 3] = -4000 - i * 800; v[i * 12 + 4] = -32000; v[i * 12 + 5] =  32000;
+        v[i * 12 + 6] = -6000 - i * 800; v[i * 12 + 7] =  32000; v[i * 12 + 8] = -32000;
+        v[i * 12 + 9] = -4000 - i * 800; v[i * 12 + 10] = 32000; v[i * 12 + 11] = 32000;
+        /* triangles, each layer has its own color */
+        t[i * 12 + 0] = i * 4 + 0; t[i * 12 + 2] = i * 4 + 2; t[i * 12 + 4] = i * 4 + 1;
+        t[i * 12 + 6] = i * 4 + 1; t[i * 12 + 8] = i * 4 + 2; t[i * 12 + 10] = i * 4 + 3;
+        t[i * 12 + 1] = t[i * 12 + 3] = t[i * 12 + 5] = t[i * 12 + 7] = t[i * 12 + 9] = t[i * 12 + 11] = 16 + i;
+    }
+}
+
+static void overdraw_draw(int frame)
+{
+    (void)frame;
+    meg4_api_cls(0);
+    meg4_api_mesh(MEG4_MEM_USER, 0, LAYERS * 2, MEG4_MEM_USER + 1024);
+}
+
+/**
+ * Plane: a large textured floor receding into the distance, made of strips wider than the screen
+ */
+#define STRIPS 32
+static void plane_init(void)
+{
+    int16_t *v = (int16_t*)meg4.data;
+    uint8_t *t = meg4.data + 2048, *uv = meg4.data + 1536;
+    int i, j;
+
+    /* look towards -X, with the light above the camera */
+    meg4.mmio.camyaw = htole16(90); meg4_getview();
+    meg4.mmio.lspx = meg4.mmio.lspz = 0; meg4.mmio.lspy = htole16(32767);
+    /* checkerboard with some noise, so that the aliasing is visible */
+    srand(1);
+    for(j = 0; j < 256; j++)
+        for(i = 0; i < 256; i++)
+            meg4.mmio.sprites[(j << 8) | i] = (((i >> 3) ^ (j >> 3)) & 1 ? 16 : 32) + (rand() & 7);
+    meg4_recalcmipmap();
+    /* the texture coordinates are mirrored, 1 is the right edge and 255 is the left */
+    uv[0] = 255; uv[1] = 255; uv[2] = 1; uv[3] = 255; uv[4] = 255; uv[5] = 1; uv[6] = 1; uv[7] = 1;
+    for(j = 0; j <= STRIPS; j++) {
+        v[j * 6 + 0] = -4000 - j * 28000 / STRIPS; v[j * 6 + 1] = -6000; v[j * 6 + 2] = -32000;
+        v[j * 6 + 3] = -4000 - j * 28000 / STRIPS; v[j * 6 + 4] = -6000; v[j * 6 + 5] =  32000;
+    }
+    /* the nearest vertex is the last, so that the rasterizer's y sorting keeps the triangles intact */
+    for(j = 0; j < STRIPS; j++, t += 12) {
+        t[0] = j * 2 + 2; t[1] = 2; t[2] = j * 2 + 1; t[3] = 1; t[4] = j * 2 + 0; t[5] = 0;
+        t[6] = j * 2 + 2; t[7] = 2; t[8] = j * 2 + 3; t[9] = 3; t[10] = j * 2 + 1; t[11] = 1;
+    }
+}
+
+static void plane_draw(int frame)
+{
+    (void)frame;
+    meg4_api_cls(0);
+    meg4_api_mesh(MEG4_MEM_USER, MEG4_MEM_USER + 1536, STRIPS * 2, MEG4_MEM_USER + 2048);
+}
+
+/**
+ * Maze: a room with pillars, a long corridor and NPCs, turning around
+ */
+static void maze_init(void)
+{
+    uint32_t *npc = (uint32_t*)meg4.data;
+    int i, x, y;
+
+    srand(1);
+    for(i = 0; i < 65536; i++) meg4.mmio.sprites[i] = rand();
+    /* object sprites with transparent pixels */
+    for(i = 0; i < 65536; i += 3) if(((i >> 3) & 31) >= 10) meg4.mmio.sprites[i] = 0;
+    meg4_recalcmipmap();
+    for(y = 0; y < 32; y++)
+        for(x = 0; x < 32; x++)
+            meg4.mmio.map[y * 320 + x] = x == 0 || y == 0 || x == 31 || y == 31 || (!(x % 5) && !(y % 7)) ? 5 :
+                (x % 3 == 1 && y % 4 == 2 ? 12 : 1);
+    for(i = 0; i < 40; i++) {
+        npc[i * 3 + 0] = htole32(128 * (3 + (i % 7) * 3) + 64);
+        npc[i * 3 + 1] = htole32(128 * (4 + (i / 7) * 4) + 64);
+        npc[i * 3 + 2] = htole32(10 + (i & 3));
+    }
+}
+
+static void maze_draw(int frame)
+{
+    meg4.mmio.turtlea = htole16((frame * 7) % 360);
+    meg4_api_maze(0, 0, 32, 32, 0, 2, 1, 4, 4, 10, 40, MEG4_MEM_USER);
+}
+
+/**
+ * Shapes: lots of small 2D primitives, sprites and text, every draw function makes a separate call
+ */
+static void shapes_init(void)
+{
+    int i;
+
+    srand(1);
+    for(i = 0; i < 65536; i++) meg4.mmio.sprites[i] = rand();
+    strcpy((char*)meg4.data, "The quick brown fox jumps over the lazy dog");
+}
+
+static void shapes_draw(int frame)
+{
+    int i, x, y;
+
+    meg4_api_cls(0);
+    for(i = 0; i < 256; i++) {
+        x = (i * 37 + frame * 3) % 320; y = (i * 23 + frame) % 200;
+        switch(i & 7) {
+            case 0: meg4_api_fcirc(16 + (i & 15), x, y, 12); break;
+            case 1: meg4_api_line(32 + (i & 15), x, y, 319 - x, 199 - y); break;
+            case 2: meg4_api_frect(48 + (i & 15), x, y, x + 20, y + 12); break;
+            case 3: meg4_api_tri(64 + (i & 15), x, y, x + 30, y + 5, x + 10, y + 25); break;
+            case 4: meg4_api_ftri(80 + (i & 15), x, y, x - 20, y + 15, x + 15, y + 20); break;
+            case 5: meg4_api_ellip(96 + (i & 15), x, y, x + 40, y + 16); break;
+            case 6: meg4_api_spr(x, y, i, 2, 2, 0, i % 8); break;
+            case 7: meg4_api_qbez(112 + (i & 15), x, y, x + 50, y, x + 25, y - 30); break;
+        }
+    }
+    for(i = 0; i < 16; i++)
+        meg4_api_text(i + 1, 4, i * 12 + (frame & 7), 1, 0, 0, MEG4_MEM_USER);
+}
+
+/**
+ * Sprites: a scrolling map with 128 moving 16 x 16 sprites, some behind the map, redrawn with spr and map every frame
+ */
+#define OBJS 128
+static void sprites_init(void)
+{
+    int i;
+
+    srand(1);
+    for(i = 0; i < 65536; i++) meg4.mmio.sprites[i] = (rand() & 3) ? rand() : 0;
+    for(i = 0; i < 320 * 200; i++) meg4.mmio.map[i] = (rand() & 3) ? 0 : rand();
+}
+
+static void sprites_obj(int i, int frame, int *x, int *y, int *f)
+{
+    *x = (i * 37 + frame * (1 + (i & 3))) % 344 - 16;
+    *y = (i * 23 + frame * (1 + (i & 1))) % 224 - 16;
+    *f = i % 5;
+}
+
+static void sprites_draw(int frame)
+{
+    int i, x, y, f, px = frame % 2000, py = frame % 1200, type[] = { 0, 6, 4, 2, 0 };
+
+    meg4_api_cls(0);
+    /* lower index is on top, and flag 4 puts the object behind the map, just like in the sprite layer */
+    for(i = OBJS - 1; i >= 0; i--) {
+        sprites_obj(i, frame, &x, &y, &f);
+        if(f == 4) meg4_api_spr(x, y, i * 2, 2, 2, 0, 0);
+    }
+    meg4_api_map(-(px & 7), -(py & 7), px >> 3, py >> 3, 41, 26, 0);
+    for(i = OBJS - 1; i >= 0; i--) {
+        sprites_obj(i, frame, &x, &y, &f);
+        if(f != 4) meg4_api_spr(x, y, i * 2, 2, 2, 0, type[f]);
+    }
+}
+
+/**
+ * Objects: the very same picture as sprites, but using the sprite layer, so nothing is drawn into the vram
+ */
+static void objects_init(void)
+{
+    sprites_init();
+    meg4_api_cls(0);
+    /* through the API, like a game would do it */
+    meg4_api_outw(0x4B6, MEG4_MEM_USER >> 4);
+    meg4_api_outb(0x4B5, OBJS);
+}
+
+static void objects_draw(int frame)
+{
+    uint8_t *o = meg4.data;
+    int i, x, y, f, px = frame % 2000, py = frame % 1200;
+
+    /* table header, the tilemap layer */
+    o[0] = px & 0xff; o[1] = px >> 8; o[2] = py & 0xff; o[3] = py >> 8; o[4] = 1;
+    for(i = 0, o += 8; i < OBJS; i++, o += 8) {
+        sprites_obj(i, frame, &x, &y, &f);
+        o[0] = x & 0xff; o[1] = (x >> 8) & 0xff; o[2] = y & 0xff; o[3] = (y >> 8) & 0xff;
+        /* 2 x 2 sprites, flipped horizontally, vertically, both, or behind the tilemap layer */
+        o[4] = (i * 2) & 0xff; o[5] = ((i * 2) >> 8) | (1 << 2) | (1 << 5);
+        o[6] = f == 4 ? 4 : f; o[7] = 0;
+    }
+}
+
+/**
+ * Parallax: layers scrolled at different speeds with the blitter, from user memory and from the sprites, recolored
+ * with a remap table, plus a status bar composed in memory and copies within the vram
+ */
+#define FARW 512
+static void parallax_init(void)
+{
+    int i;
+
+    srand(1);
+    for(i = 0; i < 65536; i++) meg4.mmio.sprites[i] = (rand() & 3) ? rand() : 0;
+    for(i = 0; i < FARW * 200; i++) meg4.data[i] = 16 + (i / FARW / 25) * 4 + (rand() & 3);
+    meg4_api_cls(0);
+}
+
+static void parallax_draw(int frame)
+{
+    addr_t far = MEG4_MEM_USER, pal = far + FARW * 200, bar = pal + 256;
+    int i, x = frame % FARW, w = FARW - x < 320 ? FARW - x : 320;
+
+    /* far layer from the user memory, wrapping around */
+    meg4_api_blitscr(0, 0, far + x, FARW, w, 200, -1, 0);
+    if(w < 320) meg4_api_blitscr(w, 0, far, FARW, 320 - w, 200, -1, 0);
+    /* near layer from the sprites, with color key */
+    x = (frame * 3) % 256;
+    meg4_api_blitscr(-x, 96, 0x10000, 256, 256, 64, 0, 0);
+    meg4_api_blitscr(256 - x, 96, 0x10000, 256, 256, 64, 0, 0);
+    /* reflection, then smear it downwards with overlapping copies */
+    meg4_api_blit(0, 160, 0, 120, 320, 20);
+    meg4_api_blit(0, 161, 0, 160, 320, 19);
+    /* status bar, composed in memory with a remapped strip of sprites */
+    for(i = 0; i < 256; i++) meg4.data[pal - MEG4_MEM_USER + i] = i + frame;
+    meg4_api_blitfill(bar, 320, 320, 20, 1);
+    meg4_api_blitmem(bar + 32, 320, 0x10000 + (frame & 127) * 256, 256, 256, 16, 0, pal);
+    meg4_api_blitscr(0, 180, bar, 320, 320, 20, -1, 0);
+}
+
+/**
+ * Benchmark scenes
+ */
+static struct { char *name, *desc; void (*init)(void); void (*draw)(int); } scenes[] = {
+    { "overdraw", "32 screen sized layers, nearest first", overdraw_init, overdraw_draw },
+    { "plane", "receding textured plane", plane_init, plane_draw },
+    { "maze", "raycasted maze with sprites", maze_init, maze_draw },
+    { "shapes", "many small 2D shapes, sprites and text", shapes_init, shapes_draw },
+    { "sprites", "scrolling map with moving sprites", sprites_init, sprites_draw },
+    { "objects", "same as sprites, using the sprite layer", objects_init, objects_draw },
+    { "parallax", "layers scrolled with the blitter", parallax_init, parallax_draw },
+    { NULL, NULL, NULL, NULL }
+};
+
+/* what a platform would display */
+static uint32_t disp[640 * 400];
+
+/**
+ * Checksum of the screen
+ */
+static uint32_t checksum(uint8_t *p)
+{
+    uint32_t h = 2166136261U, i;
+    for(i = 0; i < 640 * 400 * 4; i++) h = (h ^ p[i]) * 16777619U;
+    return h;
+}
+
+/**
+ * The main procedure
+ */
+int main(int argc, char **argv)
+{
+    struct timespec t0, t1;
+    int i, s, f, frames = 100, workers = 1, nomip = 0, latency = -1;
+    double ms;
+
+    /* "parse" command line arguments */
+    for(i = 1; i < argc && argv[i][0] == '-'; i++)
+        switch(argv[i][1]) {
+            case 'f': if(++i < argc) frames = atoi(argv[i]); break;
+            case 't': if(++i < argc) workers = atoi(argv[i]); break;
+            case 'm': nomip = 1; break;
+            case 'r': if(++i < argc) latency = atoi(argv[i]); break;
+        }
+    if(i >= argc) {
+        printf("MEG-4 GPU Benchmark by bzt Copyright (C) 2023 GPLv3+\r\n\r\n");
+        printf("%s [-f frames] [-t workers] [-r latency] [-m] <scene>\r\n\r\nScenes:\r\n", argv[0]);
+        for(s = 0; scenes[s].name; s++) printf("  %-10s %s\r\n", scenes[s].name, scenes[s].desc);
+        return 0;
+    }
+    for(s = 0; scenes[s].name && strcmp(scenes[s].name, argv[i]); s++);
+    if(!scenes[s].name) { printf("unknown scene '%s'\r\n", argv[i]); return 1; }
+    if(frames < 1) frames = 1;
+
+    /* turn on the emulator */
+    meg4_poweron("en");
+    meg4.mode = MEG4_MODE_GAME;
+    meg4_gpuworkers(workers);
+    meg4_gpuasync(latency);
+    if(nomip) meg4.mmio.texflags |= 1;
+    scenes[s].init();
+
+    /* the first frame is a warm-up, it allocates buffers and fills up caches */
+    scenes[s].draw(0);
+    gpu_frame();
+    meg4_redraw(disp, 640, 400, 640 * 4);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(f = 1; f <= frames; f++) {
+        scenes[s].draw(f);
+        gpu_frame();
+        meg4_redraw(disp, 640, 400, 640 * 4);
+    }
+    /* with one frame latency the last frame might be still in the works */
+    gpu_flush();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    /* so the display shows the last frame too, not the one before it */
+    meg4_redraw(disp, 640, 400, 640 * 4);
+    ms = (double)(t1.tv_sec - t0.tv_sec) * 1000.0 + (double)(t1.tv_nsec - t0.tv_nsec) / 1000000.0;
+    printf("%s: %d frames, %d workers, %s, %.3f ms/frame, checksum %08x, display %08x\r\n", scenes[s].name, frames,
+        workers, nomip ? "no mipmaps" : "mipmaps", ms / frames, checksum((uint8_t*)meg4.screen.buf), checksum((uint8_t*)disp));
+
+    /* free resources */
+    meg4_poweroff();
+    return 0;
+}
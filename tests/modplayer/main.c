@@ -17,19 +17,22 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  *
- * @brief Tests MEG-4 Amiga MOD capabilities, imports a .mod and plays it
+ * @brief Tests MEG-4 Amiga MOD capabilities, imports a .mod and plays it, or renders it for mixer regression checks
  *
  */
 
 #define _POSIX_C_SOURCE 199309L    /* needed for timespec and nanosleep() */
 #include <stdio.h>
 #include <time.h>
+#include <math.h>
 #include <signal.h>
+#ifndef NOAUDIO
 #ifdef TEST_PA
 #include <portaudio.h>
 #else
 #include <SDL2/SDL.h>
 #endif
+#endif
 #include "../../src/meg4.h"
 meg4_t meg4;
 
@@ -47,7 +50,8 @@ int meg4_isbyte(void *buf, uint8_t byte, int len)
 /**
  * Audio callback wrappers
  */
-#ifdef TEST_PA
+#ifdef NOAUDIO
+#elif defined(TEST_PA)
 PaStream *pa = NULL;
 static int main_audio(const void *inp, void *out, long unsigned int framesPerBuffer, const PaStreamCallbackTimeInfo *info,
     PaStreamCallbackFlags flags, void *ctx)
@@ -91,6 +95,199 @@ static void main_stop(int signal)
 /**
  * Compare two music buffers
  */
+/**
+ * Built-in test song, waveforms with and without loops and every effect the DSP knows on random notes, plus sound effects
+ */
+void testsong(void)
+{
+    static const uint8_t fx[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x9, 0xA, 0xC, 0xE1, 0xE2, 0xE4, 0xE5, 0xE7, 0xE9,
+        0xEA, 0xEB, 0xEC, 0xED };
+    uint8_t *n;
+    int i, l;
+
+    for(i = 0; i < 8; i++) {
+        l = i & 1 ? 256 : 1000 + i * 700;
+        meg4.waveforms[i][0] = l & 0xff; meg4.waveforms[i][1] = l >> 8;
+        dsp_genwave(i + 1, i);
+        if(i & 1) { meg4.waveforms[i][4] = l & 0xff; meg4.waveforms[i][5] = l >> 8; }
+        if(i == 3) meg4.waveforms[i][6] = 5;
+    }
+    for(i = 0, n = meg4.tracks[0]; i < 256 * 4; i++, n += 4) {
+        if(rand() % 3) { n[0] = 13 + rand() % 60; n[1] = 1 + rand() % 8; }
+        if(rand() & 1) { n[2] = fx[rand() % sizeof(fx)]; n[3] = rand(); }
+        if(!(i & 255)) { n[2] = 0xF; n[3] = i & 256 ? 120 + (rand() & 63) : 3 + (rand() & 3); }
+    }
+    meg4.tracks[0][255 * 16] = 1;
+    for(i = 0, n = meg4.mmio.sounds; i < 64; i++, n += 4) {
+        n[0] = 13 + rand() % 60; n[1] = 1 + rand() % 8;
+        if(rand() & 1) { n[2] = fx[rand() % sizeof(fx)]; n[3] = rand(); }
+    }
+}
+
+/**
+ * Render the music with sound effects on top into a buffer, using different buffer sizes like the platforms do
+ */
+#define RENDER_LEN (20 * 44100)
+static double voices;
+float *render(void)
+{
+    static const int sizes[] = { 4096, 1024, 333, 2048, 735, 64 };
+    float *out = (float*)malloc(RENDER_LEN * sizeof(float));
+    int i, j, n, pos, sfx = 0;
+
+    if(!out) return NULL;
+    meg4_api_music(0, 0, 255);
+    for(pos = i = 0; pos < RENDER_LEN; pos += n, i++) {
+        n = sizes[i % 6]; if(n > RENDER_LEN - pos) n = RENDER_LEN - pos;
+        if(pos >= sfx * 4410) { meg4_api_sfx(sfx & 63, sfx % 12, 64 + (sfx * 37) % 192); sfx++; }
+        meg4_audiofeed(out + pos, n);
+        /* voices playing, according to the status registers */
+        for(j = 0; j < 16; j++) if(meg4.mmio.dsp_ch[j]) voices += n;
+    }
+    return out;
+}
+
+/**
+ * Save the rendered output, or compare it with a previously saved one
+ */
+int regression(char *cmd, char *fn)
+{
+    FILE *f;
+    float *out = render(), *ref, d, max = 0.0f;
+    uint32_t h = 2166136261U;
+    int i, diff = 0, ret = 0;
+
+    if(!out) { printf("memory allocation error\n"); return 1; }
+    for(i = 0; i < (int)(RENDER_LEN * sizeof(float)); i++) h = (h ^ ((uint8_t*)out)[i]) * 16777619U;
+    printf("rendered %u samples, checksum %08x\n", RENDER_LEN, h);
+    if(cmd[1] == 'r') {
+        if(!(f = fopen(fn, "wb")) || fwrite(out, sizeof(float), RENDER_LEN, f) != RENDER_LEN) { printf("unable to write %s\n", fn); ret = 1; }
+        if(f) fclose(f);
+    } else {
+        ref = (float*)malloc(RENDER_LEN * sizeof(float));
+        if(!ref || !(f = fopen(fn, "rb")) || fread(ref, sizeof(float), RENDER_LEN, f) != RENDER_LEN) {
+            printf("unable to read %s\n", fn); ret = 1;
+        } else {
+            fclose(f);
+            for(i = 0; i < RENDER_LEN; i++) {
+                d = out[i] > ref[i] ? out[i] - ref[i] : ref[i] - out[i];
+                if(d > 0.0f) diff++;
+                if(d > max) max = d;
+            }
+            /* summing in a different order is allowed to round differently, but a single wrong sample is way above this */
+            ret = max > 1e-5f;
+            printf("%d samples differ, max difference %g: %s\n", diff, max, ret ? "FAIL" : "OK");
+        }
+        if(ref) free(ref);
+    }
+    free(out);
+    return ret;
+}
+
+/**
+ * Set up the DSP with the test song or the given .mod file
+ */
+void setup(char *fn)
+{
+    FILE *f;
+    uint8_t *buf;
+    int len;
+
+    memset(&meg4, 0, sizeof(meg4));
+    dsp_init();
+    srand(1);
+    testsong();
+    if(fn && (f = fopen(fn, "rb"))) {
+        fseek(f, 0, SEEK_END);
+        len = (int)ftell(f);
+        fseek(f, 0, SEEK_SET);
+        buf = malloc(len);
+        if(buf) fread(buf, 1, len, f); else len = 0;
+        fclose(f);
+        memset(meg4.tracks, 0, sizeof(meg4.tracks)); memset(meg4.waveforms, 0, sizeof(meg4.waveforms));
+        if(!format_mod(0, buf, len)) { printf("unable to load mod\n"); exit(1); }
+        free(buf);
+    }
+}
+
+/**
+ * Measure how much time the mixer takes with each resampler
+ */
+static const char *resamplers[] = { "nearest", "linear", "sinc" };
+int benchmark(char *fn)
+{
+    struct timespec t0, t1;
+    float *out;
+    double ns;
+    int q;
+
+    for(q = 0; q < 3; q++) {
+        setup(fn);
+        meg4_audioresampler(q);
+        voices = 0.0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        out = render();
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        if(!out) { printf("memory allocation error\n"); return 1; }
+        free(out);
+        ns = (double)(t1.tv_sec - t0.tv_sec) * 1e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+        printf("%-8s %8.3f msec per second, %6.2f nsec per voice per sample (%.1f voices on average)\n", resamplers[q],
+            ns / 1e6 / (RENDER_LEN / 44100), ns / voices, voices / RENDER_LEN);
+    }
+    dsp_free();
+    return 0;
+}
+
+/**
+ * Aliasing test, plays a looped 32 samples long sawtooth (lots of harmonics) at high notes with each resampler, and checks
+ * how much of the output's energy isn't at a harmonic of the played note (the lower the better)
+ */
+#define ALIAS_LEN 4096
+extern uint16_t dsp_periods[];
+int aliasing(void)
+{
+    static const uint8_t notes[] = { 84, 91, 96 };
+    static float out[512 + ALIAS_LEN], c[ALIAS_LEN], s[ALIAS_LEN], level[3];
+    double re, im, p, f0, fb, all, bad, w;
+    int i, j, b, h, q, ret = 0;
+
+    for(i = 0; i < ALIAS_LEN; i++) { c[i] = cos(2 * 3.14159265358979 * i / ALIAS_LEN); s[i] = sin(2 * 3.14159265358979 * i / ALIAS_LEN); }
+    for(j = 0; j < (int)sizeof(notes); j++) {
+        f0 = 1773447.3 / (dsp_periods[notes[j]] * 32);
+        printf("note %u, %7.1f Hz:", notes[j], f0);
+        for(q = 0; q < 3; q++) {
+            memset(&meg4, 0, sizeof(meg4));
+            dsp_init();
+            meg4_audioresampler(q);
+            meg4.waveforms[0][0] = 32; meg4.waveforms[0][4] = 32; meg4.waveforms[0][7] = 64;
+            for(i = 0; i < 32; i++) meg4.waveforms[0][8 + i] = (uint8_t)(i * 8 - 128);
+            meg4.tracks[0][0] = notes[j]; meg4.tracks[0][1] = 1;
+            meg4_api_music(0, 0, 255);
+            meg4_audiofeed(out, sizeof(out) / sizeof(out[0]));
+            /* Hann windowed DFT, the bins near the harmonics are the signal, everything else is aliasing */
+            for(b = 1, all = bad = 0.0; b < ALIAS_LEN / 2; b++) {
+                for(i = 0, re = im = 0.0; i < ALIAS_LEN; i++) {
+                    w = out[512 + i] * (0.5 - 0.5 * c[i]);
+                    re += w * c[(b * i) % ALIAS_LEN]; im -= w * s[(b * i) % ALIAS_LEN];
+                }
+                p = re * re + im * im;
+                fb = (double)b * 44100.0 / ALIAS_LEN; h = (int)(fb / f0 + 0.5);
+                if(h < 1) continue;
+                all += p;
+                if(h * f0 > 22050.0 || fabs(fb - h * f0) > 4 * 44100.0 / ALIAS_LEN) bad += p;
+            }
+            level[q] = 10.0 * log10(bad / all);
+            printf(" %s %6.1f dB", resamplers[q], level[q]);
+        }
+        /* the interpolating ones must be better, the band limited sinc considerably so */
+        h = level[1] < level[0] && level[2] < level[0] - 20.0f;
+        printf(": %s\n", h ? "OK" : "FAIL");
+        if(!h) ret = 1;
+    }
+    dsp_free();
+    return ret;
+}
+
 void compare(uint8_t *buf, int len, uint8_t *out, int olen)
 {
     int i, n1, n2;
@@ -127,11 +324,24 @@ int main(int argc, char **argv)
     int len = 0, olen = 0;
 
     /* load input */
-    if(argc < 1 || !argv[1]) {
+    if(argc < 2 || !argv[1] || (argv[1][0] == '-' && argv[1][1] != 'b' && argv[1][1] != 'a' &&
+      (argc < 3 || (argv[1][1] != 'r' && argv[1][1] != 'c')))) {
         printf("MEG-4 Amiga MOD Player by bzt Copyright (C) 2023 GPLv3+\r\n\r\n");
         printf("%s <in.mod> [out.mod]\r\n", argv[0]);
+        printf("%s -r <out.raw> [in.mod]\r\n", argv[0]);
+        printf("%s -c <ref.raw> [in.mod]\r\n", argv[0]);
+        printf("%s -b [in.mod]\r\n", argv[0]);
+        printf("%s -a\r\n", argv[0]);
         exit(1);
     }
+    if(argv[1][1] == 'b' && argv[1][0] == '-') return benchmark(argc > 2 ? argv[2] : NULL);
+    if(argv[1][1] == 'a' && argv[1][0] == '-') return aliasing();
+    if(argv[1][0] == '-') {
+        setup(argc > 3 ? argv[3] : NULL);
+        len = regression(argv[1], argv[2]);
+        dsp_free();
+        return len;
+    }
     f = fopen(argv[1], "rb");
     if(f) {
         fseek(f, 0, SEEK_END);
@@ -179,7 +389,10 @@ int main(int argc, char **argv)
     printf("playing, press CTRL+C to stop...\n");
 
     /* open audio */
-#ifdef TEST_PA
+#ifdef NOAUDIO
+    printf("compiled without audio\n");
+    return 1;
+#elif defined(TEST_PA)
     Pa_Initialize(); pa = NULL;
     if(Pa_OpenDefaultStream(&pa, 0, 1, paFloat32, 44100, 4096, main_audio, NULL) != paNoError || !pa) {
         Pa_Terminate(); printf("pa error\n"); return 1;
@@ -212,7 +425,8 @@ int main(int argc, char **argv)
 
     /* free resources */
     dsp_free();
-#ifdef TEST_PA
+#ifdef NOAUDIO
+#elif defined(TEST_PA)
     Pa_CloseStream(pa);
     Pa_Terminate();
 #else
@@ -0,0 +1,125 @@
+/*
+ * meg4/tests/scalerbench/main.c
+ *
+ * Copyright (C) 2023 bzt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @brief A simple CLI tool to benchmark the platforms' software scalers
+ *
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <time.h>
+#include "../../platform/scaler.h"
+
+/* the screen is always 640 pixels wide in memory, just like on the platforms */
+#define SRCP (640 * 4)
+
+static struct {
+    char *name, *desc;
+    int sw, sh, dw, dh;
+} modes[] = {
+    { "int2",     "320 x 200 to 640 x 400, pixel perfect",       320, 200,  640,  400 },
+    { "int3",     "320 x 200 to 960 x 600, pixel perfect",       320, 200,  960,  600 },
+    { "int4",     "320 x 200 to 1280 x 800, pixel perfect",      320, 200, 1280,  800 },
+    { "int6",     "320 x 200 to 1920 x 1200, pixel perfect",     320, 200, 1920, 1200 },
+    { "nearest",  "320 x 200 to 1728 x 1080, nearest neighbour", 320, 200, 1728, 1080 },
+    { "bilinear", "320 x 200 to 1728 x 1080, linear filtering",  320, 200, 1728, 1080 },
+    { "hires",    "640 x 400 to 1728 x 1080, linear filtering",  640, 400, 1728, 1080 },
+    { NULL, NULL, 0, 0, 0, 0 }
+};
+
+/**
+ * Simple checksum of the destination image (FNV-1a)
+ */
+static uint32_t checksum(uint32_t *dst, int dw, int dh, int dp)
+{
+    uint32_t h = 2166136261U;
+    uint8_t *p;
+    int x, y;
+
+    for(y = 0; y < dh; y++)
+        for(x = 0, p = (uint8_t*)dst + y * dp; x < dw * 4; x++)
+            h = (h ^ p[x]) * 16777619U;
+    return h;
+}
+
+/**
+ * The main procedure
+ */
+int main(int argc, char **argv)
+{
+    struct timespec t0, t1;
+    uint32_t *src, *dst;
+    int i, m, f, frames = 100, threads = 1, bgra = 0, dp;
+    double ms;
+
+    /* "parse" command line arguments */
+    for(i = 1; i < argc && argv[i][0] == '-'; i++)
+        switch(argv[i][1]) {
+            case 'f': if(++i < argc) frames = atoi(argv[i]); break;
+            case 't': if(++i < argc) threads = atoi(argv[i]); break;
+            case 'b': bgra = 1; break;
+        }
+    if(i >= argc) {
+        printf("MEG-4 Scaler Benchmark by bzt Copyright (C) 2023 GPLv3+\r\n\r\n");
+        printf("%s [-f frames] [-t threads] [-b] <mode>\r\n\r\nModes:\r\n", argv[0]);
+        for(m = 0; modes[m].name; m++) printf("  %-10s %s\r\n", modes[m].name, modes[m].desc);
+        return 0;
+    }
+    for(m = 0; modes[m].name && strcmp(modes[m].name, argv[i]); m++);
+    if(!modes[m].name) { printf("unknown mode '%s'\r\n", argv[i]); return 1; }
+    if(frames < 1) frames = 1;
+
+    /* noisy source image with some gradients, and a destination with some padding at the end of each row */
+    dp = (modes[m].dw + 16) * 4;
+    src = (uint32_t*)malloc(SRCP * 400);
+    dst = (uint32_t*)malloc(dp * modes[m].dh);
+    if(!src || !dst) { printf("unable to allocate memory\r\n"); return 1; }
+    memset(dst, 0, dp * modes[m].dh);
+    srand(1);
+    for(i = 0; i < 640 * 400; i++)
+        src[i] = 0xff000000 | ((rand() & 0x3f) << 16) | (((i % 640) * 255 / 640) << 8) | ((i / 640) * 255 / 400);
+    scaler_threads(threads);
+
+    /* the first frame is a warm-up, it allocates buffers and starts the threads */
+    for(f = 0; f <= frames; f++) {
+        if(f == 1) clock_gettime(CLOCK_MONOTONIC, &t0);
+        switch(modes[m].name[0]) {
+            case 'i': scaler_integer(dst, dp, src, modes[m].sw, modes[m].sh, SRCP, modes[m].dw / modes[m].sw, bgra); break;
+            case 'n': scaler_nearest(dst, modes[m].dw, modes[m].dh, dp, src, modes[m].sw, modes[m].sh, SRCP, bgra); break;
+            default: scaler_bilinear(dst, modes[m].dw, modes[m].dh, dp, src, modes[m].sw, modes[m].sh, SRCP, bgra); break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ms = (double)(t1.tv_sec - t0.tv_sec) * 1000.0 + (double)(t1.tv_nsec - t0.tv_nsec) / 1000000.0;
+    printf("%s: %d frames, %d threads, %s, %s, %.3f ms/frame, checksum %08x\r\n", modes[m].name, frames, threads,
+        bgra ? "BGRA" : "RGBA",
+#if defined(SCALER_SSE2)
+        "SSE2",
+#elif defined(SCALER_NEON)
+        "NEON",
+#else
+        "no SIMD",
+#endif
+        ms / frames, checksum(dst, modes[m].dw, modes[m].dh, dp));
+
+    /* free resources */
+    scaler_free();
+    free(src); free(dst);
+    return 0;
+}